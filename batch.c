@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+
+// Name of the WAV file of an IQ file: its extension replaced by .wav.
+static char *wav_path_for(const char *iq_path) {
+    const char *slash = strrchr(iq_path, '/');
+    const char *dot = strrchr(iq_path, '.');
+    size_t len = strlen(iq_path);
+
+    if (dot != NULL && (slash == NULL || dot > slash + 1)) len = dot - iq_path;
+    char *path = malloc(len + 5);
+    if (path == NULL) return NULL;
+    memcpy(path, iq_path, len);
+    memcpy(path + len, ".wav", 5);
+    return path;
+}
+
+// Read len bytes at offset of fd. Returns 0 on success and -1 on failure.
+static int read_at(int fd, uint8_t *buffer, long long offset, int len) {
+    while (len > 0) {
+        ssize_t count = pread(fd, buffer, len, offset);
+        if (count <= 0) return -1;
+        buffer += count;
+        offset += count;
+        len -= count;
+    }
+    return 0;
+}
+
+// Demodulate the samples of the file before the segment with a fresh
+// pipeline, discarding their audio, and save the state it reaches. The
+// warm-up starts on a multiple of the decimation factor, where the phases of
+// the decimators of a single-threaded run are back to 0. Returns 0 on success
+// and -1 on failure.
+static int warm_up(Batch *batch, BatchSegment *segment, Pipeline *pipeline, uint8_t *buffer, int fd) {
+    long long period = 2 * DECIMATION_FACTOR;
+    long long warmup_bytes = (long long)(BATCH_WARMUP_SECONDS * SAMPLE_RATE) * 2;
+    long long offset = segment->start - (warmup_bytes + batch->block_size - 1) / batch->block_size * batch->block_size;
+
+    if (offset < 0) offset = 0;
+    offset -= offset % period;
+    while (offset < segment->start) {
+        int len = batch->block_size;
+        if (len > segment->start - offset) len = segment->start - offset;
+        if (read_at(fd, buffer, offset, len) < 0) return -1;
+        pipeline_process(pipeline, buffer, len);
+        offset += len;
+    }
+    pipeline_save_state(pipeline, segment->start_state);
+    return 0;
+}
+
+// Demodulate the blocks of the segment, cut as a single-threaded run reading
+// the whole file cuts them, keeping their audio in the segment and saving the
+// state at the checkpoints and at the end. With resync the segment was
+// already demodulated after a warm-up: the audio is overwritten, and kept
+// from the first checkpoint where the state is the saved one. Returns 0 on
+// success and -1 on failure.
+static int demodulate_segment(Batch *batch, BatchSegment *segment, Pipeline *pipeline, uint8_t *buffer, int fd,
+        int resync) {
+    long long size = batch->sizes[segment->file];
+    size_t audio_len = segment->audio_len;
+
+    segment->audio_len = 0;
+    for (long long offset = segment->start; offset < segment->end; offset += batch->block_size) {
+        int len = batch->block_size;
+        if (len > size - offset) len = size - offset;
+        len &= ~1;
+        if (len < 4) break;
+        if (read_at(fd, buffer, offset, len) < 0) return -1;
+
+        int count = pipeline_process(pipeline, buffer, len);
+        if (segment->audio_len + count > segment->audio_capacity) {
+            size_t capacity = 2 * (segment->audio_len + count);
+            int16_t *audio = realloc(segment->audio, capacity * sizeof(int16_t));
+            if (audio == NULL) return -1;
+            segment->audio = audio;
+            segment->audio_capacity = capacity;
+        }
+        memcpy(segment->audio + segment->audio_len, pipeline->int_samples, count * sizeof(int16_t));
+        segment->audio_len += count;
+        if (resync) batch->resync_bytes += len;
+
+        long long next = offset + batch->block_size - segment->start;
+        if (batch->state_size == 0 || offset + batch->block_size >= segment->end ||
+                next % batch->checkpoint_size != 0) {
+            continue;
+        }
+        uint8_t *checkpoint = segment->checkpoints + (next / batch->checkpoint_size - 1) * batch->state_size;
+        if (!resync) {
+            pipeline_save_state(pipeline, checkpoint);
+            continue;
+        }
+        pipeline_save_state(pipeline, batch->resync_state);
+        if (memcmp(batch->resync_state, checkpoint, batch->state_size) == 0) {
+            segment->audio_len = audio_len;
+            return 0;
+        }
+    }
+    if (batch->state_size > 0) pipeline_save_state(pipeline, segment->end_state);
+    return 0;
+}
+
+// Demodulate segment k with a fresh pipeline, after a warm-up unless it
+// starts its file. Returns 0 on success and -1 on failure.
+static int process_segment(Batch *batch, int k, Pipeline *pipeline, uint8_t *buffer) {
+    BatchSegment *segment = &batch->segments[k];
+    int fd = open(batch->iq_paths[segment->file], O_RDONLY);
+    if (fd < 0) return -1;
+
+    int result = pipeline_init(pipeline, &batch->config, batch->block_size);
+    if (result == 0) {
+        segment->audio_capacity = (segment->end - segment->start) / (2 * DECIMATION_FACTOR) +
+            pipeline_max_output(pipeline);
+        segment->audio = malloc(segment->audio_capacity * sizeof(int16_t));
+        if (segment->audio == NULL) result = -1;
+        if (result == 0 && segment->start > 0) result = warm_up(batch, segment, pipeline, buffer, fd);
+        if (result == 0) result = demodulate_segment(batch, segment, pipeline, buffer, fd, 0);
+        pipeline_free(pipeline);
+    }
+    close(fd);
+    return result;
+}
+
+// Demodulate segment k again, from the state the previous segment ended
+// with. Returns 0 on success and -1 on failure.
+static int resync_segment(Batch *batch, int k, Pipeline *pipeline, uint8_t *buffer) {
+    BatchSegment *segment = &batch->segments[k];
+    int fd = open(batch->iq_paths[segment->file], O_RDONLY);
+    int result = fd < 0 ? -1 : pipeline_init(pipeline, &batch->config, batch->block_size);
+
+    if (result == 0) {
+        pipeline_load_state(pipeline, batch->segments[k - 1].end_state);
+        result = demodulate_segment(batch, segment, pipeline, buffer, fd, 1);
+        pipeline_free(pipeline);
+    }
+    if (fd >= 0) close(fd);
+    return result;
+}
+
+// Write the segments demodulated so far, in order, called with the lock held
+// by one worker at a time. A segment whose warm-up did not reach the state the
+// previous one ended with is first demodulated again from that state, usually
+// up to its first checkpoint. The lock is released meanwhile, so the other
+// workers carry on with their segments: the segments before it are written
+// and nobody else writes until writing is cleared. Returns 0 on success and
+// -1 on failure.
+static int write_segments(Batch *batch, Pipeline *pipeline, uint8_t *buffer) {
+    while (batch->next_write < batch->num_segments && batch->segments[batch->next_write].done) {
+        int k = batch->next_write;
+        BatchSegment *segment = &batch->segments[k];
+        const char *path = batch->wav_paths[segment->file];
+
+        if (segment->start == 0) {
+            if (wav_output_open(&batch->output, batch->writer, path) < 0) {
+                fprintf(stderr, "Failed to create %s.\n", path);
+                return -1;
+            }
+            batch->output_open = 1;
+        } else if (memcmp(segment->start_state, batch->segments[k - 1].end_state, batch->state_size) != 0) {
+            pthread_mutex_unlock(&batch->lock);
+            int result = resync_segment(batch, k, pipeline, buffer);
+            pthread_mutex_lock(&batch->lock);
+            if (result < 0) {
+                fprintf(stderr, "An error occurred while reading %s.\n", batch->iq_paths[segment->file]);
+                return -1;
+            }
+            batch->resyncs++;
+        }
+
+        if (wav_output_write(&batch->output, segment->audio, segment->audio_len) < 0) {
+            fprintf(stderr, "An error occurred while writing %s.\n", path);
+            return -1;
+        }
+        free(segment->audio);
+        segment->audio = NULL;
+        if (k + 1 == batch->num_segments || batch->segments[k + 1].file != segment->file) {
+            batch->output_open = 0;
+            if (wav_output_close(&batch->output) < 0) {
+                fprintf(stderr, "An error occurred while writing %s.\n", path);
+                return -1;
+            }
+        }
+        batch->next_write++;
+    }
+    return 0;
+}
+
+// Body of every worker: demodulate the next segment nobody took yet, then
+// write whatever is ready unless another worker is already doing so, until
+// there is none left.
+static void batch_worker(void *context, int task, int worker) {
+    Batch *batch = context;
+    Pipeline *pipeline = alloc_aligned(sizeof(Pipeline));
+    uint8_t *buffer = alloc_aligned(batch->block_size);
+
+    pthread_mutex_lock(&batch->lock);
+    if (pipeline == NULL || buffer == NULL) batch->error = 1;
+    while (!batch->error && batch->next_segment < batch->num_segments) {
+        int k = batch->next_segment++;
+        pthread_mutex_unlock(&batch->lock);
+
+        int result = process_segment(batch, k, pipeline, buffer);
+        if (result < 0) {
+            fprintf(stderr, "An error occurred while reading %s.\n", batch->iq_paths[batch->segments[k].file]);
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        batch->segments[k].done = 1;
+        if (result < 0) batch->error = 1;
+        if (!batch->error && !batch->writing) {
+            batch->writing = 1;
+            if (write_segments(batch, pipeline, buffer) < 0) batch->error = 1;
+            batch->writing = 0;
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+    free(pipeline);
+    free(buffer);
+}
+
+// Prepare the demodulation of num_files IQ files on num_threads pinned
+// workers, with blocks of block_size bytes. Returns 0 on success and -1 on
+// failure.
+int batch_init(Batch *batch, const PipelineConfig *config, int block_size, const char **iq_paths,
+        int num_files, int num_threads) {
+    memset(batch, 0, sizeof(Batch));
+    batch->config = *config;
+    batch->block_size = block_size;
+    batch->num_files = num_files;
+    batch->iq_paths = iq_paths;
+    batch->wav_paths = calloc(num_files, sizeof(char *));
+    batch->sizes = calloc(num_files, sizeof(long long));
+    pthread_mutex_init(&batch->lock, NULL);
+    if (batch->wav_paths == NULL || batch->sizes == NULL) return -1;
+
+    for (int f = 0; f < num_files; f++) {
+        struct stat st;
+        if (stat(iq_paths[f], &st) < 0 || !S_ISREG(st.st_mode)) {
+            fprintf(stderr, "Failed to open IQ file %s.\n", iq_paths[f]);
+            return -1;
+        }
+        batch->sizes[f] = st.st_size;
+        batch->total_bytes += st.st_size;
+        batch->wav_paths[f] = wav_path_for(iq_paths[f]);
+        if (batch->wav_paths[f] == NULL) return -1;
+        for (int g = 0; g < num_files; g++) {
+            if (strcmp(batch->wav_paths[f], iq_paths[g]) == 0) {
+                fprintf(stderr, "The IQ file %s would be overwritten by the audio of %s.\n", iq_paths[g],
+                        iq_paths[f]);
+                return -1;
+            }
+        }
+        for (int g = 0; g < f; g++) {
+            if (strcmp(batch->wav_paths[f], batch->wav_paths[g]) == 0) {
+                fprintf(stderr, "The IQ files %s and %s would both be written to %s.\n", iq_paths[g], iq_paths[f],
+                        batch->wav_paths[f]);
+                return -1;
+            }
+        }
+    }
+
+    // Only a pipeline that saves its whole state lets a file be split.
+    Pipeline probe;
+    if (pipeline_init(&probe, config, block_size) < 0) return -1;
+    if (config->offset == 0.0) batch->state_size = pipeline_state_size(&probe);
+    pipeline_free(&probe);
+
+    // Segments of whole blocks, enough of them for every thread.
+    long long segment_size = LLONG_MAX;
+    if (batch->state_size > 0) {
+        segment_size = (batch->total_bytes + num_threads - 1) / num_threads;
+        if (segment_size < BATCH_MIN_SEGMENT_SIZE) segment_size = BATCH_MIN_SEGMENT_SIZE;
+        if (segment_size > BATCH_MAX_SEGMENT_SIZE) segment_size = BATCH_MAX_SEGMENT_SIZE;
+        segment_size = (segment_size + block_size - 1) / block_size * block_size;
+        batch->checkpoint_size = (BATCH_CHECKPOINT_SIZE + block_size - 1) / block_size * block_size;
+        batch->resync_state = malloc(batch->state_size);
+        if (batch->resync_state == NULL) return -1;
+    }
+    for (int f = 0; f < num_files; f++) {
+        long long count = batch->state_size > 0 ? (batch->sizes[f] + segment_size - 1) / segment_size : 1;
+        batch->num_segments += count > 1 ? count : 1;
+    }
+    batch->segments = calloc(batch->num_segments, sizeof(BatchSegment));
+    if (batch->segments == NULL) return -1;
+    int k = 0;
+    for (int f = 0; f < num_files; f++) {
+        long long start = 0;
+        do {
+            BatchSegment *segment = &batch->segments[k++];
+            segment->file = f;
+            segment->start = start;
+            segment->end = batch->sizes[f] - start > segment_size ? start + segment_size : batch->sizes[f];
+            if (batch->state_size > 0) {
+                long long num_checkpoints = (segment->end - segment->start - 1) / batch->checkpoint_size;
+                segment->start_state = malloc(batch->state_size);
+                segment->checkpoints = malloc((num_checkpoints > 0 ? num_checkpoints : 1) * batch->state_size);
+                segment->end_state = malloc(batch->state_size);
+                if (segment->start_state == NULL || segment->checkpoints == NULL || segment->end_state == NULL) {
+                    return -1;
+                }
+            }
+            start = segment->end;
+        } while (start < batch->sizes[f]);
+    }
+
+    return pool_init(&batch->pool, num_threads, 0);
+}
+
+// Demodulate all the files, writing the audio through writer. Returns 0 on
+// success and -1 on failure.
+int batch_run(Batch *batch, Writer *writer) {
+    batch->writer = writer;
+    pool_run(&batch->pool, batch_worker, batch, batch->pool.num_threads);
+    // After an error, complete the header of the file being written.
+    if (batch->output_open) wav_output_close(&batch->output);
+    return batch->error ? -1 : 0;
+}
+
+void batch_free(Batch *batch) {
+    if (batch->pool.num_threads > 0) pool_free(&batch->pool);
+    for (int k = 0; k < batch->num_segments; k++) {
+        free(batch->segments[k].audio);
+        free(batch->segments[k].start_state);
+        free(batch->segments[k].checkpoints);
+        free(batch->segments[k].end_state);
+    }
+    for (int f = 0; f < batch->num_files && batch->wav_paths != NULL; f++) free(batch->wav_paths[f]);
+    free(batch->segments);
+    free(batch->wav_paths);
+    free(batch->sizes);
+    free(batch->resync_state);
+    pthread_mutex_destroy(&batch->lock);
+    memset(batch, 0, sizeof(Batch));
+}
@@ -0,0 +1,98 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "pipeline.h"
+#include "pool.h"
+#include "writer.h"
+
+// Demodulation of archives of IQ recordings on all the cores.
+//
+// Each file is written to a WAV file of its own. The files are cut into
+// segments of whole blocks, so that every worker has some to demodulate even
+// with a single file, and the workers of a WorkerPool take the next segment
+// as soon as they are done with the previous one. The audio of a segment is
+// kept in memory until the segments before it are written.
+//
+// A segment that does not start its file needs the filter state the previous
+// segment ends with. Its worker starts a fresh pipeline on the samples just
+// before the segment, a warm-up whose audio is thrown away: the FIR histories
+// fill with the same samples and the recursive filters forget where they
+// started, but only down to float rounding, so the state at the start of the
+// segment is often a few ulps away from the one of a single-threaded run. This
+// is checked when the segment is written, against the state the previous
+// segment ended with. On a mismatch the segment is demodulated again from that
+// carried state, only until the two runs reach the same state at one of the
+// checkpoints saved along the segment: from there on they are the same. The
+// audio is therefore byte-identical to a single-threaded run with the same
+// block size. The fixed engine has no state to compare and the NCO phase of a
+// station offset depends on all the samples before, so with them every file
+// is a single segment.
+
+// Largest segment, and smallest one a file is cut into to give work to more
+// threads.
+#define BATCH_MAX_SEGMENT_SIZE (256 * 1024 * 1024)
+#define BATCH_MIN_SEGMENT_SIZE (4 * 1024 * 1024)
+// Samples demodulated before a segment to settle the filters.
+#define BATCH_WARMUP_SECONDS 0.05
+// Distance between two checkpoints of the state in a segment.
+#define BATCH_CHECKPOINT_SIZE (1024 * 1024)
+
+typedef struct {
+    int file;                   // Index of the file
+    long long start;            // Bytes of the file in the segment
+    long long end;
+    int done;                   // Demodulated, under lock
+
+    // Audio of the segment, until it is written.
+    int16_t *audio;
+    size_t audio_len;
+    size_t audio_capacity;
+
+    // Pipeline state after the warm-up, at the checkpoints and at the end of
+    // the segment.
+    uint8_t *start_state;
+    uint8_t *checkpoints;
+    uint8_t *end_state;
+} BatchSegment;
+
+typedef struct {
+    PipelineConfig config;
+    int block_size;
+    int num_files;
+    const char **iq_paths;
+    char **wav_paths;
+    long long *sizes;
+    long long total_bytes;
+    size_t state_size;          // 0 if the files are not split
+    int checkpoint_size;        // Bytes between two checkpoints, whole blocks
+
+    int num_segments;
+    BatchSegment *segments;
+    WorkerPool pool;
+    Writer *writer;
+    WavOutput output;           // WAV file of the segment to write next
+    int output_open;
+
+    // Shared by the workers and protected by lock.
+    pthread_mutex_t lock;
+    int next_segment;           // Next segment to demodulate
+    int next_write;             // Next segment to write
+    int writing;                // A worker is writing, or demodulating one again
+    int error;
+
+    // Only used by the worker writing.
+    int resyncs;                // Segments demodulated again
+    long long resync_bytes;     // IQ bytes demodulated again
+    uint8_t *resync_state;      // Current state of the segment demodulated again
+} Batch;
+
+int batch_init(Batch *batch, const PipelineConfig *config, int block_size, const char **iq_paths,
+        int num_files, int num_threads);
+int batch_run(Batch *batch, Writer *writer);
+void batch_free(Batch *batch);
+
+#endif
@@ -0,0 +1,1837 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "channelizer.h"
+#include "cpu.h"
+#include "dsp.h"
+#include "convert.h"
+#include "kernels.h"
+#include "nco.h"
+#include "decimator.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "synth.h"
+#include "writer.h"
+
+// Benchmarks for the DSP kernels.
+// The input is a synthetic FM signal, so the benchmarks run on any host,
+// without a dongle or recorded captures.
+
+// Seconds of synthetic IQ samples processed by each benchmark.
+#define BENCH_SECONDS 2
+// Number of timed runs of each kernel, the fastest one is reported.
+#define BENCH_RUNS 5
+// Test signal: a tone modulated with the maximum deviation of broadcast FM.
+#define BENCH_TONE_FREQ 1000.0
+#define BENCH_DEVIATION 75000.0
+// Audio skipped before measuring the quality of the recovered audio, while
+// the filters settle.
+#define SETTLE_SECONDS 0.1
+// Harmonics of a tone included in its THD.
+#define THD_HARMONICS 5
+// Windows over which the level of a sweep is measured.
+#define SWEEP_WINDOW_SECONDS 0.01
+// Seconds of audio written to each file by the output benchmark.
+#define WRITER_BENCH_SECONDS 20
+// Seconds of wideband samples split by the channelizer benchmark, shorter as
+// the reference runs a complete filter per channel.
+#define CHANNELIZER_BENCH_SECONDS 0.5
+// Seconds of wideband capture demodulated by each configuration of the worker
+// pool benchmark.
+#define POOL_BENCH_SECONDS 0.5
+// Offset of the station from the center of the capture in the NCO benchmark.
+#define NCO_BENCH_OFFSET 250000
+
+double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Fill iq with an FM modulated tone in the rtl-sdr format (interleaved uint8
+// I/Q samples centered on 127.5).
+void generate_fm_tone(uint8_t *iq, int num_samples, double tone_freq, double deviation) {
+    SynthConfig config = synth_default_config(SAMPLE_RATE);
+    SynthState state;
+
+    config.tones[0] = tone_freq;
+    config.deviation = deviation;
+    synth_init(&state, &config);
+    synth_generate(&state, iq, num_samples);
+}
+
+// Run the whole processing chain over the IQ samples, one BUFFER_SIZE block at
+// a time like the main loop does, and store the decimated audio.
+// Returns the number of audio samples.
+int run_chain(float *audio, uint8_t *iq, int len, Discriminator discriminator, const AtanApprox *approx) {
+    float *freq_samples = alloc_aligned(sizeof(float) * BUFFER_SIZE / 2);
+    float *i_samples = alloc_aligned(sizeof(float) * BUFFER_SIZE / 2);
+    float *q_samples = alloc_aligned(sizeof(float) * BUFFER_SIZE / 2);
+    DemodState state;
+    int audio_len = 0;
+
+    demod_state_init(&state, SAMPLE_RATE, 0);
+    for (int start = 0; start + BUFFER_SIZE <= len; start += BUFFER_SIZE) {
+        demodulate(freq_samples, i_samples, q_samples, iq + start, BUFFER_SIZE, &state, discriminator, approx);
+        audio_len += decimate(audio + audio_len, freq_samples, BUFFER_SIZE / 2);
+    }
+
+    free(freq_samples);
+    free(i_samples);
+    free(q_samples);
+    return audio_len;
+}
+
+// Signal to noise ratio in dB of test, taking the difference from reference
+// as the noise.
+double snr_db(const float *reference, const float *test, int len) {
+    double signal = 0.0;
+    double noise = 0.0;
+
+    for (int i = 0; i < len; i++) {
+        double diff = (double)test[i] - reference[i];
+        signal += (double)reference[i] * reference[i];
+        noise += diff * diff;
+    }
+
+    if (noise == 0.0) return INFINITY;
+    return 10.0 * log10(signal / noise);
+}
+
+// Time get_freq_values alone and return the cost in nanoseconds per sample.
+double time_discriminator(float *freq_samples, float *i_samples, float *q_samples, int len,
+        Discriminator discriminator, const AtanApprox *approx) {
+    double best = INFINITY;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = monotonic_seconds();
+        get_freq_values(freq_samples, i_samples, q_samples, 0.0f, 0.0f, len, discriminator, approx);
+        double elapsed = monotonic_seconds() - start;
+        if (elapsed < best) best = elapsed;
+    }
+
+    return best * 1e9 / len;
+}
+
+// Compare the discriminators: cost of get_freq_values and SNR of the final
+// audio, taking the polar discriminator with the libm arctan as reference.
+void bench_discriminators(uint8_t *iq, int num_samples) {
+    float *i_samples = malloc(sizeof(float) * num_samples);
+    float *q_samples = malloc(sizeof(float) * num_samples);
+    float *freq_samples = malloc(sizeof(float) * num_samples);
+    float *reference = calloc(num_samples / DECIMATION_FACTOR, sizeof(float));
+    float *audio = malloc(sizeof(float) * (num_samples / DECIMATION_FACTOR));
+
+    for (int i = 0; i < num_samples; i++) {
+        i_samples[i] = convert_value(iq[2 * i]);
+        q_samples[i] = convert_value(iq[2 * i + 1]);
+    }
+
+    int audio_len = run_chain(reference, iq, num_samples * 2, DISCRIMINATOR_POLAR, NULL);
+
+    printf("%-10s %14s %12s %14s %16s\n", "kernel", "max err (rad)", "ns/sample", "Msamples/s", "audio SNR (dB)");
+
+    Discriminator exact[] = { DISCRIMINATOR_ATAN2, DISCRIMINATOR_POLAR };
+    const char *exact_names[] = { "atan2", "polar" };
+    for (int k = 0; k < 2; k++) {
+        double ns = time_discriminator(freq_samples, i_samples, q_samples, num_samples, exact[k], NULL);
+
+        for (int i = 0; i < audio_len; i++) audio[i] = 0.0f;
+        run_chain(audio, iq, num_samples * 2, exact[k], NULL);
+
+        printf("%-10s %14s %12.2f %14.1f %16.1f\n", exact_names[k], "libm", ns, 1e3 / ns, snr_db(reference, audio, audio_len));
+    }
+
+    // Walk the available approximations from the least to the most accurate.
+    const AtanApprox *approx = NULL;
+    for (float max_error = 1.0f; approx == NULL || approx->max_error > 1e-7f; max_error = approx->max_error * 0.5f) {
+        const AtanApprox *next = atan_approx_for_error(max_error);
+        if (next == approx) break;
+        approx = next;
+
+        double ns = time_discriminator(freq_samples, i_samples, q_samples, num_samples, DISCRIMINATOR_FAST, approx);
+
+        for (int i = 0; i < audio_len; i++) audio[i] = 0.0f;
+        run_chain(audio, iq, num_samples * 2, DISCRIMINATOR_FAST, approx);
+
+        printf("%-10s %14.2e %12.2f %14.1f %16.1f\n", "fast", approx->max_error, ns, 1e3 / ns, snr_db(reference, audio, audio_len));
+    }
+
+    free(i_samples);
+    free(q_samples);
+    free(freq_samples);
+    free(reference);
+    free(audio);
+}
+
+// Compare the IQ conversion kernels available on this CPU. The throughput is
+// also reported in GB/s of input bytes, to compare it with memory bandwidth.
+void bench_conversion(uint8_t *iq, int num_samples) {
+    float *i_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *q_samples = alloc_aligned(sizeof(float) * num_samples);
+
+    printf("%-10s %12s %14s %12s\n", "kernel", "ns/sample", "Msamples/s", "input GB/s");
+
+    CpuLevel levels[] = { CPU_LEVEL_SCALAR, CPU_LEVEL_SSE2, CPU_LEVEL_AVX2, CPU_LEVEL_NEON };
+    for (int k = 0; k < 4; k++) {
+        DeinterleaveFn fn = deinterleave_for_level(levels[k]);
+        if (fn == NULL) continue;
+
+        double best = INFINITY;
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            double start = monotonic_seconds();
+            fn(i_samples, q_samples, iq, num_samples);
+            double elapsed = monotonic_seconds() - start;
+            if (elapsed < best) best = elapsed;
+        }
+
+        double ns = best * 1e9 / num_samples;
+        printf("%-10s %12.3f %14.1f %12.2f\n", cpu_level_name(levels[k]), ns, 1e3 / ns, 2.0 / ns);
+    }
+
+    // Lookup table strategies, with an IQ correction that the arithmetic
+    // kernels could not apply.
+    const IqCorrection correction = { 0.5f, -0.5f, 1.02f, 0.01f };
+    ConvertStrategy strategies[] = { CONVERT_LUT256, CONVERT_LUT65536 };
+    const char *strategy_names[] = { "lut256", "lut65536" };
+    for (int k = 0; k < 2; k++) {
+        convert_init(CPU_LEVEL_SCALAR, strategies[k], &correction);
+
+        double best = INFINITY;
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            double start = monotonic_seconds();
+            deinterleave_iq(i_samples, q_samples, iq, num_samples);
+            double elapsed = monotonic_seconds() - start;
+            if (elapsed < best) best = elapsed;
+        }
+
+        double ns = best * 1e9 / num_samples;
+        printf("%-10s %12.3f %14.1f %12.2f\n", strategy_names[k], ns, 1e3 / ns, 2.0 / ns);
+    }
+    convert_init(cpu_detect_level(), CONVERT_ARITHMETIC, NULL);
+    kernels_init(cpu_detect_level());
+
+    free(i_samples);
+    free(q_samples);
+}
+
+// Decimate len samples with the given decimator, one BUFFER_SIZE block at a
+// time. Returns the number of output samples.
+int run_decimator(DecimatorType type, FirDecimator *fir, float *output, float *input, int len) {
+    int count = 0;
+
+    for (int start = 0; start < len; start += BUFFER_SIZE / 2) {
+        int n = len - start < BUFFER_SIZE / 2 ? len - start : BUFFER_SIZE / 2;
+
+        if (type == DECIMATOR_FIR) {
+            count += fir_decimator_process(fir, output + count, input + start, n);
+        } else {
+            count += decimate(output + count, input + start, n);
+        }
+    }
+
+    return count;
+}
+
+// Compare the decimators: gain at frequencies in the audio band and
+// rejection of the frequencies that alias into it (everything above half the
+// audio rate), together with the cost per input sample.
+void bench_decimators(int num_samples) {
+    const double test_freqs[] = { 1000, 5000, 10000, 15000, 19000, 30000, 38000, 57000, 100000 };
+    const int num_freqs = sizeof(test_freqs) / sizeof(test_freqs[0]);
+    const int taps[] = { 64, 128, 256, FIR_DEFAULT_TAPS, 1024 };
+    const int num_taps = sizeof(taps) / sizeof(taps[0]);
+
+    float *input = alloc_aligned(sizeof(float) * num_samples);
+    float *output = alloc_aligned(sizeof(float) * (num_samples / DECIMATION_FACTOR + 1));
+
+    printf("%-12s %12s", "decimator", "ns/sample");
+    for (int f = 0; f < num_freqs; f++) printf(" %6.0fk", test_freqs[f] / 1000.0);
+    printf("  (gain in dB)\n");
+
+    for (int d = -1; d < num_taps; d++) {
+        DecimatorType type = d < 0 ? DECIMATOR_BOXCAR : DECIMATOR_FIR;
+        FirDecimator fir;
+        char name[32];
+
+        if (type == DECIMATOR_FIR) {
+            fir_decimator_init(&fir, DECIMATION_FACTOR, taps[d], FIR_CUTOFF, SAMPLE_RATE, BUFFER_SIZE / 2);
+            snprintf(name, sizeof(name), "fir-%d", taps[d]);
+        } else {
+            snprintf(name, sizeof(name), "boxcar");
+        }
+
+        for (int i = 0; i < num_samples; i++) {
+            input[i] = (float)rand() / RAND_MAX - 0.5f;
+        }
+
+        double best = INFINITY;
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            double start = monotonic_seconds();
+            run_decimator(type, &fir, output, input, num_samples);
+            double elapsed = monotonic_seconds() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        printf("%-12s %12.3f", name, best * 1e9 / num_samples);
+
+        // Gain of a full scale tone, skipping the first output samples where
+        // the filter is still settling. Aliased tones come out at a different
+        // frequency, but with the same power.
+        for (int f = 0; f < num_freqs; f++) {
+            for (int i = 0; i < num_samples; i++) {
+                input[i] = sin(2.0 * M_PI * test_freqs[f] * i / SAMPLE_RATE);
+            }
+            if (type == DECIMATOR_FIR) fir_decimator_reset(&fir);
+
+            int count = run_decimator(type, &fir, output, input, num_samples);
+            double power = 0.0;
+            int skip = count / 10;
+            for (int i = skip; i < count; i++) {
+                power += (double)output[i] * output[i];
+            }
+            power /= count - skip;
+
+            printf(" %7.1f", 10.0 * log10(power / 0.5 + 1e-30));
+        }
+        printf("\n");
+
+        if (type == DECIMATOR_FIR) fir_decimator_free(&fir);
+    }
+
+    free(input);
+    free(output);
+}
+
+// Compare the cost of the decimation plans: multiply-accumulate operations per
+// audio sample and measured time per input IQ sample. The single stage FIR
+// runs after the discriminator on real samples, while the multistage plan
+// filters complex samples before it, so that the discriminator itself runs at
+// a lower rate.
+void bench_decimation_plans(int num_samples) {
+    float *i_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *q_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *output = alloc_aligned(sizeof(float) * (num_samples / DECIMATION_FACTOR + 1));
+
+    for (int i = 0; i < num_samples; i++) {
+        i_samples[i] = (float)rand() / RAND_MAX - 0.5f;
+        q_samples[i] = (float)rand() / RAND_MAX - 0.5f;
+    }
+
+    FirDecimator fir;
+    fir_decimator_init(&fir, DECIMATION_FACTOR, FIR_DEFAULT_TAPS, FIR_CUTOFF, SAMPLE_RATE, BUFFER_SIZE / 2);
+    double best = INFINITY;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = monotonic_seconds();
+        run_decimator(DECIMATOR_FIR, &fir, output, i_samples, num_samples);
+        double elapsed = monotonic_seconds() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    printf("single stage FIR %d taps: %d MACs per audio sample, %.3f ns per IQ sample\n",
+            FIR_DEFAULT_TAPS, FIR_DEFAULT_TAPS, best * 1e9 / num_samples);
+    fir_decimator_free(&fir);
+
+    MultistageDecimator multistage;
+    multistage_init(&multistage, SAMPLE_RATE, AUDIO_RATE, BUFFER_SIZE / 2);
+    best = INFINITY;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = monotonic_seconds();
+        int count = 0;
+        for (int s = 0; s + BUFFER_SIZE / 2 <= num_samples; s += BUFFER_SIZE / 2) {
+            int iq_len = multistage_process_iq(&multistage, i_samples + s, q_samples + s, BUFFER_SIZE / 2);
+            count += fir_decimator_process(&multistage.audio, output + count, i_samples + s, iq_len);
+        }
+        double elapsed = monotonic_seconds() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    printf("multistage: %.1f MACs per audio sample, %.3f ns per IQ sample\n",
+            multistage_macs_per_output(&multistage, SAMPLE_RATE, AUDIO_RATE), best * 1e9 / num_samples);
+    multistage_print_plan(&multistage, SAMPLE_RATE, AUDIO_RATE, stdout);
+    multistage_free(&multistage);
+
+    free(i_samples);
+    free(q_samples);
+    free(output);
+}
+
+// Filter the frequency samples with one of the formulations of a first order
+// filter, a block of BUFFER_SIZE / 2 samples at a time, into output.
+// Returns the best time per sample in nanoseconds.
+double time_first_order(const FirstOrderFilter *filter, float *output, const float *input, int len, int num_chunks) {
+    double best = INFINITY;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        memcpy(output, input, sizeof(float) * len);
+        float last_output = 0.0f;
+
+        double start = monotonic_seconds();
+        for (int offset = 0; offset < len; offset += BUFFER_SIZE / 2) {
+            int n = len - offset < BUFFER_SIZE / 2 ? len - offset : BUFFER_SIZE / 2;
+            if (num_chunks == 0) {
+                last_output = first_order_serial(filter, output + offset, n, last_output);
+            } else if (num_chunks == 1) {
+                last_output = first_order_block(filter, output + offset, n, last_output);
+            } else {
+                last_output = first_order_chunks(filter, output + offset, n, last_output, num_chunks);
+            }
+        }
+        double elapsed = monotonic_seconds() - start;
+        if (elapsed < best) best = elapsed;
+    }
+
+    return best * 1e9 / len;
+}
+
+// Compare the serial evaluation of the de-emphasis and DC block filters with
+// the block formulation and with the chunked one used to split a stream across
+// cores, reporting the largest difference from the serial output.
+void bench_recursive_filters(uint8_t *iq, int num_samples) {
+    float *i_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *q_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *freq_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *reference = alloc_aligned(sizeof(float) * num_samples);
+    float *output = alloc_aligned(sizeof(float) * num_samples);
+    const int chunks[] = { 0, 1, 4, 16 };
+    DemodState state;
+
+    deinterleave_iq(i_samples, q_samples, iq, num_samples);
+    get_freq_values(freq_samples, i_samples, q_samples, 0.0f, 0.0f, num_samples, DISCRIMINATOR_POLAR, NULL);
+    demod_state_init(&state, SAMPLE_RATE, 0);
+
+    printf("%-12s %-12s %12s %14s\n", "filter", "evaluation", "ns/sample", "max error");
+    for (int f = 0; f < 2; f++) {
+        const FirstOrderFilter *filter = f == 0 ? &state.deemph_filter : &state.dc_filter;
+
+        time_first_order(filter, reference, freq_samples, num_samples, 0);
+        for (int c = 0; c < 4; c++) {
+            double ns = time_first_order(filter, output, freq_samples, num_samples, chunks[c]);
+
+            double max_error = 0.0;
+            for (int i = 0; i < num_samples; i++) {
+                double error = fabs((double)output[i] - reference[i]);
+                if (error > max_error) max_error = error;
+            }
+
+            char name[32];
+            if (chunks[c] == 0) snprintf(name, sizeof(name), "serial");
+            else if (chunks[c] == 1) snprintf(name, sizeof(name), "block");
+            else snprintf(name, sizeof(name), "%d chunks", chunks[c]);
+            printf("%-12s %-12s %12.3f %14.2e\n", f == 0 ? "de-emphasis" : "DC block", name, ns, max_error);
+        }
+    }
+
+    free(i_samples);
+    free(q_samples);
+    free(freq_samples);
+    free(reference);
+    free(output);
+}
+
+// Run the complete pipeline over the IQ samples in blocks of block_size bytes.
+// Returns the time per IQ sample in nanoseconds and stores the heap
+// allocations per block in *allocations.
+double time_pipeline(uint8_t *iq, int num_samples, const PipelineConfig *config, int block_size, double *allocations) {
+    Pipeline pipeline;
+    if (pipeline_init(&pipeline, config, block_size) < 0) {
+        fprintf(stderr, "Failed to allocate the pipeline.\n");
+        exit(1);
+    }
+
+    int blocks = 0;
+    double start = monotonic_seconds();
+    for (int offset = 0; offset + block_size <= num_samples * 2; offset += block_size) {
+        pipeline_process(&pipeline, iq + offset, block_size);
+        blocks++;
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    *allocations = (double)pipeline.steady_allocations / blocks;
+    pipeline_free(&pipeline);
+    return elapsed * 1e9 / (blocks * (block_size / 2));
+}
+
+// Cost of one stage of the processing chain. rate is the number of samples per
+// second the stage has to process to keep up with the dongle.
+typedef struct {
+    const char *name;
+    int rate;
+    double ns_per_sample;
+} StageResult;
+
+enum {
+    STAGE_DEINTERLEAVE,
+    STAGE_POLAR,
+    STAGE_FAST,
+    STAGE_DEEMPHASIS,
+    STAGE_DC_BLOCK,
+    STAGE_BOXCAR,
+    STAGE_FIR,
+    STAGE_CONVERT,
+    STAGE_PIPELINE,
+    NUM_STAGES
+};
+
+// Time each stage of the staged chain separately, running them in the order of
+// the pipeline, one BUFFER_SIZE block at a time, so that every stage sees the
+// data it sees when recording. The fast discriminator and the boxcar decimator
+// run on the same data as the polar discriminator and the FIR they replace.
+// The complete default pipeline is timed last, as a reference.
+void bench_stages(uint8_t *iq, int num_samples, StageResult *results) {
+    const int block_samples = BUFFER_SIZE / 2;
+    const AtanApprox *approx = atan_approx_for_error(ATAN_DEFAULT_MAX_ERROR);
+    float *i_samples = alloc_aligned(sizeof(float) * block_samples);
+    float *q_samples = alloc_aligned(sizeof(float) * block_samples);
+    float *freq_samples = alloc_aligned(sizeof(float) * block_samples);
+    float *scratch = alloc_aligned(sizeof(float) * block_samples);
+    float *audio = alloc_aligned(sizeof(float) * block_samples);
+    int16_t *int_samples = alloc_aligned(sizeof(int16_t) * block_samples);
+    const char *names[NUM_STAGES] = {
+        "deinterleave_iq", "get_freq_values/polar", "get_freq_values/fast", "deemphasize_filter",
+        "dc_block_filter", "decimate/boxcar", "decimate/fir", "convert_samples", "pipeline"
+    };
+    double best[NUM_STAGES];
+    long samples[NUM_STAGES] = { 0 };
+
+    for (int k = 0; k < NUM_STAGES; k++) best[k] = INFINITY;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double total[NUM_STAGES] = { 0.0 };
+        DemodState state;
+        FirDecimator fir;
+        float last_i = 0.0f, last_q = 0.0f;
+
+        demod_state_init(&state, SAMPLE_RATE, 1);
+        fir_decimator_init(&fir, DECIMATION_FACTOR, FIR_DEFAULT_TAPS, FIR_CUTOFF, SAMPLE_RATE, block_samples);
+
+        for (int offset = 0; offset + BUFFER_SIZE <= num_samples * 2; offset += BUFFER_SIZE) {
+            double t[NUM_STAGES];
+            double start = monotonic_seconds();
+
+            deinterleave_iq(i_samples, q_samples, iq + offset, block_samples);
+            t[STAGE_DEINTERLEAVE] = monotonic_seconds();
+            get_freq_values(scratch, i_samples, q_samples, last_i, last_q, block_samples, DISCRIMINATOR_FAST, approx);
+            t[STAGE_FAST] = monotonic_seconds();
+            get_freq_values(freq_samples, i_samples, q_samples, last_i, last_q, block_samples, DISCRIMINATOR_POLAR, NULL);
+            t[STAGE_POLAR] = monotonic_seconds();
+            deemphasize_filter(freq_samples, block_samples, &state);
+            t[STAGE_DEEMPHASIS] = monotonic_seconds();
+            dc_block_filter(freq_samples, block_samples, &state);
+            t[STAGE_DC_BLOCK] = monotonic_seconds();
+            decimate(audio, freq_samples, block_samples);
+            t[STAGE_BOXCAR] = monotonic_seconds();
+            int count = fir_decimator_process(&fir, audio, freq_samples, block_samples);
+            t[STAGE_FIR] = monotonic_seconds();
+            convert_samples(int_samples, audio, count);
+            t[STAGE_CONVERT] = monotonic_seconds();
+
+            total[STAGE_DEINTERLEAVE] += t[STAGE_DEINTERLEAVE] - start;
+            total[STAGE_FAST] += t[STAGE_FAST] - t[STAGE_DEINTERLEAVE];
+            total[STAGE_POLAR] += t[STAGE_POLAR] - t[STAGE_FAST];
+            total[STAGE_DEEMPHASIS] += t[STAGE_DEEMPHASIS] - t[STAGE_POLAR];
+            total[STAGE_DC_BLOCK] += t[STAGE_DC_BLOCK] - t[STAGE_DEEMPHASIS];
+            total[STAGE_BOXCAR] += t[STAGE_BOXCAR] - t[STAGE_DC_BLOCK];
+            total[STAGE_FIR] += t[STAGE_FIR] - t[STAGE_BOXCAR];
+            total[STAGE_CONVERT] += t[STAGE_CONVERT] - t[STAGE_FIR];
+
+            last_i = i_samples[block_samples - 1];
+            last_q = q_samples[block_samples - 1];
+            if (run == 0) {
+                for (int k = 0; k < STAGE_CONVERT; k++) samples[k] += block_samples;
+                samples[STAGE_CONVERT] += count;
+            }
+        }
+        fir_decimator_free(&fir);
+
+        for (int k = 0; k < STAGE_PIPELINE; k++) {
+            if (total[k] < best[k]) best[k] = total[k];
+        }
+    }
+
+    for (int k = 0; k < STAGE_PIPELINE; k++) {
+        results[k].name = names[k];
+        results[k].rate = k == STAGE_CONVERT ? AUDIO_RATE : SAMPLE_RATE;
+        results[k].ns_per_sample = best[k] * 1e9 / samples[k];
+    }
+
+    PipelineConfig config = pipeline_default_config();
+    double allocations;
+    double pipeline_ns = INFINITY;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double ns = time_pipeline(iq, num_samples, &config, BUFFER_SIZE, &allocations);
+        if (ns < pipeline_ns) pipeline_ns = ns;
+    }
+    results[STAGE_PIPELINE].name = names[STAGE_PIPELINE];
+    results[STAGE_PIPELINE].rate = SAMPLE_RATE;
+    results[STAGE_PIPELINE].ns_per_sample = pipeline_ns;
+
+    printf("%-22s %12s %14s %14s\n", "stage", "ns/sample", "Msamples/s", "x real time");
+    for (int k = 0; k < NUM_STAGES; k++) {
+        printf("%-22s %12.3f %14.1f %14.1f\n", results[k].name, results[k].ns_per_sample,
+                1e3 / results[k].ns_per_sample, 1e9 / (results[k].ns_per_sample * results[k].rate));
+    }
+
+    free(i_samples);
+    free(q_samples);
+    free(freq_samples);
+    free(scratch);
+    free(audio);
+    free(int_samples);
+}
+
+// Write the stage costs as a JSON document, to compare them between versions.
+// Returns 0 on success and -1 on failure.
+int write_stages_json(const char *path, const StageResult *results, int num_results) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) return -1;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"cpu_level\": \"%s\",\n", dsp_kernels->name);
+    fprintf(file, "  \"sample_rate\": %d,\n", SAMPLE_RATE);
+    fprintf(file, "  \"audio_rate\": %d,\n", AUDIO_RATE);
+    fprintf(file, "  \"block_size\": %d,\n", BUFFER_SIZE);
+    fprintf(file, "  \"seconds\": %d,\n", BENCH_SECONDS);
+    fprintf(file, "  \"stages\": [\n");
+    for (int k = 0; k < num_results; k++) {
+        const StageResult *r = &results[k];
+        fprintf(file, "    {\"name\": \"%s\", \"rate\": %d, \"ns_per_sample\": %.4f, "
+                "\"samples_per_second\": %.0f, \"realtime_factor\": %.2f}%s\n",
+                r->name, r->rate, r->ns_per_sample, 1e9 / r->ns_per_sample,
+                1e9 / (r->ns_per_sample * r->rate), k + 1 < num_results ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+// Run the complete pipeline with each decimator, reporting the real-time
+// factor and the heap allocations per block, which must be zero.
+void bench_pipeline(uint8_t *iq, int num_samples) {
+    DecimatorType types[] = { DECIMATOR_BOXCAR, DECIMATOR_FIR, DECIMATOR_MULTISTAGE };
+    const char *names[] = { "boxcar", "fir", "multistage" };
+
+    printf("%-12s %12s %14s %18s\n", "decimator", "ns/sample", "x real time", "allocations/block");
+
+    for (int k = 0; k < 3; k++) {
+        PipelineConfig config = pipeline_default_config();
+        config.decimator_type = types[k];
+
+        double allocations;
+        double ns = time_pipeline(iq, num_samples, &config, BUFFER_SIZE, &allocations);
+        printf("%-12s %12.2f %14.1f %18.2f\n", names[k], ns, 1e9 / (ns * SAMPLE_RATE), allocations);
+    }
+}
+
+// Count the audio samples that differ between the staged and the fused
+// kernels, running both over the same blocks.
+long count_fused_mismatches(uint8_t *iq, int num_samples, PipelineConfig config) {
+    Pipeline staged, fused;
+    long mismatches = 0;
+
+    config.fused = 0;
+    int result = pipeline_init(&staged, &config, BUFFER_SIZE);
+    config.fused = 1;
+    if (result < 0 || pipeline_init(&fused, &config, BUFFER_SIZE) < 0) {
+        fprintf(stderr, "Failed to allocate the pipeline.\n");
+        exit(1);
+    }
+
+    for (int offset = 0; offset + BUFFER_SIZE <= num_samples * 2; offset += BUFFER_SIZE) {
+        int count = pipeline_process(&staged, iq + offset, BUFFER_SIZE);
+        if (pipeline_process(&fused, iq + offset, BUFFER_SIZE) != count) return -1;
+
+        for (int i = 0; i < count; i++) {
+            if (memcmp(&staged.audio_samples[i], &fused.audio_samples[i], sizeof(float)) != 0) mismatches++;
+        }
+    }
+
+    pipeline_free(&staged);
+    pipeline_free(&fused);
+    return mismatches;
+}
+
+// Compare the staged kernel, which sweeps the whole block once per stage, with
+// the fused one, which moves tiles of FUSED_TILE samples through every stage.
+// The audio must be bit-exact.
+void bench_fused(uint8_t *iq, int num_samples) {
+    DecimatorType types[] = { DECIMATOR_BOXCAR, DECIMATOR_FIR, DECIMATOR_MULTISTAGE };
+    const char *names[] = { "boxcar", "fir", "multistage" };
+
+    printf("%-12s %12s %12s %10s %12s\n", "decimator", "staged ns", "fused ns", "speedup", "mismatches");
+
+    for (int k = 0; k < 3; k++) {
+        PipelineConfig config = pipeline_default_config();
+        config.decimator_type = types[k];
+        double allocations;
+
+        config.fused = 0;
+        double staged = time_pipeline(iq, num_samples, &config, BUFFER_SIZE, &allocations);
+        config.fused = 1;
+        double fused = time_pipeline(iq, num_samples, &config, BUFFER_SIZE, &allocations);
+
+        printf("%-12s %12.2f %12.2f %9.2fx %12ld\n", names[k], staged, fused, staged / fused,
+                count_fused_mismatches(iq, num_samples, config));
+    }
+}
+
+// Run a pipeline over the IQ samples and store its WAV samples as floats.
+// Returns the number of samples.
+int run_pipeline_audio(float *audio, uint8_t *iq, int num_samples, const PipelineConfig *config) {
+    Pipeline pipeline;
+    int audio_len = 0;
+
+    if (pipeline_init(&pipeline, config, BUFFER_SIZE) < 0) {
+        fprintf(stderr, "Failed to allocate the pipeline.\n");
+        exit(1);
+    }
+    for (int offset = 0; offset + BUFFER_SIZE <= num_samples * 2; offset += BUFFER_SIZE) {
+        int count = pipeline_process(&pipeline, iq + offset, BUFFER_SIZE);
+        for (int i = 0; i < count; i++) {
+            audio[audio_len++] = pipeline.int_samples[i];
+        }
+    }
+
+    pipeline_free(&pipeline);
+    return audio_len;
+}
+
+// Solve the len x len linear system a * x = b in place by Gaussian elimination
+// with partial pivoting, the solution is stored in b.
+void solve_linear(double *a, double *b, int len) {
+    for (int col = 0; col < len; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < len; row++) {
+            if (fabs(a[row * len + col]) > fabs(a[pivot * len + col])) pivot = row;
+        }
+        for (int k = 0; k < len; k++) {
+            double tmp = a[col * len + k];
+            a[col * len + k] = a[pivot * len + k];
+            a[pivot * len + k] = tmp;
+        }
+        double tmp = b[col];
+        b[col] = b[pivot];
+        b[pivot] = tmp;
+
+        for (int row = col + 1; row < len; row++) {
+            double factor = a[row * len + col] / a[col * len + col];
+            for (int k = col; k < len; k++) a[row * len + k] -= factor * a[col * len + k];
+            b[row] -= factor * b[col];
+        }
+    }
+    for (int row = len - 1; row >= 0; row--) {
+        for (int k = row + 1; k < len; k++) b[row] -= a[row * len + k] * b[k];
+        b[row] /= a[row * len + row];
+    }
+}
+
+// Least squares fit of a DC offset and of the first harmonics of each tone to
+// the audio. Returns the SINAD in dB, the power of the fundamentals against
+// everything else, and stores the THD in percent in *thd, the amplitude of
+// the other harmonics relative to the fundamentals.
+double measure_tones(const float *audio, int len, const double *tones, int num_tones, int harmonics, double *thd) {
+    const int max_basis = 1 + 2 * SYNTH_MAX_TONES * THD_HARMONICS;
+    double gram[max_basis * max_basis];
+    double coeffs[max_basis];
+    double basis[max_basis];
+    double freqs[max_basis];
+    int num_basis = 1;
+
+    // The basis: a constant, then a cosine and a sine for each harmonic below
+    // the Nyquist frequency.
+    freqs[0] = 0.0;
+    for (int t = 0; t < num_tones; t++) {
+        for (int h = 1; h <= harmonics; h++) {
+            if (h * tones[t] >= AUDIO_RATE / 2) break;
+            freqs[num_basis] = freqs[num_basis + 1] = h * tones[t];
+            num_basis += 2;
+        }
+    }
+
+    memset(gram, 0, sizeof(double) * num_basis * num_basis);
+    memset(coeffs, 0, sizeof(double) * num_basis);
+    double energy = 0.0;
+    for (int n = 0; n < len; n++) {
+        basis[0] = 1.0;
+        for (int k = 1; k < num_basis; k += 2) {
+            double phase = 2.0 * M_PI * fmod(freqs[k] * n, AUDIO_RATE) / AUDIO_RATE;
+            basis[k] = cos(phase);
+            basis[k + 1] = sin(phase);
+        }
+        for (int j = 0; j < num_basis; j++) {
+            coeffs[j] += basis[j] * audio[n];
+            for (int k = 0; k < num_basis; k++) gram[j * num_basis + k] += basis[j] * basis[k];
+        }
+        energy += (double)audio[n] * audio[n];
+    }
+
+    // Projection of the audio on the basis, before solving overwrites it.
+    double projection[max_basis];
+    memcpy(projection, coeffs, sizeof(double) * num_basis);
+    solve_linear(gram, coeffs, num_basis);
+
+    // Residual energy of the least squares fit: |x|^2 - c . (B^T x).
+    double residual = energy;
+    for (int j = 0; j < num_basis; j++) residual -= coeffs[j] * projection[j];
+
+    double fundamental = 0.0, harmonic = 0.0;
+    for (int k = 1; k < num_basis; k += 2) {
+        double power = (coeffs[k] * coeffs[k] + coeffs[k + 1] * coeffs[k + 1]) / 2.0 * len;
+        int is_fundamental = 0;
+        for (int t = 0; t < num_tones; t++) {
+            if (freqs[k] == tones[t]) is_fundamental = 1;
+        }
+        if (is_fundamental) fundamental += power;
+        else harmonic += power;
+    }
+
+    *thd = 100.0 * sqrt(harmonic / fundamental);
+    return 10.0 * log10(fundamental / (residual + harmonic));
+}
+
+// Level of the recovered sweep between 100 Hz and 12 kHz, in dB relative to
+// its level at 1 kHz, measured over short windows. Stores the lowest and the
+// highest level in *min_db and *max_db.
+void measure_sweep(const float *audio, int len, const SynthConfig *config, double *min_db, double *max_db) {
+    const int window = AUDIO_RATE * SWEEP_WINDOW_SECONDS;
+    const double ratio = log(config->sweep_end / config->sweep_start);
+    double reference = 0.0, best_distance = INFINITY;
+
+    *min_db = INFINITY;
+    *max_db = -INFINITY;
+
+    // Two passes: the first finds the level at 1 kHz.
+    for (int pass = 0; pass < 2; pass++) {
+        for (int start = AUDIO_RATE * SETTLE_SECONDS; start + window <= len; start += window) {
+            double t = fmod((start + window / 2.0) / AUDIO_RATE, config->sweep_seconds);
+            double freq = config->sweep_start * exp(ratio * t / config->sweep_seconds);
+            if (freq < 100.0 || freq > 12000.0) continue;
+
+            double energy = 0.0;
+            for (int n = start; n < start + window; n++) energy += (double)audio[n] * audio[n];
+            double level = 10.0 * log10(energy / window);
+
+            if (pass == 0) {
+                if (fabs(freq - 1000.0) < best_distance) {
+                    best_distance = fabs(freq - 1000.0);
+                    reference = level;
+                }
+            } else {
+                if (level - reference < *min_db) *min_db = level - reference;
+                if (level - reference > *max_db) *max_db = level - reference;
+            }
+        }
+    }
+}
+
+// End-to-end benchmark on synthetic broadcast-like signals: cost of the
+// complete default pipeline and quality of the recovered audio. Tones report
+// the SINAD and the THD, the sweep the flatness of the frequency response.
+void bench_synthetic(int num_samples) {
+    const char *names[] = { "tone", "tone+noise", "tone+offset", "multitone", "sweep" };
+    const int num_signals = sizeof(names) / sizeof(names[0]);
+    const double multitone[] = { 400.0, 1000.0, 3150.0, 6300.0 };
+    uint8_t *iq = malloc(num_samples * 2);
+    int max_audio = num_samples / DECIMATION_FACTOR + 1;
+    float *audio = malloc(sizeof(float) * max_audio);
+    PipelineConfig pipeline_config = pipeline_default_config();
+
+    printf("%-12s %8s %8s %9s %12s %12s %9s %14s\n", "signal", "CNR dB", "offset", "ns/sample",
+            "x real time", "SINAD dB", "THD %", "response dB");
+
+    for (int s = 0; s < num_signals; s++) {
+        SynthConfig config = synth_default_config(SAMPLE_RATE);
+        config.preemphasis_tau = TAU;
+
+        switch (s) {
+            case 1:
+                config.cnr_db = 30.0;
+                break;
+            case 2:
+                config.cnr_db = 30.0;
+                config.carrier_offset = 50000.0;
+                break;
+            case 3:
+                config.audio = SYNTH_MULTITONE;
+                memcpy(config.tones, multitone, sizeof(multitone));
+                config.num_tones = sizeof(multitone) / sizeof(multitone[0]);
+                config.cnr_db = 40.0;
+                break;
+            case 4:
+                config.audio = SYNTH_SWEEP;
+                config.sweep_start = 50.0;
+                config.sweep_end = 15000.0;
+                config.sweep_seconds = 1.0;
+                config.deviation = 25000.0;
+                break;
+        }
+
+        SynthState state;
+        synth_init(&state, &config);
+        synth_generate(&state, iq, num_samples);
+
+        double allocations;
+        double ns = time_pipeline(iq, num_samples, &pipeline_config, BUFFER_SIZE, &allocations);
+        int len = run_pipeline_audio(audio, iq, num_samples, &pipeline_config);
+        int settle = AUDIO_RATE * SETTLE_SECONDS;
+
+        printf("%-12s %8.0f %8.0f %9.2f %12.1f", names[s], config.cnr_db, config.carrier_offset, ns, 1e9 / (ns * SAMPLE_RATE));
+        if (config.audio == SYNTH_SWEEP) {
+            double min_db, max_db;
+            measure_sweep(audio, len, &config, &min_db, &max_db);
+            printf(" %12s %9s %6.1f..%+.1f\n", "-", "-", min_db, max_db);
+        } else {
+            double thd;
+            int harmonics = config.audio == SYNTH_TONE ? THD_HARMONICS : 1;
+            double sinad = measure_tones(audio + settle, len - settle, config.tones, config.num_tones, harmonics, &thd);
+            if (harmonics > 1) printf(" %12.1f %9.3f %14s\n", sinad, thd, "-");
+            else printf(" %12.1f %9s %14s\n", sinad, "-", "-");
+        }
+    }
+
+    free(iq);
+    free(audio);
+}
+
+// Cost and accuracy of the NCO against an oscillator computing the sine and
+// cosine of every sample from its exact phase, then the audio of a station
+// away from the center of the capture, which the half-band stages filter out
+// unless the NCO first brings it to baseband.
+void bench_nco(uint8_t *iq, int num_samples) {
+    float *i_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *q_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *ref_i = alloc_aligned(sizeof(float) * num_samples);
+    float *ref_q = alloc_aligned(sizeof(float) * num_samples);
+    float *work_i = alloc_aligned(sizeof(float) * num_samples);
+    float *work_q = alloc_aligned(sizeof(float) * num_samples);
+    int max_audio = num_samples / DECIMATION_FACTOR + 1;
+    float *audio = malloc(sizeof(float) * max_audio);
+    double best_ref = INFINITY;
+    double best_nco = INFINITY;
+
+    deinterleave_iq(i_samples, q_samples, iq, num_samples);
+
+    // The phase of sample n is reduced modulo a whole turn in integers, so the
+    // reference does not lose precision over long captures.
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = monotonic_seconds();
+        for (int n = 0; n < num_samples; n++) {
+            double phase = -2.0 * M_PI * ((int64_t)n * NCO_BENCH_OFFSET % SAMPLE_RATE) / SAMPLE_RATE;
+            double c = cos(phase);
+            double s = sin(phase);
+            ref_i[n] = i_samples[n] * c - q_samples[n] * s;
+            ref_q[n] = i_samples[n] * s + q_samples[n] * c;
+        }
+        double elapsed = monotonic_seconds() - start;
+        if (elapsed < best_ref) best_ref = elapsed;
+    }
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        Nco nco;
+        nco_init(&nco, NCO_BENCH_OFFSET, SAMPLE_RATE);
+        memcpy(work_i, i_samples, sizeof(float) * num_samples);
+        memcpy(work_q, q_samples, sizeof(float) * num_samples);
+        double start = monotonic_seconds();
+        for (int offset = 0; offset < num_samples; offset += BUFFER_SIZE / 2) {
+            int n = num_samples - offset < BUFFER_SIZE / 2 ? num_samples - offset : BUFFER_SIZE / 2;
+            nco_mix(&nco, work_i + offset, work_q + offset, n);
+        }
+        double elapsed = monotonic_seconds() - start;
+        if (elapsed < best_nco) best_nco = elapsed;
+    }
+
+    double max_error = 0.0;
+    for (int n = 0; n < num_samples; n++) {
+        double error = hypot(work_i[n] - ref_i[n], work_q[n] - ref_q[n]);
+        if (error > max_error) max_error = error;
+    }
+
+    printf("%-10s %9s %12s %12s\n", "oscillator", "ns/sample", "x real time", "max error");
+    printf("%-10s %9.2f %12.1f %12s\n", "sincos", best_ref * 1e9 / num_samples,
+            num_samples / (best_ref * SAMPLE_RATE), "-");
+    printf("%-10s %9.2f %12.1f %12.2e\n", "nco", best_nco * 1e9 / num_samples,
+            num_samples / (best_nco * SAMPLE_RATE), max_error);
+
+    // A station at the offset, through the multistage decimator.
+    SynthConfig config = synth_default_config(SAMPLE_RATE);
+    config.preemphasis_tau = TAU;
+    config.cnr_db = 30.0;
+    config.carrier_offset = NCO_BENCH_OFFSET;
+    SynthState state;
+    uint8_t *station = malloc(num_samples * 2);
+    synth_init(&state, &config);
+    synth_generate(&state, station, num_samples);
+
+    printf("\n%-12s %8s %9s %12s %9s\n", "decimator", "NCO", "ns/sample", "SINAD dB", "THD %");
+    for (int use_nco = 0; use_nco <= 1; use_nco++) {
+        PipelineConfig pipeline_config = pipeline_default_config();
+        pipeline_config.decimator_type = DECIMATOR_MULTISTAGE;
+        pipeline_config.offset = use_nco ? NCO_BENCH_OFFSET : 0.0;
+
+        double allocations;
+        double ns = time_pipeline(station, num_samples, &pipeline_config, BUFFER_SIZE, &allocations);
+        int len = run_pipeline_audio(audio, station, num_samples, &pipeline_config);
+        int settle = AUDIO_RATE * SETTLE_SECONDS;
+        double thd;
+        double sinad = measure_tones(audio + settle, len - settle, config.tones, 1, THD_HARMONICS, &thd);
+        printf("%-12s %8s %9.2f %12.1f %9.3f\n", "multistage", use_nco ? "yes" : "no", ns, sinad, thd);
+    }
+
+    free(i_samples);
+    free(q_samples);
+    free(ref_i);
+    free(ref_q);
+    free(work_i);
+    free(work_q);
+    free(station);
+    free(audio);
+}
+
+// Mixer and decimating filters of a single channel, the reference the filter
+// bank is compared to.
+typedef struct {
+    ComplexSample mixer[CHANNELIZER_NUM_CHANNELS];  // exp(-2 pi i bin n / M)
+    FirDecimator fir_i;
+    FirDecimator fir_q;
+    float *mixed_i;
+    float *mixed_q;
+} ReferenceChannel;
+
+void reference_channel_init(ReferenceChannel *channel, int bin, int max_len) {
+    for (int n = 0; n < CHANNELIZER_NUM_CHANNELS; n++) {
+        double angle = -2.0 * M_PI * bin * n / CHANNELIZER_NUM_CHANNELS;
+        channel->mixer[n].re = cos(angle);
+        channel->mixer[n].im = sin(angle);
+    }
+    int num_taps = CHANNELIZER_NUM_CHANNELS * CHANNELIZER_TAPS_PER_BRANCH;
+    channel->mixed_i = alloc_aligned(sizeof(float) * max_len);
+    channel->mixed_q = alloc_aligned(sizeof(float) * max_len);
+    if (channel->mixed_i == NULL || channel->mixed_q == NULL ||
+            fir_decimator_init(&channel->fir_i, CHANNELIZER_DECIMATION, num_taps, CHANNELIZER_CUTOFF,
+                CHANNELIZER_SAMPLE_RATE, max_len) < 0 ||
+            fir_decimator_init(&channel->fir_q, CHANNELIZER_DECIMATION, num_taps, CHANNELIZER_CUTOFF,
+                CHANNELIZER_SAMPLE_RATE, max_len) < 0) {
+        fprintf(stderr, "Failed to allocate the reference channel.\n");
+        exit(1);
+    }
+}
+
+void reference_channel_free(ReferenceChannel *channel) {
+    fir_decimator_free(&channel->fir_i);
+    fir_decimator_free(&channel->fir_q);
+    free(channel->mixed_i);
+    free(channel->mixed_q);
+}
+
+// Mix len samples, the first one at absolute index first, down to baseband
+// and filter them. Returns the number of samples stored in out_i and out_q.
+int reference_channel_process(ReferenceChannel *channel, float *out_i, float *out_q,
+        const float *i_samples, const float *q_samples, long first, int len) {
+    int phase = first % CHANNELIZER_NUM_CHANNELS;
+
+    for (int n = 0; n < len; n++) {
+        const ComplexSample w = channel->mixer[phase];
+        channel->mixed_i[n] = i_samples[n] * w.re - q_samples[n] * w.im;
+        channel->mixed_q[n] = i_samples[n] * w.im + q_samples[n] * w.re;
+        if (++phase == CHANNELIZER_NUM_CHANNELS) phase = 0;
+    }
+    fir_decimator_process(&channel->fir_i, out_i, channel->mixed_i, len);
+    return fir_decimator_process(&channel->fir_q, out_q, channel->mixed_q, len);
+}
+
+// Time the filter bank against one mixer and filter per channel over the
+// wideband samples, one BUFFER_SIZE block at a time, for num_channels
+// channels. Stores the ns per input sample of both, and returns the largest
+// difference between their outputs.
+double time_channelizer(uint8_t *iq, int num_samples, int num_channels, double *bank_ns, double *mixers_ns) {
+    const int block_samples = BUFFER_SIZE / 2;
+    int bins[CHANNELIZER_NUM_CHANNELS];
+    Channelizer channelizer;
+    ReferenceChannel *channels = malloc(sizeof(ReferenceChannel) * num_channels);
+    float *i_samples = alloc_aligned(sizeof(float) * block_samples);
+    float *q_samples = alloc_aligned(sizeof(float) * block_samples);
+    int max_output = block_samples / CHANNELIZER_DECIMATION + 1;
+    float *out_i = alloc_aligned(sizeof(float) * max_output * num_channels);
+    float *out_q = alloc_aligned(sizeof(float) * max_output * num_channels);
+    int blocks = num_samples / block_samples;
+    double max_diff = 0.0;
+
+    for (int k = 0; k < num_channels; k++) {
+        bins[k] = k;
+        reference_channel_init(&channels[k], k, block_samples);
+    }
+    if (channelizer_init(&channelizer, bins, num_channels, block_samples, 1) < 0) {
+        fprintf(stderr, "Failed to allocate the channelizer.\n");
+        exit(1);
+    }
+
+    double start = monotonic_seconds();
+    for (int b = 0; b < blocks; b++) {
+        channelizer_process(&channelizer, iq + 2L * b * block_samples, BUFFER_SIZE);
+    }
+    *bank_ns = (monotonic_seconds() - start) * 1e9 / ((double)blocks * block_samples);
+
+    start = monotonic_seconds();
+    for (int b = 0; b < blocks; b++) {
+        deinterleave_iq(i_samples, q_samples, iq + 2L * b * block_samples, block_samples);
+        for (int k = 0; k < num_channels; k++) {
+            reference_channel_process(&channels[k], out_i + k * max_output, out_q + k * max_output,
+                    i_samples, q_samples, (long)b * block_samples, block_samples);
+        }
+    }
+    *mixers_ns = (monotonic_seconds() - start) * 1e9 / ((double)blocks * block_samples);
+
+    // Both run again from the start of the stream on the first block, to
+    // compare their outputs.
+    channelizer_free(&channelizer);
+    channelizer_init(&channelizer, bins, num_channels, block_samples, 1);
+    int count = channelizer_process(&channelizer, iq, BUFFER_SIZE);
+    deinterleave_iq(i_samples, q_samples, iq, block_samples);
+    for (int k = 0; k < num_channels; k++) {
+        reference_channel_free(&channels[k]);
+        reference_channel_init(&channels[k], k, block_samples);
+        reference_channel_process(&channels[k], out_i, out_q, i_samples, q_samples, 0, block_samples);
+        for (int n = 0; n < count; n++) {
+            double diff = fabs(out_i[n] - channelizer.out_i[k][n]) + fabs(out_q[n] - channelizer.out_q[k][n]);
+            if (diff > max_diff) max_diff = diff;
+        }
+        reference_channel_free(&channels[k]);
+    }
+
+    channelizer_free(&channelizer);
+    free(channels);
+    free(i_samples);
+    free(q_samples);
+    free(out_i);
+    free(out_q);
+    return max_diff;
+}
+
+// Generate num_samples of a capture at CHANNELIZER_SAMPLE_RATE with a station
+// at each offset from its center, CNR 40 dB. Station n transmits a tone at
+// (n + 1) * 500 Hz, low enough for the pre-emphasis not to push the deviation
+// out of the channel, and the amplitude is split so that the sum does not
+// clip. The states keep the configuration of each station, and bins, unless
+// NULL, gets the channel of each one.
+void generate_stations(uint8_t *iq, int num_samples, const double *offsets, int num_stations,
+        SynthState *states, int *bins) {
+    for (int s = 0; s < num_stations; s++) {
+        SynthConfig config = synth_default_config(CHANNELIZER_SAMPLE_RATE);
+        config.preemphasis_tau = TAU;
+        config.carrier_offset = offsets[s];
+        config.tones[0] = 500.0 * (s + 1);
+        config.amplitude = 1.0 / num_stations;
+        config.cnr_db = 40.0;
+        synth_init(&states[s], &config);
+        if (bins != NULL) bins[s] = channelizer_bin_for_offset(offsets[s]);
+    }
+    synth_generate_stations(states, num_stations, iq, num_samples);
+}
+
+// Several stations in one wideband capture: quality of each one recovered
+// through the filter bank and its own pipeline, then the cost of the filter
+// bank against one mixer and filter per channel.
+void bench_channelizer(void) {
+    const double offsets[] = { -600000.0, -200000.0, 300000.0, 900000.0 };
+    const int num_stations = sizeof(offsets) / sizeof(offsets[0]);
+    const int channel_counts[] = { 1, 2, 4, 8, 16, CHANNELIZER_NUM_CHANNELS };
+    const int block_samples = BUFFER_SIZE / 2;
+    int num_samples = CHANNELIZER_SAMPLE_RATE * BENCH_SECONDS;
+    uint8_t *iq = malloc(num_samples * 2);
+    SynthState states[num_stations];
+    int bins[num_stations];
+    Channelizer channelizer;
+    Pipeline pipelines[num_stations];
+    PipelineConfig pipeline_config = pipeline_default_config();
+    int max_audio = num_samples / (CHANNELIZER_SAMPLE_RATE / AUDIO_RATE) + 1;
+    float *audio[num_stations];
+    int audio_len[num_stations];
+
+    generate_stations(iq, num_samples, offsets, num_stations, states, bins);
+    for (int s = 0; s < num_stations; s++) {
+        audio[s] = malloc(sizeof(float) * max_audio);
+        audio_len[s] = 0;
+    }
+
+    if (channelizer_init(&channelizer, bins, num_stations, block_samples, 1) < 0) {
+        fprintf(stderr, "Failed to allocate the channelizer.\n");
+        exit(1);
+    }
+    for (int s = 0; s < num_stations; s++) {
+        if (pipeline_init_channel(&pipelines[s], &pipeline_config, CHANNEL_RATE, channelizer_max_output(&channelizer)) < 0) {
+            fprintf(stderr, "Failed to allocate the pipeline.\n");
+            exit(1);
+        }
+    }
+
+    double start = monotonic_seconds();
+    for (int offset = 0; offset + BUFFER_SIZE <= num_samples * 2; offset += BUFFER_SIZE) {
+        int len = channelizer_process(&channelizer, iq + offset, BUFFER_SIZE);
+        for (int s = 0; s < num_stations; s++) {
+            int count = pipeline_process_iq(&pipelines[s], channelizer.out_i[s], channelizer.out_q[s], len);
+            for (int i = 0; i < count; i++) audio[s][audio_len[s]++] = pipelines[s].int_samples[i];
+        }
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    printf("%d stations at %d S/s, CNR %.0f dB: %.2f ns per IQ sample (%.1fx real time)\n",
+            num_stations, CHANNELIZER_SAMPLE_RATE, states[0].config.cnr_db,
+            elapsed * 1e9 / num_samples, (double)num_samples / CHANNELIZER_SAMPLE_RATE / elapsed);
+    printf("%-12s %8s %12s %9s\n", "offset kHz", "tone Hz", "SINAD dB", "THD %");
+    for (int s = 0; s < num_stations; s++) {
+        int settle = AUDIO_RATE * SETTLE_SECONDS;
+        double thd;
+        double sinad = measure_tones(audio[s] + settle, audio_len[s] - settle, states[s].config.tones, 1, THD_HARMONICS, &thd);
+        printf("%-12.0f %8.0f %12.1f %9.3f\n", offsets[s] / 1000.0, states[s].config.tones[0], sinad, thd);
+        pipeline_free(&pipelines[s]);
+        free(audio[s]);
+    }
+    channelizer_free(&channelizer);
+
+    // The cost does not depend on the signal, the first stations are enough.
+    printf("\n%-9s %14s %14s %9s %12s\n", "channels", "bank ns/IQ", "mixers ns/IQ", "speedup", "max diff");
+    for (int c = 0; c < (int)(sizeof(channel_counts) / sizeof(channel_counts[0])); c++) {
+        double bank_ns, mixers_ns;
+        double diff = time_channelizer(iq, CHANNELIZER_SAMPLE_RATE * CHANNELIZER_BENCH_SECONDS, channel_counts[c],
+                &bank_ns, &mixers_ns);
+        printf("%-9d %14.2f %14.2f %9.1f %12.2e\n", channel_counts[c], bank_ns, mixers_ns, mixers_ns / bank_ns, diff);
+    }
+
+    free(iq);
+}
+
+// FNV-1a hash of WAV samples, to check that two runs wrote the same audio.
+uint64_t hash_samples(uint64_t hash, const int16_t *samples, int count) {
+    const uint8_t *bytes = (const uint8_t *)samples;
+    for (size_t k = 0; k < sizeof(int16_t) * count; k++) {
+        hash = (hash ^ bytes[k]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Demodulate blocks of channel samples, on num_threads workers or on this
+// thread if num_threads is 0. The samples of each block are copied to the
+// input buffers first, as the recorder gets them from the channelizer, and
+// only the demodulation is timed. Returns ns per IQ sample of the capture and
+// stores a hash of the audio of every channel.
+double time_channel_pool(float **channel_i, float **channel_q, const int *block_lens, int blocks,
+        int num_channels, int num_threads, float **in_i, float **in_q, int max_len, uint64_t *hash) {
+    PipelineConfig config = pipeline_default_config();
+    Pipeline *pipelines = calloc(num_channels, sizeof(Pipeline));
+    ChannelPool pool;
+    int counts[CHANNELIZER_NUM_CHANNELS];
+    double elapsed = 0.0;
+
+    if (num_threads > 0) {
+        if (channel_pool_init(&pool, &config, num_channels, CHANNEL_RATE, max_len, num_threads, 0) < 0) {
+            fprintf(stderr, "Failed to start the worker threads.\n");
+            exit(1);
+        }
+    } else {
+        for (int k = 0; k < num_channels; k++) {
+            if (pipeline_init_channel(&pipelines[k], &config, CHANNEL_RATE, max_len) < 0) {
+                fprintf(stderr, "Failed to allocate the pipeline.\n");
+                exit(1);
+            }
+        }
+    }
+
+    *hash = 0xcbf29ce484222325ull;
+    for (int b = 0, offset = 0; b < blocks; offset += block_lens[b], b++) {
+        for (int k = 0; k < num_channels; k++) {
+            memcpy(in_i[k], channel_i[k] + offset, sizeof(float) * block_lens[b]);
+            memcpy(in_q[k], channel_q[k] + offset, sizeof(float) * block_lens[b]);
+        }
+
+        int lens[CHANNELIZER_NUM_CHANNELS];
+        for (int k = 0; k < num_channels; k++) lens[k] = block_lens[b];
+
+        double start = monotonic_seconds();
+        if (num_threads > 0) {
+            channel_pool_process(&pool, in_i, in_q, lens);
+        } else {
+            for (int k = 0; k < num_channels; k++) {
+                counts[k] = pipeline_process_iq(&pipelines[k], in_i[k], in_q[k], block_lens[b]);
+            }
+        }
+        elapsed += monotonic_seconds() - start;
+
+        for (int k = 0; k < num_channels; k++) {
+            if (num_threads > 0) {
+                *hash = hash_samples(*hash, pool.pipelines[k]->int_samples, pool.counts[k]);
+            } else {
+                *hash = hash_samples(*hash, pipelines[k].int_samples, counts[k]);
+            }
+        }
+    }
+
+    if (num_threads > 0) {
+        channel_pool_free(&pool);
+    } else {
+        for (int k = 0; k < num_channels; k++) pipeline_free(&pipelines[k]);
+    }
+    free(pipelines);
+    return elapsed * 1e9 / ((double)blocks * BUFFER_SIZE / 2);
+}
+
+// Sweep of the number of channels demodulated in parallel and of the number
+// of worker threads, against demodulating them one after the other on the
+// thread reading the samples. The channels come from a synthetic capture with
+// four stations, the other channels hold noise, which costs as much.
+void bench_channel_pool(void) {
+    const int channel_counts[] = { 1, 2, 4, 8, 16, CHANNELIZER_NUM_CHANNELS };
+    const int thread_counts[] = { 1, 2, 4, 8 };
+    const double offsets[] = { -600000.0, -200000.0, 300000.0, 900000.0 };
+    const int num_stations = sizeof(offsets) / sizeof(offsets[0]);
+    const int block_samples = BUFFER_SIZE / 2;
+    int blocks = CHANNELIZER_SAMPLE_RATE * POOL_BENCH_SECONDS / block_samples;
+    int num_samples = blocks * block_samples;
+    uint8_t *iq = malloc(num_samples * 2);
+    SynthState states[num_stations];
+    int bins[CHANNELIZER_NUM_CHANNELS];
+    Channelizer channelizer;
+    float *channel_i[CHANNELIZER_NUM_CHANNELS];
+    float *channel_q[CHANNELIZER_NUM_CHANNELS];
+    float *in_i[CHANNELIZER_NUM_CHANNELS];
+    float *in_q[CHANNELIZER_NUM_CHANNELS];
+    int *block_lens = malloc(sizeof(int) * blocks);
+
+    generate_stations(iq, num_samples, offsets, num_stations, states, NULL);
+
+    // Split the capture into every channel once.
+    for (int k = 0; k < CHANNELIZER_NUM_CHANNELS; k++) bins[k] = k;
+    if (channelizer_init(&channelizer, bins, CHANNELIZER_NUM_CHANNELS, block_samples, 1) < 0) {
+        fprintf(stderr, "Failed to allocate the channelizer.\n");
+        exit(1);
+    }
+    int max_len = channelizer_max_output(&channelizer);
+    for (int k = 0; k < CHANNELIZER_NUM_CHANNELS; k++) {
+        channel_i[k] = alloc_aligned(sizeof(float) * max_len * blocks);
+        channel_q[k] = alloc_aligned(sizeof(float) * max_len * blocks);
+        in_i[k] = alloc_aligned(sizeof(float) * max_len);
+        in_q[k] = alloc_aligned(sizeof(float) * max_len);
+    }
+    for (int b = 0, offset = 0; b < blocks; offset += block_lens[b], b++) {
+        block_lens[b] = channelizer_process(&channelizer, iq + 2L * b * block_samples, BUFFER_SIZE);
+        for (int k = 0; k < CHANNELIZER_NUM_CHANNELS; k++) {
+            memcpy(channel_i[k] + offset, channelizer.out_i[k], sizeof(float) * block_lens[b]);
+            memcpy(channel_q[k] + offset, channelizer.out_q[k], sizeof(float) * block_lens[b]);
+        }
+    }
+    channelizer_free(&channelizer);
+
+    printf("%ld CPUs online, blocks of %d bytes of capture\n", sysconf(_SC_NPROCESSORS_ONLN), BUFFER_SIZE);
+    printf("%-9s %8s %12s %9s %11s %10s\n", "channels", "threads", "ns/IQ", "speedup", "efficiency", "identical");
+    for (int c = 0; c < (int)(sizeof(channel_counts) / sizeof(channel_counts[0])); c++) {
+        int num_channels = channel_counts[c];
+        uint64_t serial_hash;
+        double serial_ns = time_channel_pool(channel_i, channel_q, block_lens, blocks, num_channels, 0,
+                in_i, in_q, max_len, &serial_hash);
+        printf("%-9d %8s %12.2f %9s %11s %10s\n", num_channels, "serial", serial_ns, "-", "-", "-");
+
+        for (int t = 0; t < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); t++) {
+            uint64_t hash;
+            double ns = time_channel_pool(channel_i, channel_q, block_lens, blocks, num_channels, thread_counts[t],
+                    in_i, in_q, max_len, &hash);
+            printf("%-9d %8d %12.2f %9.2f %10.0f%% %10s\n", num_channels, thread_counts[t], ns, serial_ns / ns,
+                    100.0 * serial_ns / ns / thread_counts[t], hash == serial_hash ? "yes" : "no");
+        }
+    }
+
+    for (int k = 0; k < CHANNELIZER_NUM_CHANNELS; k++) {
+        free(channel_i[k]);
+        free(channel_q[k]);
+        free(in_i[k]);
+        free(in_q[k]);
+    }
+    free(block_lens);
+    free(iq);
+}
+
+// Record the stations at bins from blocks of the capture like the recorder
+// does with -s: the filter bank, then the demodulation of every station, with
+// both shared by num_threads workers, or on this thread if num_threads is 0.
+// Stores the ns per IQ sample of the filter bank in *bank_ns and returns the
+// ns per IQ sample of both, and a hash of the audio in *hash.
+double time_parallel_channelizer(const uint8_t *iq, int blocks, const int *bins, int num_stations, int num_threads,
+        double *bank_ns, uint64_t *hash) {
+    PipelineConfig config = pipeline_default_config();
+    Channelizer channelizer;
+    ChannelPool pool;
+    Pipeline pipelines[num_stations];
+    double bank = 0.0;
+    double elapsed = 0.0;
+
+    if (channelizer_init(&channelizer, bins, num_stations, BUFFER_SIZE / 2, num_threads > 0 ? num_threads : 1) < 0) {
+        fprintf(stderr, "Failed to allocate the channelizer.\n");
+        exit(1);
+    }
+    int max_len = channelizer_max_output(&channelizer);
+    if (num_threads > 0) {
+        if (channel_pool_init(&pool, &config, num_stations, CHANNEL_RATE, max_len, num_threads, 0) < 0) {
+            fprintf(stderr, "Failed to start the worker threads.\n");
+            exit(1);
+        }
+    } else {
+        for (int s = 0; s < num_stations; s++) {
+            if (pipeline_init_channel(&pipelines[s], &config, CHANNEL_RATE, max_len) < 0) {
+                fprintf(stderr, "Failed to allocate the pipeline.\n");
+                exit(1);
+            }
+        }
+    }
+
+    *hash = 0xcbf29ce484222325ull;
+    for (int b = 0; b < blocks; b++) {
+        const uint8_t *block = iq + (size_t)b * BUFFER_SIZE;
+        double start = monotonic_seconds();
+        if (num_threads > 0) {
+            Channelizer *channelizers[1] = { &channelizer };
+            int lens[CHANNELIZER_NUM_CHANNELS];
+            int len = channelizer_begin(&channelizer, block, BUFFER_SIZE);
+            channel_pool_channelize(&pool, channelizers, 1);
+            channelizer_end(&channelizer);
+            double split = monotonic_seconds();
+            for (int s = 0; s < num_stations; s++) lens[s] = len;
+            channel_pool_process(&pool, channelizer.out_i, channelizer.out_q, lens);
+            double end = monotonic_seconds();
+            bank += split - start;
+            elapsed += end - start;
+            for (int s = 0; s < num_stations; s++) {
+                *hash = hash_samples(*hash, pool.pipelines[s]->int_samples, pool.counts[s]);
+            }
+        } else {
+            int len = channelizer_process(&channelizer, block, BUFFER_SIZE);
+            double split = monotonic_seconds();
+            int counts[num_stations];
+            for (int s = 0; s < num_stations; s++) {
+                counts[s] = pipeline_process_iq(&pipelines[s], channelizer.out_i[s], channelizer.out_q[s], len);
+            }
+            double end = monotonic_seconds();
+            bank += split - start;
+            elapsed += end - start;
+            for (int s = 0; s < num_stations; s++) *hash = hash_samples(*hash, pipelines[s].int_samples, counts[s]);
+        }
+    }
+
+    if (num_threads > 0) {
+        channel_pool_free(&pool);
+    } else {
+        for (int s = 0; s < num_stations; s++) pipeline_free(&pipelines[s]);
+    }
+    channelizer_free(&channelizer);
+    double num_samples = (double)blocks * BUFFER_SIZE / 2;
+    *bank_ns = bank * 1e9 / num_samples;
+    return elapsed * 1e9 / num_samples;
+}
+
+// Scaling of the recording of four stations with the number of worker
+// threads, the filter bank included: its outputs are split between the
+// workers, then the stations are demodulated in parallel. On a machine with
+// fewer cores than threads the workers take turns, and the speedup shows the
+// cost of handing the block out rather than any gain.
+void bench_parallel_channelizer(void) {
+    const double offsets[] = { -600000.0, -200000.0, 300000.0, 900000.0 };
+    const int num_stations = sizeof(offsets) / sizeof(offsets[0]);
+    const int thread_counts[] = { 1, 2, 4, 8 };
+    int blocks = CHANNELIZER_SAMPLE_RATE * POOL_BENCH_SECONDS / (BUFFER_SIZE / 2);
+    uint8_t *iq = malloc((size_t)blocks * BUFFER_SIZE);
+    SynthState states[num_stations];
+    int bins[num_stations];
+
+    generate_stations(iq, blocks * (BUFFER_SIZE / 2), offsets, num_stations, states, bins);
+
+    printf("%ld CPUs online, %d stations, blocks of %d bytes of capture\n", sysconf(_SC_NPROCESSORS_ONLN),
+            num_stations, BUFFER_SIZE);
+    printf("%-9s %12s %9s %12s %9s %10s\n", "threads", "bank ns/IQ", "speedup", "total ns/IQ", "speedup",
+            "identical");
+    uint64_t serial_hash;
+    double serial_bank;
+    double serial_total = time_parallel_channelizer(iq, blocks, bins, num_stations, 0, &serial_bank, &serial_hash);
+    printf("%-9s %12.2f %9s %12.2f %9s %10s\n", "serial", serial_bank, "-", serial_total, "-", "-");
+    for (int t = 0; t < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); t++) {
+        uint64_t hash;
+        double bank;
+        double total = time_parallel_channelizer(iq, blocks, bins, num_stations, thread_counts[t], &bank, &hash);
+        printf("%-9d %12.2f %9.2f %12.2f %9.2f %10s\n", thread_counts[t], bank, serial_bank / bank, total,
+                serial_total / total, hash == serial_hash ? "yes" : "no");
+    }
+
+    free(iq);
+}
+
+// Accuracy of the fixed-point engine against the float one: the error of the
+// CORDIC discriminator in radians, then the cost and the SNR of the WAV
+// samples of the complete chain, taking the float output as reference.
+void bench_fixed(uint8_t *iq, int num_samples) {
+    int32_t re[CORDIC_BLOCK];
+    int32_t im[CORDIC_BLOCK];
+    int16_t angles[CORDIC_BLOCK];
+    double max_error = 0.0;
+
+    // Every pair of consecutive samples of the test signal.
+    for (int start = 1; start + CORDIC_BLOCK <= num_samples; start += CORDIC_BLOCK) {
+        for (int k = 0; k < CORDIC_BLOCK; k++) {
+            int i1 = 2 * iq[2 * (start + k - 1)] - 255, q1 = 2 * iq[2 * (start + k - 1) + 1] - 255;
+            int i2 = 2 * iq[2 * (start + k)] - 255, q2 = 2 * iq[2 * (start + k) + 1] - 255;
+            re[k] = i1 * i2 + q1 * q2;
+            im[k] = i1 * q2 - q1 * i2;
+        }
+        cordic_atan2_block(angles, im, re, CORDIC_BLOCK);
+        for (int k = 0; k < CORDIC_BLOCK; k++) {
+            double error = fabs(angles[k] * M_PI / 32768.0 - atan2(im[k], re[k]));
+            if (error > max_error) max_error = error;
+        }
+    }
+    printf("CORDIC discriminator: %d iterations, max error %.2e rad (Q15 step %.2e rad)\n",
+            CORDIC_ITERATIONS, max_error, M_PI / 32768.0);
+
+    DecimatorType types[] = { DECIMATOR_BOXCAR, DECIMATOR_FIR };
+    const char *names[] = { "boxcar", "fir" };
+    int max_audio = num_samples / DECIMATION_FACTOR + 1;
+    float *reference = malloc(sizeof(float) * max_audio);
+    float *audio = malloc(sizeof(float) * max_audio);
+
+    printf("%-12s %12s %12s %10s %12s %12s\n", "decimator", "float ns", "fixed ns", "speedup", "SNR dB", "max diff");
+    for (int k = 0; k < 2; k++) {
+        PipelineConfig config = pipeline_default_config();
+        config.decimator_type = types[k];
+        double allocations;
+
+        double float_ns = time_pipeline(iq, num_samples, &config, BUFFER_SIZE, &allocations);
+        int len = run_pipeline_audio(reference, iq, num_samples, &config);
+        config.engine = ENGINE_FIXED;
+        double fixed_ns = time_pipeline(iq, num_samples, &config, BUFFER_SIZE, &allocations);
+        run_pipeline_audio(audio, iq, num_samples, &config);
+
+        double max_diff = 0.0;
+        for (int i = 0; i < len; i++) {
+            if (fabs(audio[i] - reference[i]) > max_diff) max_diff = fabs(audio[i] - reference[i]);
+        }
+        printf("%-12s %12.2f %12.2f %9.2fx %12.1f %12.0f\n", names[k], float_ns, fixed_ns, float_ns / fixed_ns,
+                snr_db(reference, audio, len), max_diff);
+    }
+
+    free(reference);
+    free(audio);
+}
+
+// Record num_files files of WRITER_BENCH_SECONDS of audio each in dir with the
+// given backend, one block of each file after the other like a multi-channel
+// recorder would. Returns the total time in seconds, including closing the
+// files, and stores the time spent handing the samples over in *producer.
+// Returns a negative value if the backend is not available.
+double time_writer(WriterBackend backend, const char *dir, int num_files, const int16_t *samples,
+        int block_samples, double *producer) {
+    Writer writer;
+    WavOutput *outputs = malloc(sizeof(WavOutput) * num_files);
+    char path[PATH_MAX];
+    int num_blocks = WRITER_BENCH_SECONDS * AUDIO_RATE / block_samples;
+
+    if (writer_init(&writer, backend, num_files, NULL) < 0) {
+        free(outputs);
+        return -1.0;
+    }
+
+    double start = monotonic_seconds();
+    for (int f = 0; f < num_files; f++) {
+        snprintf(path, sizeof(path), "%s/%d.wav", dir, f);
+        if (wav_output_open(&outputs[f], &writer, path) < 0) {
+            fprintf(stderr, "Failed to create %s.\n", path);
+            exit(1);
+        }
+    }
+
+    *producer = 0.0;
+    for (int b = 0; b < num_blocks; b++) {
+        double block_start = monotonic_seconds();
+        for (int f = 0; f < num_files; f++) {
+            if (wav_output_write(&outputs[f], samples, block_samples) < 0) {
+                fprintf(stderr, "Failed to write the benchmark files.\n");
+                exit(1);
+            }
+        }
+        *producer += monotonic_seconds() - block_start;
+    }
+
+    for (int f = 0; f < num_files; f++) {
+        if (wav_output_close(&outputs[f]) < 0) {
+            fprintf(stderr, "Failed to write the benchmark files.\n");
+            exit(1);
+        }
+    }
+    double elapsed = monotonic_seconds() - start;
+    writer_free(&writer);
+
+    for (int f = 0; f < num_files; f++) {
+        snprintf(path, sizeof(path), "%s/%d.wav", dir, f);
+        unlink(path);
+    }
+    free(outputs);
+    return elapsed;
+}
+
+// Compare the output backends while recording several stations at once, each
+// one receiving the audio of a default block at a time. The files go to a
+// temporary directory, so the numbers mostly reflect the cost of the system
+// calls and of the page cache rather than the disk.
+void bench_writers(void) {
+    const WriterBackend backends[] = { WRITER_STDIO, WRITER_THREAD, WRITER_URING };
+    const char *names[] = { "stdio", "thread", "uring" };
+    const int file_counts[] = { 1, 8, 32, 64 };
+    const int block_samples = BUFFER_SIZE / 2 / DECIMATION_FACTOR;
+    int16_t *samples = malloc(sizeof(int16_t) * block_samples);
+    char dir[] = "/tmp/fmrec_bench_XXXXXX";
+
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "Failed to create a temporary directory.\n");
+        exit(1);
+    }
+    for (int i = 0; i < block_samples; i++) {
+        samples[i] = (int16_t)(10000.0 * sin(2.0 * M_PI * BENCH_TONE_FREQ * i / AUDIO_RATE));
+    }
+
+    printf("%-8s %6s %10s %12s %18s\n", "backend", "files", "MB/s", "total ms", "us per file-block");
+    for (int n = 0; n < (int)(sizeof(file_counts) / sizeof(file_counts[0])); n++) {
+        int num_files = file_counts[n];
+        double bytes = (double)num_files * (WRITER_BENCH_SECONDS * AUDIO_RATE / block_samples) * block_samples * sizeof(int16_t);
+        double blocks = (double)num_files * (WRITER_BENCH_SECONDS * AUDIO_RATE / block_samples);
+
+        for (int k = 0; k < 3; k++) {
+            double producer;
+            double elapsed = time_writer(backends[k], dir, num_files, samples, block_samples, &producer);
+            if (elapsed < 0.0) {
+                printf("%-8s %6d %10s\n", names[k], num_files, "unavailable");
+                continue;
+            }
+            printf("%-8s %6d %10.1f %12.2f %18.2f\n", names[k], num_files, bytes / elapsed / 1e6,
+                    elapsed * 1e3, producer * 1e6 / blocks);
+        }
+    }
+
+    rmdir(dir);
+    free(samples);
+}
+
+// Run each kernel compiled for every instruction set level supported by the
+// CPU, then the complete pipeline, reporting the largest difference of its WAV
+// samples from the scalar kernels.
+void bench_kernel_levels(uint8_t *iq, int num_samples) {
+    const CpuLevel levels[] = { CPU_LEVEL_SCALAR, CPU_LEVEL_SSE2, CPU_LEVEL_AVX2, CPU_LEVEL_AVX512, CPU_LEVEL_NEON };
+    const int num_levels = sizeof(levels) / sizeof(levels[0]);
+    const AtanApprox *approx = atan_approx_for_error(ATAN_DEFAULT_MAX_ERROR);
+    float *i_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *q_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *freq_samples = alloc_aligned(sizeof(float) * num_samples);
+    float *output = alloc_aligned(sizeof(float) * num_samples);
+    int16_t *int_samples = alloc_aligned(sizeof(int16_t) * num_samples);
+    int max_audio = num_samples / DECIMATION_FACTOR + 1;
+    float *reference = malloc(sizeof(float) * max_audio);
+    float *audio = malloc(sizeof(float) * max_audio);
+    PipelineConfig config = pipeline_default_config();
+    DemodState state;
+    FirDecimator fir;
+    MultistageDecimator multistage;
+
+    deinterleave_iq(i_samples, q_samples, iq, num_samples);
+    demod_state_init(&state, SAMPLE_RATE, 1);
+    fir_decimator_init(&fir, DECIMATION_FACTOR, FIR_DEFAULT_TAPS, FIR_CUTOFF, SAMPLE_RATE, BUFFER_SIZE / 2);
+    multistage_init(&multistage, SAMPLE_RATE, AUDIO_RATE, BUFFER_SIZE / 2);
+
+    printf("%-8s %9s %9s %9s %9s %9s %10s %9s\n",
+            "level", "fast", "iir", "fir", "halfband", "int16", "pipeline", "max diff");
+
+    int reference_len = 0;
+    for (int l = 0; l < num_levels; l++) {
+        if (kernels_init(levels[l]) < 0) continue;
+        double best[5] = { INFINITY, INFINITY, INFINITY, INFINITY, INFINITY };
+
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            double t0 = monotonic_seconds();
+            get_freq_values(freq_samples, i_samples, q_samples, 0.0f, 0.0f, num_samples, DISCRIMINATOR_FAST, approx);
+            double t1 = monotonic_seconds();
+            memcpy(output, freq_samples, sizeof(float) * num_samples);
+            double t2 = monotonic_seconds();
+            first_order_block(&state.deemph_filter, output, num_samples, 0.0f);
+            double t3 = monotonic_seconds();
+            run_decimator(DECIMATOR_FIR, &fir, output, freq_samples, num_samples);
+            double t4 = monotonic_seconds();
+            for (int offset = 0; offset < num_samples; offset += BUFFER_SIZE / 2) {
+                int n = num_samples - offset < BUFFER_SIZE / 2 ? num_samples - offset : BUFFER_SIZE / 2;
+                memcpy(output, i_samples + offset, sizeof(float) * n);
+                memcpy(freq_samples, q_samples + offset, sizeof(float) * n);
+                multistage_process_iq(&multistage, output, freq_samples, n);
+            }
+            double t5 = monotonic_seconds();
+            convert_samples(int_samples, i_samples, num_samples);
+            double t6 = monotonic_seconds();
+
+            double times[5] = { t1 - t0, t3 - t2, t4 - t3, t5 - t4, t6 - t5 };
+            for (int k = 0; k < 5; k++) {
+                if (times[k] < best[k]) best[k] = times[k];
+            }
+        }
+
+        double allocations;
+        double pipeline_ns = time_pipeline(iq, num_samples, &config, BUFFER_SIZE, &allocations);
+        int len = run_pipeline_audio(l == 0 ? reference : audio, iq, num_samples, &config);
+        double max_diff = 0.0;
+        if (l == 0) {
+            reference_len = len;
+        } else {
+            for (int i = 0; i < len && i < reference_len; i++) {
+                if (fabs(audio[i] - reference[i]) > max_diff) max_diff = fabs(audio[i] - reference[i]);
+            }
+        }
+
+        printf("%-8s", cpu_level_name(levels[l]));
+        for (int k = 0; k < 5; k++) {
+            printf(" %9.3f", best[k] * 1e9 / num_samples);
+        }
+        printf(" %10.2f %9.0f\n", pipeline_ns, max_diff);
+    }
+    kernels_init(cpu_detect_level());
+
+    fir_decimator_free(&fir);
+    multistage_free(&multistage);
+    free(i_samples);
+    free(q_samples);
+    free(freq_samples);
+    free(output);
+    free(int_samples);
+    free(reference);
+    free(audio);
+}
+
+// Run the default pipeline with different block sizes, with and without huge
+// pages, to find the size that best fits the caches of the machine.
+void bench_block_sizes(uint8_t *iq, int num_samples) {
+    const int sizes[] = { 16 * 1024, 64 * 1024, BUFFER_SIZE, 1024 * 1024 };
+    const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    PipelineConfig config = pipeline_default_config();
+
+    printf("%-12s %12s %14s %14s\n", "block bytes", "working set", "ns/sample", "hugepages");
+
+    for (int k = 0; k < num_sizes; k++) {
+        // Input block, I, Q and frequency buffers.
+        int working_set = sizes[k] + 3 * (int)sizeof(float) * (sizes[k] / 2);
+        double allocations;
+
+        dsp_set_hugepages(0);
+        double ns = time_pipeline(iq, num_samples, &config, sizes[k], &allocations);
+        dsp_set_hugepages(1);
+        double ns_huge = time_pipeline(iq, num_samples, &config, sizes[k], &allocations);
+        dsp_set_hugepages(0);
+
+        printf("%-12d %10d KB %14.2f %14.2f\n", sizes[k], working_set / 1024, ns, ns_huge);
+    }
+}
+
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-s] [-j FILE]\n", program);
+    fprintf(stderr, "  -s       only time the stages of the processing chain\n");
+    fprintf(stderr, "  -j FILE  also write the cost of the stages to FILE as JSON\n");
+}
+
+int main(int argc, char **argv) {
+    const char *json_path = NULL;
+    int stages_only = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:s")) != -1) {
+        switch (opt) {
+            case 'j':
+                json_path = optarg;
+                break;
+            case 's':
+                stages_only = 1;
+                break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    int num_samples = SAMPLE_RATE * BENCH_SECONDS;
+    uint8_t *iq = malloc(num_samples * 2);
+    if (iq == NULL) {
+        fprintf(stderr, "Failed to allocate the benchmark signal.\n");
+        exit(1);
+    }
+
+    generate_fm_tone(iq, num_samples, BENCH_TONE_FREQ, BENCH_DEVIATION);
+    convert_init(cpu_detect_level(), CONVERT_ARITHMETIC, NULL);
+    kernels_init(cpu_detect_level());
+
+    StageResult stages[NUM_STAGES];
+    printf("Processing stages (%s kernels, blocks of %d bytes)\n", dsp_kernels->name, BUFFER_SIZE);
+    bench_stages(iq, num_samples, stages);
+    if (json_path != NULL && write_stages_json(json_path, stages, NUM_STAGES) < 0) {
+        fprintf(stderr, "Failed to write %s.\n", json_path);
+        exit(1);
+    }
+    if (stages_only) {
+        free(iq);
+        return 0;
+    }
+    printf("\n");
+
+    printf("IQ conversion (%s detected)\n", cpu_level_name(cpu_detect_level()));
+    bench_conversion(iq, num_samples);
+    printf("\n");
+
+    printf("FM discriminators (%d s of %.0f Hz tone, %.0f kHz deviation)\n",
+            BENCH_SECONDS, BENCH_TONE_FREQ, BENCH_DEVIATION / 1000.0);
+    bench_discriminators(iq, num_samples);
+
+    printf("\nDecimators (%d:1, FIR cutoff %.0f Hz)\n", DECIMATION_FACTOR, FIR_CUTOFF);
+    bench_decimators(num_samples);
+
+    printf("\nDecimation plans (%d Hz -> %d Hz)\n", SAMPLE_RATE, AUDIO_RATE);
+    bench_decimation_plans(num_samples);
+
+    printf("\nRecursive filters (first order, %d samples per block)\n", IIR_BLOCK);
+    bench_recursive_filters(iq, num_samples);
+
+    printf("\nComplete pipeline\n");
+    bench_pipeline(iq, num_samples);
+
+    printf("\nFused kernel (tiles of %d IQ samples, ns per IQ sample)\n", FUSED_TILE);
+    bench_fused(iq, num_samples);
+
+    printf("\nKernels per instruction set (ns per sample, max diff of the WAV samples from scalar)\n");
+    bench_kernel_levels(iq, num_samples);
+
+    printf("\nSynthetic signals (complete pipeline, %d s, pre-emphasized %.0f us)\n", BENCH_SECONDS, TAU * 1e6);
+    bench_synthetic(num_samples);
+
+    printf("\nNCO (%d Hz offset at %d S/s)\n", NCO_BENCH_OFFSET, SAMPLE_RATE);
+    bench_nco(iq, num_samples);
+
+    printf("\nChannelizer (%d channels %d kHz apart, %d S/s each)\n",
+            CHANNELIZER_NUM_CHANNELS, CHANNEL_SPACING / 1000, CHANNEL_RATE);
+    bench_channelizer();
+
+    printf("\nWorker pool (channels demodulated in parallel, ns per IQ sample of the %d S/s capture)\n",
+            CHANNELIZER_SAMPLE_RATE);
+    bench_channel_pool();
+
+    printf("\nParallel channelizer (filter bank and demodulation on the workers, ns per IQ sample of the capture)\n");
+    bench_parallel_channelizer();
+
+    printf("\nOutput backends (%d s of audio per file, total includes closing the files)\n", WRITER_BENCH_SECONDS);
+    bench_writers();
+
+    printf("\nFixed-point engine (ns per IQ sample, SNR of the WAV samples against float)\n");
+    bench_fixed(iq, num_samples);
+
+    printf("\nBlock sizes (default pipeline, ns per IQ sample)\n");
+    bench_block_sizes(iq, num_samples);
+
+    free(iq);
+    return 0;
+}
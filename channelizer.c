@@ -0,0 +1,385 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsp.h"
+#include "convert.h"
+#include "decimator.h"
+#include "kernels.h"
+#include "channelizer.h"
+
+// The filter bank kernel sums FIR_LANES branches at a time.
+#if CHANNELIZER_NUM_CHANNELS % FIR_LANES != 0
+#error "CHANNELIZER_NUM_CHANNELS must be a multiple of FIR_LANES"
+#endif
+
+// Prepare an FFT of the given size, computing sum x[n] exp(-2 pi i n k / size)
+// or, if inverse is non-zero, sum x[n] exp(2 pi i n k / size), unscaled.
+// Returns 0 on success and -1 on failure.
+int fft_init(Fft *fft, int size, int inverse) {
+    int remaining = size;
+    int radix = 4;
+    int max_radix = 1;
+
+    memset(fft, 0, sizeof(Fft));
+    if (size < 1) return -1;
+    fft->size = size;
+    fft->inverse = inverse;
+    if (size == 1) {
+        fft->factors[0] = fft->factors[1] = 1;
+        fft->num_factors = 1;
+    }
+
+    // Radix 4 stages first, then 2, 3, 5 and any other prime factor.
+    while (remaining > 1) {
+        while (remaining % radix != 0) {
+            if (radix == 4) radix = 2;
+            else if (radix == 2) radix = 3;
+            else radix += 2;
+        }
+        if (fft->num_factors == FFT_MAX_FACTORS) return -1;
+        remaining /= radix;
+        fft->factors[2 * fft->num_factors] = radix;
+        fft->factors[2 * fft->num_factors + 1] = remaining;
+        fft->num_factors++;
+        if (radix > max_radix) max_radix = radix;
+    }
+
+    fft->twiddles = alloc_aligned(sizeof(ComplexSample) * size);
+    fft->scratch = alloc_aligned(sizeof(ComplexSample) * max_radix);
+    if (fft->twiddles == NULL || fft->scratch == NULL) {
+        fft_free(fft);
+        return -1;
+    }
+    for (int k = 0; k < size; k++) {
+        double angle = (inverse ? 2.0 : -2.0) * M_PI * k / size;
+        fft->twiddles[k].re = cos(angle);
+        fft->twiddles[k].im = sin(angle);
+    }
+
+    return 0;
+}
+
+void fft_free(Fft *fft) {
+    free(fft->twiddles);
+    free(fft->scratch);
+    fft->twiddles = NULL;
+    fft->scratch = NULL;
+}
+
+static inline ComplexSample complex_mul(ComplexSample a, ComplexSample b) {
+    ComplexSample c = { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+    return c;
+}
+
+// Combine radix transforms of size m, stored one after the other in output,
+// into a transform of size radix * m. stride is the distance between the
+// twiddles of consecutive outputs of the sub-transforms.
+static void fft_butterfly2(Fft *fft, ComplexSample *output, int stride, int m) {
+    for (int u = 0; u < m; u++) {
+        ComplexSample t = complex_mul(output[u + m], fft->twiddles[u * stride]);
+        output[u + m].re = output[u].re - t.re;
+        output[u + m].im = output[u].im - t.im;
+        output[u].re += t.re;
+        output[u].im += t.im;
+    }
+}
+
+static void fft_butterfly3(Fft *fft, ComplexSample *output, int stride, int m) {
+    // Imaginary part of the cube root of unity of the direction.
+    const float root_im = fft->twiddles[stride * m].im;
+
+    for (int u = 0; u < m; u++) {
+        ComplexSample s1 = complex_mul(output[u + m], fft->twiddles[u * stride]);
+        ComplexSample s2 = complex_mul(output[u + 2 * m], fft->twiddles[2 * u * stride]);
+        ComplexSample sum = { s1.re + s2.re, s1.im + s2.im };
+        ComplexSample diff = { (s1.re - s2.re) * root_im, (s1.im - s2.im) * root_im };
+        ComplexSample mid = { output[u].re - 0.5f * sum.re, output[u].im - 0.5f * sum.im };
+
+        output[u].re += sum.re;
+        output[u].im += sum.im;
+        output[u + m].re = mid.re - diff.im;
+        output[u + m].im = mid.im + diff.re;
+        output[u + 2 * m].re = mid.re + diff.im;
+        output[u + 2 * m].im = mid.im - diff.re;
+    }
+}
+
+static void fft_butterfly4(Fft *fft, ComplexSample *output, int stride, int m) {
+    // Multiplying by -i (forward) or i (inverse) swaps the components.
+    const float sign = fft->inverse ? 1.0f : -1.0f;
+
+    for (int u = 0; u < m; u++) {
+        ComplexSample s0 = complex_mul(output[u + m], fft->twiddles[u * stride]);
+        ComplexSample s1 = complex_mul(output[u + 2 * m], fft->twiddles[2 * u * stride]);
+        ComplexSample s2 = complex_mul(output[u + 3 * m], fft->twiddles[3 * u * stride]);
+        ComplexSample even_sum = { output[u].re + s1.re, output[u].im + s1.im };
+        ComplexSample even_diff = { output[u].re - s1.re, output[u].im - s1.im };
+        ComplexSample odd_sum = { s0.re + s2.re, s0.im + s2.im };
+        ComplexSample odd_diff = { s0.re - s2.re, s0.im - s2.im };
+
+        output[u].re = even_sum.re + odd_sum.re;
+        output[u].im = even_sum.im + odd_sum.im;
+        output[u + 2 * m].re = even_sum.re - odd_sum.re;
+        output[u + 2 * m].im = even_sum.im - odd_sum.im;
+        output[u + m].re = even_diff.re - sign * odd_diff.im;
+        output[u + m].im = even_diff.im + sign * odd_diff.re;
+        output[u + 3 * m].re = even_diff.re + sign * odd_diff.im;
+        output[u + 3 * m].im = even_diff.im - sign * odd_diff.re;
+    }
+}
+
+// Any other radix, with a DFT of the radix samples of each output.
+static void fft_butterfly(Fft *fft, ComplexSample *output, int stride, int m, int radix) {
+    const ComplexSample *twiddles = fft->twiddles;
+    ComplexSample *scratch = fft->scratch;
+
+    for (int u = 0; u < m; u++) {
+        for (int q = 0; q < radix; q++) scratch[q] = output[u + q * m];
+
+        for (int q1 = 0, k = u; q1 < radix; q1++, k += m) {
+            ComplexSample sum = scratch[0];
+            int index = 0;
+            for (int q = 1; q < radix; q++) {
+                index += stride * k;
+                if (index >= fft->size) index -= fft->size;
+                ComplexSample term = complex_mul(scratch[q], twiddles[index]);
+                sum.re += term.re;
+                sum.im += term.im;
+            }
+            output[k] = sum;
+        }
+    }
+}
+
+// Decimation in time: transform the radix sub-sequences of input taken every
+// stride samples, then combine them.
+static void fft_work(Fft *fft, ComplexSample *output, const ComplexSample *input, int stride, const int *factors) {
+    int radix = factors[0];
+    int m = factors[1];
+
+    if (m == 1) {
+        for (int q = 0; q < radix; q++) output[q] = input[q * stride];
+    } else {
+        for (int q = 0; q < radix; q++) {
+            fft_work(fft, output + q * m, input + q * stride, stride * radix, factors + 2);
+        }
+    }
+    switch (radix) {
+        case 2: fft_butterfly2(fft, output, stride, m); break;
+        case 3: fft_butterfly3(fft, output, stride, m); break;
+        case 4: fft_butterfly4(fft, output, stride, m); break;
+        default: fft_butterfly(fft, output, stride, m, radix);
+    }
+}
+
+// Transform size samples of input into output, which must not overlap.
+void fft_compute(Fft *fft, ComplexSample *output, const ComplexSample *input) {
+    fft_work(fft, output, input, 1, fft->factors);
+}
+
+// Channel holding the station at offset Hz from the center frequency.
+// Returns -1 if the offset is not on the raster of the channels or too far
+// from the center.
+int channelizer_bin_for_offset(double offset) {
+    long channel = lround(offset / CHANNEL_SPACING);
+
+    if (fabs(offset - (double)channel * CHANNEL_SPACING) > 1.0 || fabs(offset) > CHANNELIZER_MAX_OFFSET) return -1;
+    return (int)((channel + CHANNELIZER_NUM_CHANNELS) % CHANNELIZER_NUM_CHANNELS);
+}
+
+// Prepare a channelizer producing the num_outputs channels listed in bins,
+// from blocks of at most max_len IQ samples, whose outputs are split in
+// num_parts parts. All the memory is allocated here. Returns 0 on success and
+// -1 on failure.
+int channelizer_init(Channelizer *channelizer, const int *bins, int num_outputs, int max_len, int num_parts) {
+    const int num_taps = CHANNELIZER_NUM_CHANNELS * CHANNELIZER_TAPS_PER_BRANCH;
+    // Besides the filter length, the history covers the windows of the
+    // outputs held back until a whole group is available.
+    int history = num_taps - 1 + (CHANNELIZER_OUTPUT_MULTIPLE - 1) * CHANNELIZER_DECIMATION;
+
+    memset(channelizer, 0, sizeof(Channelizer));
+    channelizer->num_taps = num_taps;
+    channelizer->history = history;
+    channelizer->max_len = max_len;
+    channelizer->num_outputs = num_outputs;
+    channelizer->taps = alloc_aligned(sizeof(float) * num_taps);
+    channelizer->work_i = alloc_aligned(sizeof(float) * (history + max_len));
+    channelizer->work_q = alloc_aligned(sizeof(float) * (history + max_len));
+    channelizer->bins = calloc(num_outputs, sizeof(int));
+    channelizer->out_i = calloc(num_outputs, sizeof(float *));
+    channelizer->out_q = calloc(num_outputs, sizeof(float *));
+    channelizer->parts = num_parts > 0 ? calloc(num_parts, sizeof(ChannelizerPart)) : NULL;
+    if (channelizer->taps == NULL || channelizer->work_i == NULL || channelizer->work_q == NULL ||
+            channelizer->bins == NULL || channelizer->out_i == NULL || channelizer->out_q == NULL ||
+            channelizer->parts == NULL) {
+        channelizer_free(channelizer);
+        return -1;
+    }
+
+    // Each part has buffers of its own, so that the parts of a block never
+    // write the same cache line.
+    for (int p = 0; p < num_parts; p++) {
+        ChannelizerPart *part = &channelizer->parts[channelizer->num_parts++];
+        part->branch_i = alloc_aligned(sizeof(float) * CHANNELIZER_NUM_CHANNELS);
+        part->branch_q = alloc_aligned(sizeof(float) * CHANNELIZER_NUM_CHANNELS);
+        part->spectrum = alloc_aligned(sizeof(ComplexSample) * 2 * CHANNELIZER_NUM_CHANNELS);
+        if (part->branch_i == NULL || part->branch_q == NULL || part->spectrum == NULL ||
+                fft_init(&part->fft, CHANNELIZER_NUM_CHANNELS, 1) < 0) {
+            channelizer_free(channelizer);
+            return -1;
+        }
+    }
+
+    for (int k = 0; k < num_outputs; k++) {
+        channelizer->bins[k] = bins[k];
+        channelizer->out_i[k] = alloc_aligned(sizeof(float) * channelizer_max_output(channelizer));
+        channelizer->out_q[k] = alloc_aligned(sizeof(float) * channelizer_max_output(channelizer));
+        if (channelizer->out_i[k] == NULL || channelizer->out_q[k] == NULL) {
+            channelizer_free(channelizer);
+            return -1;
+        }
+    }
+
+    // The windows run forward in time, the taps are reversed to match.
+    float *prototype = alloc_aligned(sizeof(float) * num_taps);
+    if (prototype == NULL) {
+        channelizer_free(channelizer);
+        return -1;
+    }
+    design_lowpass(prototype, num_taps, CHANNELIZER_CUTOFF, CHANNELIZER_SAMPLE_RATE);
+    for (int k = 0; k < num_taps; k++) {
+        channelizer->taps[k] = prototype[num_taps - 1 - k];
+    }
+    free(prototype);
+
+    memset(channelizer->work_i, 0, sizeof(float) * (history + max_len));
+    memset(channelizer->work_q, 0, sizeof(float) * (history + max_len));
+    // Like the FIR decimator, the first output is produced once
+    // CHANNELIZER_DECIMATION samples have been received.
+    channelizer->phase = CHANNELIZER_DECIMATION - 1;
+    channelizer->rotation = channelizer->phase % CHANNELIZER_NUM_CHANNELS;
+
+    return 0;
+}
+
+void channelizer_free(Channelizer *channelizer) {
+    for (int k = 0; k < channelizer->num_outputs && channelizer->out_i != NULL; k++) {
+        free(channelizer->out_i[k]);
+        free(channelizer->out_q[k]);
+    }
+    free(channelizer->taps);
+    free(channelizer->work_i);
+    free(channelizer->work_q);
+    for (int p = 0; p < channelizer->num_parts; p++) {
+        free(channelizer->parts[p].branch_i);
+        free(channelizer->parts[p].branch_q);
+        free(channelizer->parts[p].spectrum);
+        fft_free(&channelizer->parts[p].fft);
+    }
+    free(channelizer->parts);
+    free(channelizer->bins);
+    free(channelizer->out_i);
+    free(channelizer->out_q);
+    memset(channelizer, 0, sizeof(Channelizer));
+}
+
+// Largest number of samples produced for each channel by a single call.
+int channelizer_max_output(const Channelizer *channelizer) {
+    int held_back = channelizer->history - (channelizer->num_taps - 1);
+    return (channelizer->max_len + held_back) / CHANNELIZER_DECIMATION + 1;
+}
+
+// Start splitting a block of len IQ bytes (at most 2 * max_len) into the
+// selected channels. Returns the number of samples of each channel the block
+// gives, always a multiple of CHANNELIZER_OUTPUT_MULTIPLE: the remaining
+// outputs are produced with the next block. They are computed by
+// channelizer_process_part() for every part, in any order or in parallel,
+// then channelizer_end() must be called before the next block.
+int channelizer_begin(Channelizer *channelizer, const uint8_t *block, int len) {
+    int num_samples = len / 2;
+    int history = channelizer->history;
+
+    deinterleave_iq(channelizer->work_i + history, channelizer->work_q + history, block, num_samples);
+
+    int available = 0;
+    if (channelizer->phase < num_samples) {
+        available = (num_samples - channelizer->phase + CHANNELIZER_DECIMATION - 1) / CHANNELIZER_DECIMATION;
+    }
+    channelizer->num_samples = num_samples;
+    channelizer->count = available / CHANNELIZER_OUTPUT_MULTIPLE * CHANNELIZER_OUTPUT_MULTIPLE;
+    return channelizer->count;
+}
+
+// Compute the outputs of the current block in part, stored in out_i and out_q.
+//
+// Output m of channel k filters the input mixed down by k * CHANNEL_SPACING:
+//   y_k[m] = sum_l h[l] x[n - l] exp(-2 pi i k (n - l) / M)
+// where n is the index of the newest input sample and M the number of
+// channels. Splitting l = p M + r, the sum over p is the same for every
+// channel (a branch of the polyphase filter), and the sum over r is an
+// inverse DFT of the M branch sums, rotated by n modulo M.
+void channelizer_process_part(Channelizer *channelizer, int part) {
+    const int M = CHANNELIZER_NUM_CHANNELS;
+    ChannelizerPart *buffers = &channelizer->parts[part];
+    const float *branch_i = buffers->branch_i;
+    const float *branch_q = buffers->branch_q;
+    ComplexSample *input = buffers->spectrum;
+    ComplexSample *output = buffers->spectrum + M;
+    // Offset of the window of the output at phase 0 in the work buffers.
+    int first_window = channelizer->history - (channelizer->num_taps - 1);
+    int start = (int)((long long)channelizer->count * part / channelizer->num_parts);
+    int end = (int)((long long)channelizer->count * (part + 1) / channelizer->num_parts);
+    int phase = channelizer->phase + start * CHANNELIZER_DECIMATION;
+    int rotation = (int)((channelizer->rotation + (long long)start * CHANNELIZER_DECIMATION) % M);
+
+    for (int n = start; n < end; n++, phase += CHANNELIZER_DECIMATION) {
+        // The window of the output spans num_taps samples, the newest one at
+        // index phase of the new samples.
+        int window = first_window + phase;
+        dsp_kernels->polyphase_branches(buffers->branch_i, buffers->branch_q, channelizer->taps,
+                channelizer->work_i + window, channelizer->work_q + window, M, CHANNELIZER_TAPS_PER_BRANCH);
+
+        // Column c of the window holds the samples at distance M - 1 - c
+        // modulo M from the newest one, i.e. branch r = M - 1 - c. The DFT
+        // input is the branches rotated by n modulo M.
+        int c = M - 1 - rotation;
+        for (int r = 0; r < M; r++) {
+            input[r].re = branch_i[c];
+            input[r].im = branch_q[c];
+            if (--c < 0) c = M - 1;
+        }
+        fft_compute(&buffers->fft, output, input);
+
+        for (int k = 0; k < channelizer->num_outputs; k++) {
+            channelizer->out_i[k][n] = output[channelizer->bins[k]].re;
+            channelizer->out_q[k][n] = output[channelizer->bins[k]].im;
+        }
+        rotation = (rotation + CHANNELIZER_DECIMATION) % M;
+    }
+}
+
+// Finish the current block once all its parts are computed.
+void channelizer_end(Channelizer *channelizer) {
+    const int M = CHANNELIZER_NUM_CHANNELS;
+    int num_samples = channelizer->num_samples;
+    int history = channelizer->history;
+
+    channelizer->phase += channelizer->count * CHANNELIZER_DECIMATION - num_samples;
+    channelizer->rotation = (int)((channelizer->rotation + (long long)channelizer->count * CHANNELIZER_DECIMATION) % M);
+
+    // Keep the most recent samples for the next call.
+    memmove(channelizer->work_i, channelizer->work_i + num_samples, sizeof(float) * history);
+    memmove(channelizer->work_q, channelizer->work_q + num_samples, sizeof(float) * history);
+}
+
+// Split a block of len IQ bytes (at most 2 * max_len) into the selected
+// channels, all the parts on the calling thread. Returns the number of samples
+// of each channel, see channelizer_begin().
+int channelizer_process(Channelizer *channelizer, const uint8_t *block, int len) {
+    int count = channelizer_begin(channelizer, block, len);
+
+    for (int p = 0; p < channelizer->num_parts; p++) channelizer_process_part(channelizer, p);
+    channelizer_end(channelizer);
+    return count;
+}
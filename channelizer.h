@@ -0,0 +1,108 @@
+#ifndef CHANNELIZER_H
+#define CHANNELIZER_H
+
+#include <stdint.h>
+
+#include "dsp.h"
+
+// Polyphase filter bank splitting a wideband capture into evenly spaced
+// channels, so that several stations are recorded from a single dongle.
+//
+// Channel k is the signal around k * CHANNEL_SPACING from the center
+// frequency (k >= NUM_CHANNELS / 2 are the negative offsets), moved to
+// baseband, low-pass filtered and decimated to CHANNEL_RATE. Doing it with
+// one mixer and one filter per channel costs a prototype filter per channel
+// for every output sample. The filter bank instead splits the prototype
+// filter into NUM_CHANNELS branches, sums each branch once per output sample
+// and shares the mixing of all the channels in a single inverse FFT of the
+// branch sums.
+//
+// The channels are spaced like the broadcast FM raster, so that with the
+// dongle tuned on the raster every station falls at the center of a channel.
+// The output rate is higher than the spacing: adjacent channels overlap, and
+// a whole FM channel with its transition band fits in each of them.
+#define CHANNELIZER_SAMPLE_RATE 2400000
+#define CHANNEL_SPACING 100000
+#define CHANNELIZER_NUM_CHANNELS (CHANNELIZER_SAMPLE_RATE / CHANNEL_SPACING)
+#define CHANNELIZER_DECIMATION 5
+#define CHANNEL_RATE (CHANNELIZER_SAMPLE_RATE / CHANNELIZER_DECIMATION)
+// Prototype filter: passes the FM channel up to about 100 kHz from its center
+// and stops from about 145 kHz on, where the band of a station 200 kHz away
+// lies.
+#define CHANNELIZER_TAPS_PER_BRANCH 16
+#define CHANNELIZER_CUTOFF 125000.0
+// Largest offset of a channel from the center frequency. Beyond it the
+// channel gets close to the edges of the capture, where the filters of the
+// dongle attenuate and alias.
+#define CHANNELIZER_MAX_OFFSET (CHANNELIZER_SAMPLE_RATE / 2 - 2 * CHANNEL_SPACING)
+// The channels are produced in groups of this many samples, so that every
+// call hands whole blocks of the recursive filters (IIR_BLOCK samples) to the
+// demodulators, even after a half-band stage, and the audio does not depend
+// on the size of the blocks of IQ samples.
+#define CHANNELIZER_OUTPUT_MULTIPLE (2 * IIR_BLOCK)
+// Largest number of radix factors of the FFT.
+#define FFT_MAX_FACTORS 16
+
+typedef struct {
+    float re;
+    float im;
+} ComplexSample;
+
+// Mixed radix FFT of a small size, computed recursively like kissfft does.
+typedef struct {
+    int size;
+    int inverse;
+    int num_factors;
+    int factors[2 * FFT_MAX_FACTORS];   // Pairs of radix and remaining size
+    ComplexSample *twiddles;            // exp(sign * 2 pi i k / size)
+    ComplexSample *scratch;             // One radix worth of samples
+} Fft;
+
+// Working buffers of one part of the outputs of a block, see
+// channelizer_process_part().
+typedef struct {
+    float *branch_i;            // Sums of the branches of the current output
+    float *branch_q;
+    ComplexSample *spectrum;    // Input and output of the FFT
+    Fft fft;
+} ChannelizerPart;
+
+typedef struct {
+    int num_taps;               // NUM_CHANNELS * TAPS_PER_BRANCH
+    float *taps;                // Prototype filter, time reversed
+    int max_len;                // Maximum number of input samples per call
+    int history;                // Input samples kept from one call to the next
+    float *work_i;              // History followed by the new input samples
+    float *work_q;
+    int phase;                  // Index of the next output in the new input,
+                                // negative if it was held back
+    int rotation;               // Absolute index of the next output modulo NUM_CHANNELS
+
+    // The outputs of a block are split in num_parts ranges, which can be
+    // computed in parallel.
+    int num_parts;
+    ChannelizerPart *parts;
+    int num_samples;            // Input samples of the current block
+    int count;                  // Outputs of the current block
+
+    // Selected channels and their samples at CHANNEL_RATE.
+    int num_outputs;
+    int *bins;
+    float **out_i;
+    float **out_q;
+} Channelizer;
+
+int fft_init(Fft *fft, int size, int inverse);
+void fft_free(Fft *fft);
+void fft_compute(Fft *fft, ComplexSample *output, const ComplexSample *input);
+
+int channelizer_bin_for_offset(double offset);
+int channelizer_init(Channelizer *channelizer, const int *bins, int num_outputs, int max_len, int num_parts);
+void channelizer_free(Channelizer *channelizer);
+int channelizer_max_output(const Channelizer *channelizer);
+int channelizer_begin(Channelizer *channelizer, const uint8_t *block, int len);
+void channelizer_process_part(Channelizer *channelizer, int part);
+void channelizer_end(Channelizer *channelizer);
+int channelizer_process(Channelizer *channelizer, const uint8_t *block, int len);
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNELS
+#endif
+
+#include "dsp.h"
+#include "convert.h"
+
+void deinterleave_scalar(float *restrict i_samples, float *restrict q_samples,
+        const uint8_t *restrict iq, int num_samples) {
+    for (int i = 0; i < num_samples; i++) {
+        i_samples[i] = convert_value(iq[2 * i]);
+        q_samples[i] = convert_value(iq[2 * i + 1]);
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+// SSE2 has no byte shuffle, but it does not need one: reading 16 bytes as
+// eight 16-bit lanes, the low byte of each lane is an I value and the high
+// byte is the matching Q value. Masking and shifting separates them, already
+// widened to 16 bits, and unpacking with zeros widens them to 32 bits.
+__attribute__((target("sse2")))
+void deinterleave_sse2(float *restrict i_samples, float *restrict q_samples,
+        const uint8_t *restrict iq, int num_samples) {
+    const __m128i low_byte = _mm_set1_epi16(0x00FF);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 offset = _mm_set1_ps(127.5f);
+    int i = 0;
+
+    for (; i + 8 <= num_samples; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(iq + 2 * i));
+        __m128i i16 = _mm_and_si128(v, low_byte);
+        __m128i q16 = _mm_srli_epi16(v, 8);
+
+        __m128 i_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(i16, zero));
+        __m128 i_hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(i16, zero));
+        __m128 q_lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(q16, zero));
+        __m128 q_hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(q16, zero));
+
+        _mm_storeu_ps(i_samples + i, _mm_sub_ps(i_lo, offset));
+        _mm_storeu_ps(i_samples + i + 4, _mm_sub_ps(i_hi, offset));
+        _mm_storeu_ps(q_samples + i, _mm_sub_ps(q_lo, offset));
+        _mm_storeu_ps(q_samples + i + 4, _mm_sub_ps(q_hi, offset));
+    }
+
+    deinterleave_scalar(i_samples + i, q_samples + i, iq + 2 * i, num_samples - i);
+}
+
+// Same idea as the SSE2 kernel on 32 bytes at a time. The 16-bit lanes keep
+// the sample order inside each 128-bit half, so each half is widened to eight
+// 32-bit lanes with a single zero extension.
+__attribute__((target("avx2")))
+void deinterleave_avx2(float *restrict i_samples, float *restrict q_samples,
+        const uint8_t *restrict iq, int num_samples) {
+    const __m256i low_byte = _mm256_set1_epi16(0x00FF);
+    const __m256 offset = _mm256_set1_ps(127.5f);
+    int i = 0;
+
+    for (; i + 16 <= num_samples; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(iq + 2 * i));
+        __m256i i16 = _mm256_and_si256(v, low_byte);
+        __m256i q16 = _mm256_srli_epi16(v, 8);
+
+        __m256 i_lo = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(i16)));
+        __m256 i_hi = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(i16, 1)));
+        __m256 q_lo = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(q16)));
+        __m256 q_hi = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(q16, 1)));
+
+        _mm256_storeu_ps(i_samples + i, _mm256_sub_ps(i_lo, offset));
+        _mm256_storeu_ps(i_samples + i + 8, _mm256_sub_ps(i_hi, offset));
+        _mm256_storeu_ps(q_samples + i, _mm256_sub_ps(q_lo, offset));
+        _mm256_storeu_ps(q_samples + i + 8, _mm256_sub_ps(q_hi, offset));
+    }
+
+    deinterleave_scalar(i_samples + i, q_samples + i, iq + 2 * i, num_samples - i);
+}
+#endif
+
+#ifdef HAVE_NEON_KERNELS
+// NEON deinterleaves natively: vld2q_u8 loads 16 IQ pairs splitting I and Q
+// bytes into two registers, which are then widened to 16 and 32 bits.
+void deinterleave_neon(float *restrict i_samples, float *restrict q_samples,
+        const uint8_t *restrict iq, int num_samples) {
+    const float32x4_t offset = vdupq_n_f32(127.5f);
+    int i = 0;
+
+    for (; i + 16 <= num_samples; i += 16) {
+        uint8x16x2_t v = vld2q_u8(iq + 2 * i);
+        uint16x8_t i16[2] = { vmovl_u8(vget_low_u8(v.val[0])), vmovl_u8(vget_high_u8(v.val[0])) };
+        uint16x8_t q16[2] = { vmovl_u8(vget_low_u8(v.val[1])), vmovl_u8(vget_high_u8(v.val[1])) };
+
+        for (int h = 0; h < 2; h++) {
+            float32x4_t i_lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(i16[h])));
+            float32x4_t i_hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(i16[h])));
+            float32x4_t q_lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(q16[h])));
+            float32x4_t q_hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(q16[h])));
+
+            vst1q_f32(i_samples + i + 8 * h, vsubq_f32(i_lo, offset));
+            vst1q_f32(i_samples + i + 8 * h + 4, vsubq_f32(i_hi, offset));
+            vst1q_f32(q_samples + i + 8 * h, vsubq_f32(q_lo, offset));
+            vst1q_f32(q_samples + i + 8 * h + 4, vsubq_f32(q_hi, offset));
+        }
+    }
+
+    deinterleave_scalar(i_samples + i, q_samples + i, iq + 2 * i, num_samples - i);
+}
+#endif
+
+// Lookup tables built by convert_init(). Since the input is only 8 bits wide,
+// every possible conversion can be precomputed, including the DC offset and
+// IQ imbalance corrections. The corrected Q value depends on both bytes, but
+// linearly, so with 256 entries tables it is the sum of two lookups.
+typedef struct {
+    float i[256];               // Corrected I for each I byte
+    float q[256];               // Contribution of the Q byte to Q
+    float q_from_i[256];        // Contribution of the I byte to Q
+    float *pairs;               // Corrected (I, Q) for each pair, 512 KB
+} ConvertTables;
+
+static ConvertTables tables;
+
+const IqCorrection IQ_CORRECTION_NONE = { 0.0f, 0.0f, 1.0f, 0.0f };
+
+void deinterleave_lut256(float *restrict i_samples, float *restrict q_samples,
+        const uint8_t *restrict iq, int num_samples) {
+    for (int i = 0; i < num_samples; i++) {
+        uint8_t byte_i = iq[2 * i];
+        uint8_t byte_q = iq[2 * i + 1];
+
+        i_samples[i] = tables.i[byte_i];
+        q_samples[i] = tables.q[byte_q] + tables.q_from_i[byte_i];
+    }
+}
+
+// A single lookup per IQ pair, at the price of a table that does not fit in
+// L1 or L2 cache.
+void deinterleave_lut65536(float *restrict i_samples, float *restrict q_samples,
+        const uint8_t *restrict iq, int num_samples) {
+    for (int i = 0; i < num_samples; i++) {
+        const float *pair = tables.pairs + 2 * (iq[2 * i] | (iq[2 * i + 1] << 8));
+
+        i_samples[i] = pair[0];
+        q_samples[i] = pair[1];
+    }
+}
+
+// Fill the lookup tables. The imbalance is removed by taking I as reference
+// and rebuilding a Q channel orthogonal to it with the same amplitude:
+//   I' = I
+//   Q' = Q / (gain * cos(phase)) - I * tan(phase)
+// where I and Q already have their DC offset removed.
+int convert_build_tables(ConvertStrategy strategy, const IqCorrection *correction) {
+    float q_scale = 1.0f / (correction->gain_q * cosf(correction->phase));
+    float i_to_q = -tanf(correction->phase);
+
+    for (int v = 0; v < 256; v++) {
+        float corrected_i = convert_value(v) - correction->dc_i;
+        float corrected_q = convert_value(v) - correction->dc_q;
+
+        tables.i[v] = corrected_i;
+        tables.q[v] = corrected_q * q_scale;
+        tables.q_from_i[v] = corrected_i * i_to_q;
+    }
+
+    if (strategy != CONVERT_LUT65536 || tables.pairs != NULL) return 0;
+
+    tables.pairs = alloc_aligned(sizeof(float) * 2 * 65536);
+    if (tables.pairs == NULL) return -1;
+
+    for (int byte_q = 0; byte_q < 256; byte_q++) {
+        for (int byte_i = 0; byte_i < 256; byte_i++) {
+            float *pair = tables.pairs + 2 * (byte_i | (byte_q << 8));
+
+            pair[0] = tables.i[byte_i];
+            pair[1] = tables.q[byte_q] + tables.q_from_i[byte_i];
+        }
+    }
+
+    return 0;
+}
+
+// Kernel used by deinterleave_iq(). It starts as the scalar version so that
+// the conversion works even if convert_init() has not been called.
+static DeinterleaveFn active_deinterleave = deinterleave_scalar;
+
+// Return the kernel written for the given level, or NULL if it is not
+// available in this build or not supported by the CPU.
+DeinterleaveFn deinterleave_for_level(CpuLevel level) {
+    if (!cpu_level_supported(level)) return NULL;
+
+    switch (level) {
+#ifdef HAVE_X86_KERNELS
+        case CPU_LEVEL_SSE2: return deinterleave_sse2;
+        case CPU_LEVEL_AVX2:
+        case CPU_LEVEL_AVX512: return deinterleave_avx2;
+#endif
+#ifdef HAVE_NEON_KERNELS
+        case CPU_LEVEL_NEON: return deinterleave_neon;
+#endif
+        case CPU_LEVEL_SCALAR: return deinterleave_scalar;
+        default: return NULL;
+    }
+}
+
+// Select the conversion kernel: the lookup table strategies use the tables
+// built here, while the arithmetic one uses the best kernel for the given
+// level. Must be called before starting any processing thread.
+// Returns 0 on success and -1 on failure.
+int convert_init(CpuLevel level, ConvertStrategy strategy, const IqCorrection *correction) {
+    if (strategy != CONVERT_ARITHMETIC) {
+        if (correction == NULL) correction = &IQ_CORRECTION_NONE;
+        if (convert_build_tables(strategy, correction) < 0) return -1;
+
+        active_deinterleave = strategy == CONVERT_LUT256 ? deinterleave_lut256 : deinterleave_lut65536;
+        return 0;
+    }
+
+    DeinterleaveFn fn = deinterleave_for_level(level);
+    active_deinterleave = fn != NULL ? fn : deinterleave_scalar;
+    return 0;
+}
+
+void deinterleave_iq(float *restrict i_samples, float *restrict q_samples,
+        const uint8_t *restrict iq, int num_samples) {
+    active_deinterleave(i_samples, q_samples, iq, num_samples);
+}
@@ -0,0 +1,43 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+// Split interleaved uint8 IQ samples into I and Q float arrays, converting
+// each value like convert_value() does. num_samples is the number of IQ pairs.
+typedef void (*DeinterleaveFn)(float *restrict i_samples, float *restrict q_samples,
+        const uint8_t *restrict iq, int num_samples);
+
+// Strategies used to convert IQ bytes to float values.
+typedef enum {
+    CONVERT_ARITHMETIC,         // Subtraction of the midpoint, SIMD kernels
+    CONVERT_LUT256,             // One 256 entries table per component
+    CONVERT_LUT65536,           // One table mapping each I/Q byte pair
+} ConvertStrategy;
+
+// Correction of the analog front end imperfections, only applied by the
+// lookup table strategies where it comes for free.
+// The DC offsets are expressed in converted units (the midpoint of the uint8
+// range is 0), the Q gain is the amplitude of Q relative to I and the phase is
+// the deviation from orthogonality of the Q channel, in radians.
+typedef struct {
+    float dc_i;
+    float dc_q;
+    float gain_q;
+    float phase;
+} IqCorrection;
+
+// Largest phase error accepted, in degrees. Q is divided by the cosine of the
+// phase, which blows up the noise of Q as the phase gets close to 90 degrees.
+#define MAX_IQ_PHASE_ERROR 45.0
+
+extern const IqCorrection IQ_CORRECTION_NONE;
+
+int convert_init(CpuLevel level, ConvertStrategy strategy, const IqCorrection *correction);
+DeinterleaveFn deinterleave_for_level(CpuLevel level);
+void deinterleave_iq(float *restrict i_samples, float *restrict q_samples,
+        const uint8_t *restrict iq, int num_samples);
+
+#endif
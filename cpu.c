@@ -0,0 +1,54 @@
+#include <string.h>
+
+#include "cpu.h"
+
+// Return the best instruction set level supported by the running CPU.
+// On x86 the features are queried at runtime through cpuid, so that a single
+// binary uses AVX2 where available and still runs on older processors.
+CpuLevel cpu_detect_level(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+            __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("fma")) {
+        return CPU_LEVEL_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return CPU_LEVEL_AVX2;
+    if (__builtin_cpu_supports("sse2")) return CPU_LEVEL_SSE2;
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+    return CPU_LEVEL_NEON;
+#endif
+    return CPU_LEVEL_SCALAR;
+}
+
+// Return non-zero if kernels of the given level can run on this CPU.
+int cpu_level_supported(CpuLevel level) {
+    CpuLevel best = cpu_detect_level();
+
+    if (level == CPU_LEVEL_SCALAR) return 1;
+    if (best == CPU_LEVEL_NEON) return level == CPU_LEVEL_NEON;
+    return level != CPU_LEVEL_NEON && level <= best;
+}
+
+const char *cpu_level_name(CpuLevel level) {
+    switch (level) {
+        case CPU_LEVEL_SSE2: return "sse2";
+        case CPU_LEVEL_AVX2: return "avx2";
+        case CPU_LEVEL_AVX512: return "avx512";
+        case CPU_LEVEL_NEON: return "neon";
+        default: return "scalar";
+    }
+}
+
+// Parse the name of a level, as returned by cpu_level_name().
+// Returns 0 on success and -1 if the name is unknown.
+int cpu_level_from_name(const char *name, CpuLevel *level) {
+    const CpuLevel levels[] = { CPU_LEVEL_SCALAR, CPU_LEVEL_SSE2, CPU_LEVEL_AVX2, CPU_LEVEL_AVX512, CPU_LEVEL_NEON };
+
+    for (int i = 0; i < (int)(sizeof(levels) / sizeof(levels[0])); i++) {
+        if (strcmp(name, cpu_level_name(levels[i])) == 0) {
+            *level = levels[i];
+            return 0;
+        }
+    }
+    return -1;
+}
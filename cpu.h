@@ -0,0 +1,19 @@
+#ifndef CPU_H
+#define CPU_H
+
+// Instruction set levels for which optimized DSP kernels exist. On x86 each
+// level includes the previous ones, NEON is the baseline of 64-bit ARM.
+typedef enum {
+    CPU_LEVEL_SCALAR,
+    CPU_LEVEL_SSE2,
+    CPU_LEVEL_AVX2,
+    CPU_LEVEL_AVX512,           // AVX-512 F, BW and VL
+    CPU_LEVEL_NEON,
+} CpuLevel;
+
+CpuLevel cpu_detect_level(void);
+int cpu_level_supported(CpuLevel level);
+const char *cpu_level_name(CpuLevel level);
+int cpu_level_from_name(const char *name, CpuLevel *level);
+
+#endif
@@ -0,0 +1,347 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "dsp.h"
+#include "decimator.h"
+#include "kernels.h"
+
+// Design a low-pass filter with the windowed-sinc method: the ideal impulse
+// response (a sinc) is truncated to num_taps samples and smoothed with a
+// Blackman window, which gives about 74 dB of stopband attenuation.
+// The gain at DC is normalized to 1.
+void design_lowpass(float *taps, int num_taps, double cutoff, double sample_rate) {
+    double fc = cutoff / sample_rate;
+    double center = (num_taps - 1) / 2.0;
+    double sum = 0.0;
+
+    for (int k = 0; k < num_taps; k++) {
+        double t = k - center;
+        double sinc = t == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * t) / (M_PI * t);
+        double window = num_taps == 1 ? 1.0 :
+            0.42 - 0.5 * cos(2.0 * M_PI * k / (num_taps - 1)) + 0.08 * cos(4.0 * M_PI * k / (num_taps - 1));
+
+        taps[k] = sinc * window;
+        sum += taps[k];
+    }
+
+    for (int k = 0; k < num_taps; k++) {
+        taps[k] /= sum;
+    }
+}
+
+// Prepare a decimator by factor, filtering with num_taps coefficients.
+// max_len is the largest number of input samples passed to a single call of
+// fir_decimator_process(), all the memory is allocated here.
+// Returns 0 on success and -1 on failure.
+int fir_decimator_init(FirDecimator *decimator, int factor, int num_taps, double cutoff, double sample_rate, int max_len) {
+    if (factor < 1 || num_taps < 1) return -1;
+
+    decimator->factor = factor;
+    decimator->num_taps = num_taps;
+    decimator->padded_taps = (num_taps + FIR_LANES - 1) / FIR_LANES * FIR_LANES;
+    decimator->max_len = max_len;
+
+    // The last window can read up to padded_taps - num_taps samples past the
+    // valid data, which are multiplied by the zero padding of the taps.
+    decimator->taps = alloc_aligned(sizeof(float) * decimator->padded_taps);
+    decimator->work = alloc_aligned(sizeof(float) * (decimator->padded_taps + max_len));
+    if (decimator->taps == NULL || decimator->work == NULL) {
+        fir_decimator_free(decimator);
+        return -1;
+    }
+
+    memset(decimator->taps, 0, sizeof(float) * decimator->padded_taps);
+    design_lowpass(decimator->taps, num_taps, cutoff, sample_rate);
+    fir_decimator_reset(decimator);
+
+    return 0;
+}
+
+void fir_decimator_free(FirDecimator *decimator) {
+    free(decimator->taps);
+    free(decimator->work);
+    decimator->taps = NULL;
+    decimator->work = NULL;
+}
+
+// Clear the history, as if the filter never received any sample.
+void fir_decimator_reset(FirDecimator *decimator) {
+    memset(decimator->work, 0, sizeof(float) * (decimator->padded_taps + decimator->max_len));
+    // Like the boxcar decimation, the first output is produced once factor
+    // samples have been received.
+    decimator->phase = decimator->factor - 1;
+}
+
+// Largest number of output samples produced by a single call.
+int fir_decimator_max_output(const FirDecimator *decimator) {
+    return (decimator->max_len + decimator->factor - 1) / decimator->factor;
+}
+
+// Where the next input samples go for fir_decimator_filter(). Kernels that
+// produce the input themselves write it there directly, saving a copy.
+float *fir_decimator_input(FirDecimator *decimator) {
+    return decimator->work + decimator->num_taps - 1;
+}
+
+// Filter and decimate len input samples (at most max_len).
+// Returns the number of samples written to output.
+int fir_decimator_process(FirDecimator *decimator, float *output, const float *input, int len) {
+    memcpy(fir_decimator_input(decimator), input, sizeof(float) * len);
+    return fir_decimator_filter(decimator, output, len);
+}
+
+// Filter and decimate the len samples already stored at
+// fir_decimator_input(). Returns the number of samples written to output.
+int fir_decimator_filter(FirDecimator *decimator, float *output, int len) {
+    int history = decimator->num_taps - 1;
+    float *work = decimator->work;
+
+    // The window of the output produced at input sample p spans the samples
+    // from p - num_taps + 1 to p, i.e. work[p] to work[p + num_taps - 1].
+    int count = dsp_kernels->fir_filter(output, decimator->taps, decimator->padded_taps, work,
+            decimator->phase, decimator->factor, len);
+    decimator->phase += count * decimator->factor - len;
+
+    // Keep the most recent samples for the next call.
+    memmove(work, work + len, sizeof(float) * history);
+
+    return count;
+}
+
+// The state carried from one call to the next is the phase and the history
+// of the filter: saved by one decimator and loaded by another one with the
+// same configuration, it continues the stream of the first one, e.g. on
+// another thread. Size in bytes of the state.
+size_t fir_decimator_state_size(const FirDecimator *decimator) {
+    return sizeof(int) + sizeof(float) * (decimator->num_taps - 1);
+}
+
+void fir_decimator_save_state(const FirDecimator *decimator, uint8_t *state) {
+    memcpy(state, &decimator->phase, sizeof(int));
+    memcpy(state + sizeof(int), decimator->work, sizeof(float) * (decimator->num_taps - 1));
+}
+
+void fir_decimator_load_state(FirDecimator *decimator, const uint8_t *state) {
+    memcpy(&decimator->phase, state, sizeof(int));
+    memcpy(decimator->work, state + sizeof(int), sizeof(float) * (decimator->num_taps - 1));
+}
+
+// Prepare a half-band stage for the given input rate. The transition band
+// goes from the edge of the FM channel to its alias at the output rate.
+int halfband_init(HalfbandStage *stage, double input_rate, int max_len) {
+    double transition = input_rate / 2.0 - FM_CHANNEL_BANDWIDTH;
+    int num_taps = (int)ceil(BLACKMAN_TRANSITION * input_rate / transition);
+
+    // Round up to 4k + 3 taps, so that both ends are non-zero coefficients.
+    num_taps = num_taps / 4 * 4 + 3;
+    int history = num_taps - 1;
+
+    stage->num_taps = num_taps;
+    stage->num_pairs = (num_taps + 1) / 4;
+    stage->max_len = max_len;
+    stage->pair_taps = alloc_aligned(sizeof(float) * stage->num_pairs);
+    stage->work_i = alloc_aligned(sizeof(float) * (history + max_len));
+    stage->work_q = alloc_aligned(sizeof(float) * (history + max_len));
+    stage->center_branch = alloc_aligned(sizeof(float) * (max_len / 2 + 1));
+    stage->odd_branch = alloc_aligned(sizeof(float) * (max_len / 2 + 2 * stage->num_pairs));
+    float *taps = alloc_aligned(sizeof(float) * num_taps);
+    if (stage->pair_taps == NULL || stage->work_i == NULL || stage->work_q == NULL ||
+            stage->center_branch == NULL || stage->odd_branch == NULL || taps == NULL) {
+        free(taps);
+        return -1;
+    }
+
+    // A windowed sinc with the cutoff at a quarter of the rate has zeros at
+    // every even distance from the center.
+    design_lowpass(taps, num_taps, input_rate / 4.0, input_rate);
+    int center = history / 2;
+    for (int k = 0; k < stage->num_pairs; k++) {
+        stage->pair_taps[k] = taps[center + 2 * k + 1];
+    }
+    free(taps);
+
+    memset(stage->work_i, 0, sizeof(float) * (history + max_len));
+    memset(stage->work_q, 0, sizeof(float) * (history + max_len));
+    stage->phase = 1;
+
+    return 0;
+}
+
+void halfband_free(HalfbandStage *stage) {
+    free(stage->pair_taps);
+    free(stage->work_i);
+    free(stage->work_q);
+    free(stage->center_branch);
+    free(stage->odd_branch);
+    stage->pair_taps = NULL;
+    stage->work_i = NULL;
+    stage->work_q = NULL;
+    stage->center_branch = NULL;
+    stage->odd_branch = NULL;
+}
+
+// Filter one component, writing one output every two input samples.
+// The input is first split in its two polyphase branches: the samples at the
+// center of each window, and the ones at odd distances from the centers,
+// which are the only ones multiplied by non-zero coefficients. With the odd
+// samples contiguous, every coefficient is applied to a whole tile of outputs
+// at once, which vectorizes without reordering any float addition.
+int halfband_filter(const HalfbandStage *stage, float *output, const float *work, int phase, int len) {
+    const int center = (stage->num_taps - 1) / 2;
+    const int pairs = stage->num_pairs;
+    float *center_branch = stage->center_branch;
+    float *odd_branch = stage->odd_branch;
+    int count = (len - phase + 1) / 2;
+
+    // The output m is centered on work[phase + center + 2m], and its odd
+    // neighbours are work[phase + 2n] for n from m to m + 2 * pairs - 1.
+    for (int m = 0; m < count; m++) {
+        center_branch[m] = work[phase + center + 2 * m];
+    }
+    for (int n = 0; n < count + 2 * pairs - 1; n++) {
+        odd_branch[n] = work[phase + 2 * n];
+    }
+
+    dsp_kernels->halfband_filter(output, center_branch, odd_branch, stage->pair_taps, pairs, count);
+    return count;
+}
+
+// Decimate by 2 len complex samples, in place. Returns the number of samples.
+int halfband_process(HalfbandStage *stage, float *i_samples, float *q_samples, int len) {
+    int history = stage->num_taps - 1;
+
+    memcpy(stage->work_i + history, i_samples, sizeof(float) * len);
+    memcpy(stage->work_q + history, q_samples, sizeof(float) * len);
+
+    halfband_filter(stage, i_samples, stage->work_i, stage->phase, len);
+    int count = halfband_filter(stage, q_samples, stage->work_q, stage->phase, len);
+    stage->phase = (stage->phase + count * 2) - len;
+
+    memmove(stage->work_i, stage->work_i + len, sizeof(float) * history);
+    memmove(stage->work_q, stage->work_q + len, sizeof(float) * history);
+
+    return count;
+}
+
+// Derive the decimation plan from the input and audio rates: one half-band
+// stage for every halving that keeps the IQ rate above IQ_MIN_RATE and
+// divides the total factor, then an FIR for the remaining factor.
+// max_len is the largest number of IQ samples passed to a single call.
+// Returns 0 on success and -1 on failure.
+int multistage_init(MultistageDecimator *decimator, int sample_rate, int audio_rate, int max_len) {
+    int factor = sample_rate / audio_rate;
+    int rate = sample_rate;
+
+    decimator->num_iq_stages = 0;
+    decimator->audio.taps = NULL;
+    decimator->audio.work = NULL;
+    while (factor % 2 == 0 && rate / 2 >= IQ_MIN_RATE && decimator->num_iq_stages < MAX_HALFBAND_STAGES) {
+        HalfbandStage *stage = &decimator->iq_stages[decimator->num_iq_stages];
+        if (halfband_init(stage, rate, max_len) < 0) {
+            halfband_free(stage);
+            multistage_free(decimator);
+            return -1;
+        }
+
+        decimator->num_iq_stages++;
+        max_len = max_len / 2 + 1;
+        rate /= 2;
+        factor /= 2;
+    }
+    decimator->iq_rate = rate;
+
+    // The transition band of the audio filter goes from the edge of the audio
+    // band to its alias at the audio rate.
+    double transition = audio_rate - 2.0 * AUDIO_BANDWIDTH;
+    int num_taps = (int)ceil(BLACKMAN_TRANSITION * rate / transition);
+    if (fir_decimator_init(&decimator->audio, factor, num_taps, FIR_CUTOFF, rate, max_len) < 0) {
+        multistage_free(decimator);
+        return -1;
+    }
+
+    // The discriminator output grows with the phase step per sample, which is
+    // larger at a lower rate: scale it back to the level at the input rate.
+    for (int k = 0; k < num_taps; k++) {
+        decimator->audio.taps[k] *= (float)rate / sample_rate;
+    }
+
+    return 0;
+}
+
+void multistage_free(MultistageDecimator *decimator) {
+    for (int s = 0; s < decimator->num_iq_stages; s++) {
+        halfband_free(&decimator->iq_stages[s]);
+    }
+    decimator->num_iq_stages = 0;
+    fir_decimator_free(&decimator->audio);
+}
+
+// Run the IQ stages in place. Returns the number of IQ samples at iq_rate.
+int multistage_process_iq(MultistageDecimator *decimator, float *i_samples, float *q_samples, int len) {
+    for (int s = 0; s < decimator->num_iq_stages; s++) {
+        len = halfband_process(&decimator->iq_stages[s], i_samples, q_samples, len);
+    }
+    return len;
+}
+
+// State of the half-band stages and of the audio filter, see
+// fir_decimator_state_size().
+size_t multistage_state_size(const MultistageDecimator *decimator) {
+    size_t size = fir_decimator_state_size(&decimator->audio);
+    for (int s = 0; s < decimator->num_iq_stages; s++) {
+        size += sizeof(int) + 2 * sizeof(float) * (decimator->iq_stages[s].num_taps - 1);
+    }
+    return size;
+}
+
+void multistage_save_state(const MultistageDecimator *decimator, uint8_t *state) {
+    for (int s = 0; s < decimator->num_iq_stages; s++) {
+        const HalfbandStage *stage = &decimator->iq_stages[s];
+        size_t history = sizeof(float) * (stage->num_taps - 1);
+        memcpy(state, &stage->phase, sizeof(int));
+        memcpy(state + sizeof(int), stage->work_i, history);
+        memcpy(state + sizeof(int) + history, stage->work_q, history);
+        state += sizeof(int) + 2 * history;
+    }
+    fir_decimator_save_state(&decimator->audio, state);
+}
+
+void multistage_load_state(MultistageDecimator *decimator, const uint8_t *state) {
+    for (int s = 0; s < decimator->num_iq_stages; s++) {
+        HalfbandStage *stage = &decimator->iq_stages[s];
+        size_t history = sizeof(float) * (stage->num_taps - 1);
+        memcpy(&stage->phase, state, sizeof(int));
+        memcpy(stage->work_i, state + sizeof(int), history);
+        memcpy(stage->work_q, state + sizeof(int) + history, history);
+        state += sizeof(int) + 2 * history;
+    }
+    fir_decimator_load_state(&decimator->audio, state);
+}
+
+// Number of multiply-accumulate operations needed for each audio sample.
+double multistage_macs_per_output(const MultistageDecimator *decimator, int sample_rate, int audio_rate) {
+    double macs = 0.0;
+    int rate = sample_rate;
+
+    for (int s = 0; s < decimator->num_iq_stages; s++) {
+        rate /= 2;
+        // Two components, each with one multiplication per pair plus the
+        // central coefficient.
+        macs += 2.0 * (decimator->iq_stages[s].num_pairs + 1) * rate / audio_rate;
+    }
+
+    return macs + decimator->audio.num_taps;
+}
+
+void multistage_print_plan(const MultistageDecimator *decimator, int sample_rate, int audio_rate, FILE *out) {
+    int rate = sample_rate;
+
+    for (int s = 0; s < decimator->num_iq_stages; s++) {
+        fprintf(out, "  IQ half-band %d taps: %d -> %d Hz\n", decimator->iq_stages[s].num_taps, rate, rate / 2);
+        rate /= 2;
+    }
+    fprintf(out, "  FM discriminator at %d Hz\n", rate);
+    fprintf(out, "  audio FIR %d taps: %d -> %d Hz\n", decimator->audio.num_taps, rate, rate / decimator->audio.factor);
+    fprintf(out, "  %.1f MACs per audio sample\n", multistage_macs_per_output(decimator, sample_rate, audio_rate));
+}
@@ -0,0 +1,97 @@
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Default design of the low-pass filter of the FIR decimator. The cutoff
+// keeps the mono audio band (up to 15 kHz) and removes the 19 kHz stereo
+// pilot and the stereo and RDS subcarriers above it, which would otherwise
+// alias into the audio band.
+#define FIR_DEFAULT_TAPS 512
+#define FIR_CUTOFF 16000.0
+// Number of partial sums of the dot products, one per SIMD lane.
+#define FIR_LANES 8
+
+// Multistage decimation. Half-band stages halve the IQ rate before the
+// discriminator as long as the FM channel still fits with some margin, then a
+// short FIR filters the audio and brings it to the final rate.
+// The occupied bandwidth of a broadcast FM channel (Carson's rule), the
+// bandwidth of the mono audio and the number of taps per octave of
+// transition band of the Blackman window determine the filter lengths.
+#define FM_CHANNEL_BANDWIDTH 200000.0
+#define AUDIO_BANDWIDTH 15000.0
+#define IQ_MIN_RATE (1.2 * FM_CHANNEL_BANDWIDTH)
+#define BLACKMAN_TRANSITION 5.5
+#define MAX_HALFBAND_STAGES 8
+// Number of outputs of a half-band stage computed together, small enough for
+// the outputs and the inputs they need to stay in L1 cache.
+#define HALFBAND_TILE 512
+
+// Decimators that can be used to go from the IQ rate to the audio rate.
+typedef enum {
+    DECIMATOR_FIR,              // Polyphase windowed-sinc FIR
+    DECIMATOR_BOXCAR,           // Average of DECIMATION_FACTOR samples
+    DECIMATOR_MULTISTAGE,       // Half-band IQ stages and audio FIR
+} DecimatorType;
+
+// Decimating FIR filter. Only one output every factor input samples is
+// computed, which is what the polyphase decomposition of the filter achieves.
+// The last num_taps - 1 input samples are kept between calls, so that a
+// stream split in buffers is filtered as a single signal.
+typedef struct {
+    int factor;
+    int num_taps;
+    int padded_taps;            // num_taps rounded up to FIR_LANES
+    int max_len;                // Maximum number of input samples per call
+    float *taps;                // Coefficients, zero padded
+    float *work;                // History followed by the new input samples
+    int phase;                  // Index of the next output in the new input
+} FirDecimator;
+
+// Half-band filter decimating complex samples by 2. Every other coefficient
+// of a half-band filter is zero, except the central one which is 1/2, and the
+// filter is symmetric, so each output needs (num_taps + 1) / 4 + 1
+// multiplications per component.
+typedef struct {
+    int num_taps;               // Of the form 4k + 3
+    int num_pairs;              // Non-zero coefficients on each side
+    float *pair_taps;           // Coefficients at odd distances from center
+    int max_len;
+    float *work_i;              // History followed by the new samples
+    float *work_q;
+    float *center_branch;       // Samples at the center of each window
+    float *odd_branch;          // Samples at odd distances from the centers
+    int phase;                  // 0 or 1, index of the next output
+} HalfbandStage;
+
+typedef struct {
+    int num_iq_stages;
+    HalfbandStage iq_stages[MAX_HALFBAND_STAGES];
+    int iq_rate;                // Rate at the discriminator
+    FirDecimator audio;         // From iq_rate to the audio rate
+} MultistageDecimator;
+
+void design_lowpass(float *taps, int num_taps, double cutoff, double sample_rate);
+int fir_decimator_init(FirDecimator *decimator, int factor, int num_taps, double cutoff, double sample_rate, int max_len);
+void fir_decimator_free(FirDecimator *decimator);
+void fir_decimator_reset(FirDecimator *decimator);
+int fir_decimator_process(FirDecimator *decimator, float *output, const float *input, int len);
+float *fir_decimator_input(FirDecimator *decimator);
+int fir_decimator_filter(FirDecimator *decimator, float *output, int len);
+int fir_decimator_max_output(const FirDecimator *decimator);
+size_t fir_decimator_state_size(const FirDecimator *decimator);
+void fir_decimator_save_state(const FirDecimator *decimator, uint8_t *state);
+void fir_decimator_load_state(FirDecimator *decimator, const uint8_t *state);
+
+int multistage_init(MultistageDecimator *decimator, int sample_rate, int audio_rate, int max_len);
+void multistage_free(MultistageDecimator *decimator);
+int multistage_process_iq(MultistageDecimator *decimator, float *i_samples, float *q_samples, int len);
+size_t multistage_state_size(const MultistageDecimator *decimator);
+void multistage_save_state(const MultistageDecimator *decimator, uint8_t *state);
+void multistage_load_state(MultistageDecimator *decimator, const uint8_t *state);
+double multistage_macs_per_output(const MultistageDecimator *decimator, int sample_rate, int audio_rate);
+void multistage_print_plan(const MultistageDecimator *decimator, int sample_rate, int audio_rate, FILE *out);
+
+#endif
@@ -0,0 +1,389 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "dsp.h"
+#include "convert.h"
+#include "kernels.h"
+
+// Number of heap allocations made by each thread. The program is linked with
+// -Wl,--wrap for malloc(), calloc(), realloc() and posix_memalign() (see the
+// Makefile), so that every allocation of its own code goes through the
+// wrappers below. The counter is per thread, so that a pipeline only sees the
+// allocations of the thread running it, not those of the other workers or of
+// the writer.
+static _Thread_local uint64_t allocation_count;
+// Non-zero if large buffers should be backed by huge pages.
+static int use_hugepages;
+
+// Back the large buffers allocated from now on with transparent huge pages.
+// A single 2 MB page covers a whole working buffer, so streaming through the
+// buffers of a large block does not keep missing the TLB.
+void dsp_set_hugepages(int enable) {
+    use_hugepages = enable;
+}
+
+// Allocate a buffer aligned to DSP_ALIGNMENT bytes, so that SIMD loads never
+// straddle a cache line. Returns NULL on failure, release it with free().
+void *alloc_aligned(size_t size) {
+    void *ptr = NULL;
+
+    if (use_hugepages && size >= HUGEPAGE_MIN_SIZE) {
+        // The kernel can only use a huge page for an aligned range covering
+        // it entirely.
+        size = (size + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+        if (posix_memalign(&ptr, HUGEPAGE_SIZE, size) != 0) return NULL;
+#ifdef MADV_HUGEPAGE
+        madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+        return ptr;
+    }
+
+    if (posix_memalign(&ptr, DSP_ALIGNMENT, size) != 0) return NULL;
+    return ptr;
+}
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+int __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocation_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocation_count++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocation_count++;
+    return __real_realloc(ptr, size);
+}
+
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size) {
+    allocation_count++;
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+// Heap allocations made so far by the calling thread.
+uint64_t dsp_allocation_count(void) {
+    return allocation_count;
+}
+
+// Minimax polynomials for the fast arctan approximation, sorted by increasing
+// accuracy. The coefficients were obtained with the Remez exchange algorithm,
+// minimizing the maximum absolute error on [0, 1]. The error bounds are the
+// largest errors of fast_atan2_block() against atan2() measured over 2^26
+// angles spread on the whole circle, at every instruction set level, plus a
+// 10% margin: besides the error of the polynomials they cover the rounding of
+// their float evaluation, of the division and of the octant corrections.
+static const AtanApprox ATAN_APPROXIMATIONS[] = {
+    { 2, 5.5e-3f, { 0.972394118f, -0.191947954f } },
+    { 3, 6.7e-4f, { 0.995357955f, -0.288690238f, 0.0793390414f } },
+    { 4, 9.0e-5f, { 0.999213813f, -0.321174969f, 0.146264464f, -0.0389865142f } },
+    { 5, 1.3e-5f, { 0.999866329f, -0.330304786f, 0.180159295f, -0.0851563509f, 0.0208451142f } },
+    { 6, 2.2e-6f, { 0.999977219f, -0.332622828f, 0.193540376f, -0.116426482f, 0.0526473515f, -0.0117191357f } },
+    { 7, 6.0e-7f, { 0.999996112f, -0.333173681f, 0.198078156f, -0.132333421f, 0.0796236724f, -0.0336042206f, 0.00681179329f } },
+};
+
+// Return the cheapest approximation whose error does not exceed max_error.
+// If no approximation is accurate enough the most accurate one is returned.
+const AtanApprox *atan_approx_for_error(float max_error) {
+    int count = sizeof(ATAN_APPROXIMATIONS) / sizeof(ATAN_APPROXIMATIONS[0]);
+
+    for (int i = 0; i < count; i++) {
+        if (ATAN_APPROXIMATIONS[i].max_error <= max_error) return &ATAN_APPROXIMATIONS[i];
+    }
+    return &ATAN_APPROXIMATIONS[count - 1];
+}
+
+// Approximate atan2(y, x) over len samples, with the accuracy of approx.
+void fast_atan2_block(float *angles, const float *y, const float *x, int len, const AtanApprox *approx) {
+    dsp_kernels->fast_atan2_block(angles, y, x, len, approx);
+}
+
+// Convert value from unsigned int to float.
+// This function is used for converting IQ samples to float values.
+float convert_value(uint8_t value) {
+    return (float)value - 127.5f;
+}
+
+// Compute the istantaneous frequency from a pair of IQ samples.
+// This is the core of FM demodulation, as it converts the raw IQ samples into
+// a frequency value that contains the actual audio data.
+//
+// The frequency is the derivative of the phase, which is the angle of the
+// signal in the complex plane. Instead of computing the two phases and
+// subtracting them, we multiply the current sample by the complex conjugate of
+// the previous one: the angle of the product is exactly the phase difference.
+//   z2 * conj(z1) = (i2 + jq2)(i1 - jq1) = (i1i2 + q1q2) + j(i1q2 - q1i2)
+// This needs a single arctan per sample and the result is already in the
+// (-pi, pi] range, so no phase unwrapping is needed.
+float get_instant_freq(float i1, float q1, float i2, float q2) {
+    float re = i1 * i2 + q1 * q2;
+    float im = i1 * q2 - q1 * i2;
+
+    return atan2f(im, re);
+}
+
+// Reference discriminator, kept for accuracy comparisons.
+// It computes the phase of each sample with an arctan of Q/I, following simple
+// trigonometry formulas, and then the derivative by subtracting the two
+// consecutive phases.
+// It is important to handle the case where the shift in phase is small but
+// the computed arctan value is the clipped to the opposite value (e.g. +pi and
+// -pi), as it will cause a sudden jump in the final audio. 
+// To solve this issue we can subtract or add 2pi depending on
+// the frequency value.
+float get_instant_freq_atan2(float i1, float q1, float i2, float q2) {
+    float phase1 = atan2(q1, i1);
+    float phase2 = atan2(q2, i2);
+
+    float instant_freq = phase2 - phase1;
+    
+    if (instant_freq > M_PI) instant_freq -= 2 * M_PI;
+    else if (instant_freq < -M_PI) instant_freq += 2 * M_PI;
+
+    return instant_freq;
+}
+
+// Compute istantaneous frequency over all the IQ samples.
+// Each frequency sample is obtained from an IQ sample and the previous one,
+// the first one using the last IQ sample of the previous buffer.
+// The discriminator is selected outside of the loops, so that the compiler
+// can inline it.
+void get_freq_values(float *freq_samples, float *i_samples, float *q_samples, float last_i, float last_q, int len, Discriminator discriminator, const AtanApprox *approx) {
+    if (discriminator == DISCRIMINATOR_FAST) {
+        dsp_kernels->freq_values_fast(freq_samples, i_samples, q_samples, last_i, last_q, len, approx);
+        return;
+    }
+
+    if (discriminator == DISCRIMINATOR_ATAN2) {
+        freq_samples[0] = get_instant_freq_atan2(
+            last_i, last_q, i_samples[0], q_samples[0] 
+        );
+        for (int i = 1; i < len; i++) {
+            freq_samples[i] = get_instant_freq_atan2(
+                    i_samples[i-1], q_samples[i-1], i_samples[i], q_samples[i]
+            );
+        }
+        return;
+    }
+
+    freq_samples[0] = get_instant_freq(
+        last_i, last_q, i_samples[0], q_samples[0] 
+    );
+    for (int i = 1; i < len; i++) {
+        freq_samples[i] = get_instant_freq(
+                i_samples[i-1], q_samples[i-1], i_samples[i], q_samples[i]
+        );
+    }
+}
+
+// Prepare a first order recursive filter
+//   y[n] = gain * x[n] + pole * y[n-1]
+// together with the tables of its block formulation. Unrolling the recursion
+// over IIR_BLOCK samples gives
+//   y[n+k] = sum_{j<=k} gain * pole^(k-j) * x[n+j] + pole^(k+1) * y[n-1]
+// so the outputs of a block only depend on its inputs and on the last output
+// of the previous block.
+void first_order_init(FirstOrderFilter *filter, double gain, double pole) {
+    filter->gain = gain;
+    filter->pole = pole;
+
+    for (int k = 0; k < IIR_BLOCK; k++) {
+        filter->decay[k] = pow(pole, k + 1);
+        for (int j = 0; j < IIR_BLOCK; j++) {
+            filter->response[j][k] = j <= k ? gain * pow(pole, k - j) : 0.0;
+        }
+    }
+}
+
+// Filter the samples in place one at a time, starting from the last output
+// of the previous call. Returns the last output.
+float first_order_serial(const FirstOrderFilter *filter, float *samples, int len, float last_output) {
+    const float gain = filter->gain;
+    const float pole = filter->pole;
+
+    for (int i = 0; i < len; i++) {
+        last_output = gain * samples[i] + pole * last_output;
+        samples[i] = last_output;
+    }
+
+    return last_output;
+}
+
+// Filter the samples in place IIR_BLOCK at a time with the block formulation.
+// Each block is a small matrix-vector product whose rows are independent, so
+// it maps on SIMD registers, and only the last output is carried from one
+// block to the next. The result matches first_order_serial() up to float
+// rounding. Returns the last output.
+float first_order_block(const FirstOrderFilter *filter, float *samples, int len, float last_output) {
+    return dsp_kernels->first_order_block(filter, samples, len, last_output);
+}
+
+// Add the contribution of the output carried into a chunk that was filtered
+// starting from zero: the sample k of the chunk gets pole^(k+1) * carry.
+// The contribution decays geometrically. The carried output is a sample of
+// the stream, so once the contribution is 2^-24 of it, below the float
+// precision of the samples around the boundary, the loop stops: about 1650
+// samples for the DC block and 780 for the de-emphasis.
+void first_order_fixup(const FirstOrderFilter *filter, float *samples, int len, float carry) {
+    const float limit = fabsf(carry) * 0x1p-24f;
+
+    for (int i = 0; i < len && fabsf(carry) > limit; i++) {
+        carry *= filter->pole;
+        samples[i] += carry;
+    }
+}
+
+// Filter the samples in place split in num_chunks chunks. Every chunk is
+// first filtered from a zero state, independently of the others, then the
+// outputs carried across the chunk boundaries are propagated and added back
+// with first_order_fixup(). The first and the last steps can run on separate
+// cores, only the propagation of one value per chunk is serial.
+// Returns the last output.
+float first_order_chunks(const FirstOrderFilter *filter, float *samples, int len, float last_output, int num_chunks) {
+    int chunk = (len + num_chunks - 1) / num_chunks;
+
+    for (int start = 0; start < len; start += chunk) {
+        int n = len - start < chunk ? len - start : chunk;
+        first_order_block(filter, samples + start, n, 0.0f);
+    }
+
+    for (int start = 0; start < len; start += chunk) {
+        int n = len - start < chunk ? len - start : chunk;
+        first_order_fixup(filter, samples + start, n, last_output);
+        last_output = samples[start + n - 1];
+    }
+
+    return last_output;
+}
+
+// Prepare the state of the demodulator for samples at sample_rate, as if the
+// previous samples were all zero. If block_iir is non-zero the filters use
+// the block formulation.
+void demod_state_init(DemodState *state, int sample_rate, int block_iir) {
+    // The de-emphasis coefficient is computed using the sample rate and the
+    // time constant tau that depends on the continent where we are trying to
+    // demodulate the signal.
+    float alpha = 1.0 - exp(-(1.0/(TAU * sample_rate)));
+    // The pole of the DC block filter is DC_BLOCK_POLE at SAMPLE_RATE, and it
+    // is moved at lower rates so that the time constant stays the same.
+    float dc_pole = pow(DC_BLOCK_POLE, (double)SAMPLE_RATE / sample_rate);
+
+    first_order_init(&state->deemph_filter, alpha, 1.0f - alpha);
+    first_order_init(&state->dc_filter, 1.0, dc_pole);
+    state->block_iir = block_iir;
+    state->last_i = 0.0f;
+    state->last_q = 0.0f;
+    state->deemph = 0.0f;
+    state->dc_input = 0.0f;
+    state->dc_output = 0.0f;
+}
+
+// Run a first order filter of the demodulator with the formulation selected
+// by the state.
+static inline float demod_filter(const DemodState *state, const FirstOrderFilter *filter, float *samples, int len, float last_output) {
+    if (state->block_iir) return first_order_block(filter, samples, len, last_output);
+    return first_order_serial(filter, samples, len, last_output);
+}
+
+// De-emphasize filter is a low-pass filter that is used to reduce high
+// frequency components in the signal.
+// This is crucial because in FM transmissions, transmitters apply a boost
+// to the high frequencies to make them less susceptible to noise,
+// however at the receiver this will result in distorted audio.
+// So it is crucial to apply such filter.
+// To reproduce this filter in the digital domain an exponential moving average
+// is used to replicate the same decay effect that is part of the analog circuit.
+void deemphasize_filter(float *freq_samples, int len, DemodState *state) {
+    state->deemph = demod_filter(state, &state->deemph_filter, freq_samples, len, state->deemph);
+}
+
+// DC block filter is an high-pass filter used to reduce the impact of the DC
+// frequencies. In the digital domain it works by centering the frequency around
+// 0 using the two operations: first we compute the difference between the last
+// two samples and then we add a fraction of the previous output. This formula
+// translates the high-pass CR circuit.
+// The differences are taken first, walking backwards so that every sample is
+// read before being overwritten, and the recursive part is then a first order
+// filter with unit gain.
+void dc_block_filter(float *samples_buffer, int len, DemodState *state) {
+    if (len == 0) return;
+
+    float last_input = samples_buffer[len - 1];
+    for (int i = len - 1; i > 0; i--) {
+        samples_buffer[i] -= samples_buffer[i - 1];
+    }
+    samples_buffer[0] -= state->dc_input;
+    state->dc_input = last_input;
+
+    state->dc_output = demod_filter(state, &state->dc_filter, samples_buffer, len, state->dc_output);
+}
+
+// Perform FM signal demodulation. Specifically it performs the following
+// operations:
+// - Separate I and Q samples into two different arrays
+// - Compute the frequency samples
+// - Apply De-emphasize filter on frequency samples
+// - Apply DC block filter on frequency samples
+// The I and Q arrays are working buffers owned by the caller, each one able to
+// hold len/2 samples, so that no memory is allocated while processing.
+void demodulate(float *freq_samples, float *i_samples, float *q_samples, uint8_t *buffer, int len, DemodState *state, Discriminator discriminator, const AtanApprox *approx) {
+    deinterleave_iq(i_samples, q_samples, buffer, len/2);
+    demodulate_samples(freq_samples, i_samples, q_samples, len/2, state, discriminator, approx);
+}
+
+// Demodulate IQ samples that were already converted to float, possibly after
+// reducing their rate. len is the number of IQ samples, their rate is the one
+// the state was prepared for. The samples continue the ones of the previous
+// call, whatever their number: a block can be demodulated at once or a few
+// samples at a time, while they are still in L1 cache.
+void demodulate_samples(float *freq_samples, float *i_samples, float *q_samples, int len, DemodState *state, Discriminator discriminator, const AtanApprox *approx) {
+    if (len == 0) return;
+
+    get_freq_values(freq_samples, i_samples, q_samples, state->last_i, state->last_q, len, discriminator, approx);
+    state->last_i = i_samples[len - 1];
+    state->last_q = q_samples[len - 1];
+
+    deemphasize_filter(freq_samples, len, state);
+    dc_block_filter(freq_samples, len, state);
+}
+
+// Decimate frequency samples to match the sample rate of the WAV audio file.
+// This is a fundamental operation for converting the FM audio into the WAV
+// file.
+// Decimation is implemented using a Boxcar low pass filter. In practice, each
+// decimated sample is obtained by averaging out a number of samples equal to
+// the DECIMATED_FACTOR. This works better than taking one sample every
+// DECIMATION_FACTOR samples, but it is a poor anti-aliasing filter: the
+// polyphase FIR decimator is used by default and this one is kept as a
+// reference.
+int decimate(float *decimated_samples, float *freq_samples, int len) {
+    for (int i = 0, j = DECIMATION_FACTOR; i < (len / DECIMATION_FACTOR); i++, j+=DECIMATION_FACTOR) {
+        decimated_samples[i] = 0.0f;
+        for (int k = j - DECIMATION_FACTOR; k < j; k++) {
+            decimated_samples[i] += freq_samples[k];
+        }
+        decimated_samples[i] /= DECIMATION_FACTOR;
+    }
+
+    return len / DECIMATION_FACTOR;
+}
+
+// Converts samples from float to int16_t for the WAV audio file.
+// Since the WAV file will contain 16bit integers, it is important to convert
+// them.
+// This is done by clipping the sample value and converting it into an int16_t
+// data type. The gain is used to take into account the value difference between
+// the frequency sample and the audio file.
+// Frequency samples go from -1 to 1, while WAV samples go from -32768 to 32767.
+// It is fundamental to clip values to make them fit the 16 bit integer.
+void convert_samples(int16_t *buffer, float *samples, int len) {
+    dsp_kernels->convert_samples(buffer, samples, len);
+}
@@ -0,0 +1,115 @@
+#ifndef DSP_H
+#define DSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sample rate is set to 960 kHz as it is a multiple of the WAV file sample rate
+// and it is sufficiently high to work well with the SDR dongle and to correctly
+// sample the radio signal (it is almost five time the FM signal bandwidth).
+#define SAMPLE_RATE 960000
+#define AUDIO_RATE 48000
+#define DECIMATION_FACTOR (SAMPLE_RATE / AUDIO_RATE)
+
+// Size of the buffer used to store samples. 16384 represents the number of
+// bytes contained in a USB packet the one used to send data from the dongle to
+// the CPU
+#define BUFFER_SIZE (16 * 16384)
+// Limits of the block size chosen at run time. librtlsdr requires transfers
+// to be a multiple of 512 bytes.
+#define BLOCK_SIZE_MULTIPLE 512
+#define MAX_BLOCK_SIZE (64 * 1024 * 1024)
+
+// Time coefficient used in the de-emphasis filter. It represents the speed to
+// which the physical circuit reacts and it is used to convert the de-emphasis
+// filter in software.
+// The value of the constant depend on the continent in which the FM signals are
+// being transmitted: 50 microseconds for Europe/Asia/Africa and 75 microseconds
+// for Americas/Korea.
+#define TAU 0.000050
+
+// Pole of the DC block filter at SAMPLE_RATE.
+#define DC_BLOCK_POLE 0.99
+
+// Alignment of the working buffers, one cache line.
+#define DSP_ALIGNMENT 64
+// Huge page size on x86-64 and arm64, and the smallest buffer worth backing
+// with huge pages when they are enabled.
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+#define HUGEPAGE_MIN_SIZE (256 * 1024)
+
+// FM discriminators that can be used to compute the istantaneous frequency.
+typedef enum {
+    DISCRIMINATOR_POLAR,        // Conjugate multiply, one arctan per sample
+    DISCRIMINATOR_ATAN2,        // Difference of two arctans (reference)
+    DISCRIMINATOR_FAST,         // Conjugate multiply, polynomial arctan
+} Discriminator;
+
+// Number of samples processed together by the fast arctan approximation.
+// Every step of the approximation is applied to a whole block before moving
+// to the next one, so that the compiler can map each loop to SIMD registers.
+#define ATAN_BLOCK 16
+#define ATAN_MAX_COEFFS 7
+// Default accuracy of the fast discriminator, in radians. It selects the
+// polynomial whose error is below the resolution of 16-bit audio.
+#define ATAN_DEFAULT_MAX_ERROR 2e-5f
+
+// Odd polynomial approximation of arctan(x) on [0, 1]:
+//   arctan(x) ~ x * (c0 + c1 x^2 + c2 x^4 + ...)
+typedef struct {
+    int num_coeffs;
+    float max_error;            // Maximum absolute error in radians
+    float coeffs[ATAN_MAX_COEFFS];
+} AtanApprox;
+
+void dsp_set_hugepages(int enable);
+// Number of samples filtered together by the block formulation of the
+// recursive filters, one per SIMD lane.
+#define IIR_BLOCK 8
+
+// First order recursive filter y[n] = gain * x[n] + pole * y[n-1], with the
+// tables used to evaluate it IIR_BLOCK samples at a time.
+typedef struct {
+    float gain;
+    float pole;
+    float decay[IIR_BLOCK];                 // pole^(k+1)
+    float response[IIR_BLOCK][IIR_BLOCK];   // [j][k] = gain * pole^(k-j)
+} FirstOrderFilter;
+
+// State of the demodulator carried from one call of demodulate_samples() to
+// the next, so that consecutive calls filter a single stream.
+typedef struct {
+    FirstOrderFilter deemph_filter;
+    FirstOrderFilter dc_filter;
+    int block_iir;              // Use the block formulation of the filters
+    float last_i;               // Last IQ sample
+    float last_q;
+    float deemph;               // Last output of the de-emphasis filter
+    float dc_input;             // Last input and output of the DC block filter
+    float dc_output;
+} DemodState;
+
+void *alloc_aligned(size_t size);
+uint64_t dsp_allocation_count(void);
+
+const AtanApprox *atan_approx_for_error(float max_error);
+void fast_atan2_block(float *angles, const float *y, const float *x, int len, const AtanApprox *approx);
+
+float convert_value(uint8_t value);
+float get_instant_freq(float i1, float q1, float i2, float q2);
+float get_instant_freq_atan2(float i1, float q1, float i2, float q2);
+void get_freq_values(float *freq_samples, float *i_samples, float *q_samples, float last_i, float last_q, int len, Discriminator discriminator, const AtanApprox *approx);
+void first_order_init(FirstOrderFilter *filter, double gain, double pole);
+float first_order_serial(const FirstOrderFilter *filter, float *samples, int len, float last_output);
+float first_order_block(const FirstOrderFilter *filter, float *samples, int len, float last_output);
+void first_order_fixup(const FirstOrderFilter *filter, float *samples, int len, float carry);
+float first_order_chunks(const FirstOrderFilter *filter, float *samples, int len, float last_output, int num_chunks);
+void demod_state_init(DemodState *state, int sample_rate, int block_iir);
+void deemphasize_filter(float *freq_samples, int len, DemodState *state);
+void dc_block_filter(float *samples_buffer, int len, DemodState *state);
+void demodulate(float *freq_samples, float *i_samples, float *q_samples, uint8_t *buffer, int len, DemodState *state, Discriminator discriminator, const AtanApprox *approx);
+void demodulate_samples(float *freq_samples, float *i_samples, float *q_samples, int len, DemodState *state, Discriminator discriminator, const AtanApprox *approx);
+int decimate(float *decimated_samples, float *freq_samples, int len);
+void convert_samples(int16_t *buffer, float *samples, int len);
+
+#endif
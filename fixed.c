@@ -0,0 +1,315 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "dsp.h"
+#include "pipeline.h"
+#include "fixed.h"
+
+#define CORDIC_PI (32768 << CORDIC_ANGLE_BITS)
+
+// Angles of the CORDIC rotations, atan(2^-i) in Q15 fractions of pi with
+// CORDIC_ANGLE_BITS extra bits.
+static const int32_t CORDIC_ANGLES[CORDIC_ITERATIONS] = {
+    2097152, 1238021, 654136, 332050, 166669, 83416, 41718, 20860,
+    10430, 5215, 2608, 1304, 652, 326, 163, 81
+};
+
+// Saturate a value to the int16 range.
+static inline int16_t saturate16(int64_t value) {
+    if (value > 32767) return 32767;
+    if (value < -32768) return -32768;
+    return value;
+}
+
+// Negate value where mask is -1, leave it unchanged where mask is 0.
+static inline int32_t negate_if(int32_t value, int32_t mask) {
+    return (value ^ mask) - mask;
+}
+
+// CORDIC in vectoring mode on a tile of at most CORDIC_BLOCK vectors. Each
+// vector is first moved to the right half plane, then rotated towards the x
+// axis by +-atan(2^-i), accumulating the rotations. Every step is branch-free
+// and applied to the whole tile before the next one, like the fast float
+// arctan, so that the loops are vectorized.
+static inline void cordic_tile(int16_t *restrict angles, const int32_t *restrict y_in,
+        const int32_t *restrict x_in, int len) {
+    int32_t x[CORDIC_BLOCK];
+    int32_t y[CORDIC_BLOCK];
+    int32_t z[CORDIC_BLOCK];
+
+    for (int k = 0; k < len; k++) {
+        // Rotate by pi when x is negative, keeping the sign of the angle.
+        int32_t flip = x_in[k] >> 31;
+        int32_t half_turn = CORDIC_PI + ((y_in[k] >> 31) & (-2 * CORDIC_PI));
+        x[k] = negate_if(x_in[k], flip) * (1 << CORDIC_INPUT_SHIFT);
+        y[k] = negate_if(y_in[k], flip) * (1 << CORDIC_INPUT_SHIFT);
+        z[k] = flip & half_turn;
+    }
+
+    for (int i = 0; i < CORDIC_ITERATIONS; i++) {
+        const int32_t angle = CORDIC_ANGLES[i];
+        for (int k = 0; k < len; k++) {
+            // Rotate clockwise when y is positive, counterclockwise otherwise.
+            int32_t negative = y[k] >> 31;
+            int32_t x_shifted = x[k] >> i;
+            int32_t y_shifted = y[k] >> i;
+            x[k] += negate_if(y_shifted, negative);
+            y[k] -= negate_if(x_shifted, negative);
+            z[k] += negate_if(angle, negative);
+        }
+    }
+
+    for (int k = 0; k < len; k++) {
+        angles[k] = saturate16((z[k] + (1 << (CORDIC_ANGLE_BITS - 1))) >> CORDIC_ANGLE_BITS);
+    }
+}
+
+// Compute atan2(y, x) for len vectors, in Q15 fractions of pi. The inputs
+// must fit in 17 bits plus sign, which is the case for the conjugate products
+// of the int16 IQ samples.
+void cordic_atan2_block(int16_t *angles, const int32_t *y, const int32_t *x, int len) {
+    int i = 0;
+
+    for (; i + CORDIC_BLOCK <= len; i += CORDIC_BLOCK) {
+        cordic_tile(angles + i, y + i, x + i, CORDIC_BLOCK);
+    }
+    if (i < len) cordic_tile(angles + i, y + i, x + i, len - i);
+}
+
+// Convert a float to Q15, saturating.
+static int16_t to_q15(double value) {
+    long q = lrint(value * 32768.0);
+    if (q > 32767) q = 32767;
+    if (q < -32768) q = -32768;
+    return q;
+}
+
+// Prepare a decimator like fir_decimator_init(), with the taps rounded to
+// Q15. Returns 0 on success and -1 on failure.
+int fixed_fir_decimator_init(FixedFirDecimator *decimator, int factor, int num_taps, double cutoff, double sample_rate, int max_len) {
+    if (factor < 1 || num_taps < 1) return -1;
+
+    decimator->factor = factor;
+    decimator->num_taps = num_taps;
+    decimator->padded_taps = (num_taps + FIR_LANES - 1) / FIR_LANES * FIR_LANES;
+    decimator->max_len = max_len;
+    // Like the boxcar decimation, the first output is produced once factor
+    // samples have been received.
+    decimator->phase = factor - 1;
+
+    float *taps = alloc_aligned(sizeof(float) * num_taps);
+    decimator->taps = alloc_aligned(sizeof(int16_t) * decimator->padded_taps);
+    decimator->work = alloc_aligned(sizeof(int16_t) * (decimator->padded_taps + max_len));
+    if (taps == NULL || decimator->taps == NULL || decimator->work == NULL) {
+        free(taps);
+        fixed_fir_decimator_free(decimator);
+        return -1;
+    }
+
+    design_lowpass(taps, num_taps, cutoff, sample_rate);
+    memset(decimator->taps, 0, sizeof(int16_t) * decimator->padded_taps);
+    for (int k = 0; k < num_taps; k++) {
+        decimator->taps[k] = to_q15(taps[k]);
+    }
+    memset(decimator->work, 0, sizeof(int16_t) * (decimator->padded_taps + max_len));
+
+    free(taps);
+    return 0;
+}
+
+void fixed_fir_decimator_free(FixedFirDecimator *decimator) {
+    free(decimator->taps);
+    free(decimator->work);
+    decimator->taps = NULL;
+    decimator->work = NULL;
+}
+
+// Dot product of int16 arrays whose length is a multiple of FIR_LANES, with
+// FIR_LANES int32 partial sums. The taps sum to one, so the accumulators
+// cannot overflow.
+static inline int32_t dot_product_q15(const int16_t *restrict a, const int16_t *restrict b, int len) {
+    int32_t acc[FIR_LANES] = { 0 };
+
+    for (int k = 0; k < len; k += FIR_LANES) {
+        for (int j = 0; j < FIR_LANES; j++) {
+            acc[j] += (int32_t)a[k + j] * b[k + j];
+        }
+    }
+
+    int32_t sum = 0;
+    for (int j = 0; j < FIR_LANES; j++) {
+        sum += acc[j];
+    }
+    return sum;
+}
+
+// Filter and decimate the len samples stored after the history, see
+// fir_decimator_filter(). Returns the number of samples written to output.
+int fixed_fir_decimator_filter(FixedFirDecimator *decimator, int16_t *output, int len) {
+    int history = decimator->num_taps - 1;
+    int16_t *work = decimator->work;
+    int count = 0;
+
+    int p = decimator->phase;
+    for (; p < len; p += decimator->factor) {
+        int32_t acc = dot_product_q15(decimator->taps, work + p, decimator->padded_taps);
+        output[count++] = saturate16((acc + (1 << 14)) >> 15);
+    }
+    decimator->phase = p - len;
+
+    memmove(work, work + len, sizeof(int16_t) * history);
+    return count;
+}
+
+// Allocate the fixed-point chain for blocks of at most block_size bytes. Only
+// the FIR and boxcar decimators are available.
+// Returns 0 on success and -1 on failure.
+int fixed_pipeline_init(FixedPipeline *pipeline, DecimatorType decimator_type, int fir_taps, int block_size) {
+    memset(pipeline, 0, sizeof(FixedPipeline));
+    if (decimator_type == DECIMATOR_MULTISTAGE) return -1;
+
+    pipeline->decimator_type = decimator_type;
+    pipeline->block_size = block_size;
+
+    int max_output = block_size / (2 * DECIMATION_FACTOR) + 1;
+    pipeline->i_samples = alloc_aligned(sizeof(int16_t) * FUSED_TILE);
+    pipeline->q_samples = alloc_aligned(sizeof(int16_t) * FUSED_TILE);
+    pipeline->freq_samples = alloc_aligned(sizeof(int16_t) * FUSED_TILE);
+    pipeline->audio_samples = alloc_aligned(sizeof(int16_t) * max_output);
+    if (pipeline->i_samples == NULL || pipeline->q_samples == NULL ||
+            pipeline->freq_samples == NULL || pipeline->audio_samples == NULL) {
+        fixed_pipeline_free(pipeline);
+        return -1;
+    }
+
+    if (decimator_type == DECIMATOR_FIR &&
+            fixed_fir_decimator_init(&pipeline->fir, DECIMATION_FACTOR, fir_taps, FIR_CUTOFF, SAMPLE_RATE, FUSED_TILE) < 0) {
+        fixed_pipeline_free(pipeline);
+        return -1;
+    }
+
+    // Same coefficients and initial state as the float path, which starts
+    // from the IQ sample (0, 0).
+    FixedDemodState *demod = &pipeline->demod;
+    demod->last_i = -255;
+    demod->last_q = -255;
+    demod->alpha = to_q15(1.0 - exp(-(1.0/(TAU * SAMPLE_RATE))));
+    demod->dc_pole = to_q15(DC_BLOCK_POLE);
+
+    return 0;
+}
+
+void fixed_pipeline_free(FixedPipeline *pipeline) {
+    free(pipeline->i_samples);
+    free(pipeline->q_samples);
+    free(pipeline->freq_samples);
+    free(pipeline->audio_samples);
+    if (pipeline->decimator_type == DECIMATOR_FIR) fixed_fir_decimator_free(&pipeline->fir);
+    memset(pipeline, 0, sizeof(FixedPipeline));
+}
+
+// Discriminate a tile of int16 IQ samples into Q15 frequency samples.
+static void fixed_freq_values(int16_t *freq_samples, const int16_t *i_samples, const int16_t *q_samples, int len, FixedDemodState *state) {
+    int32_t re[CORDIC_BLOCK];
+    int32_t im[CORDIC_BLOCK];
+    int32_t last_i = state->last_i;
+    int32_t last_q = state->last_q;
+
+    for (int start = 0; start < len; start += CORDIC_BLOCK) {
+        int n = len - start < CORDIC_BLOCK ? len - start : CORDIC_BLOCK;
+        const int16_t *i2 = i_samples + start;
+        const int16_t *q2 = q_samples + start;
+
+        re[0] = last_i * i2[0] + last_q * q2[0];
+        im[0] = last_i * q2[0] - last_q * i2[0];
+        for (int k = 1; k < n; k++) {
+            re[k] = i2[k - 1] * i2[k] + q2[k - 1] * q2[k];
+            im[k] = i2[k - 1] * q2[k] - q2[k - 1] * i2[k];
+        }
+        cordic_atan2_block(freq_samples + start, im, re, n);
+
+        last_i = i2[n - 1];
+        last_q = q2[n - 1];
+    }
+
+    state->last_i = last_i;
+    state->last_q = last_q;
+}
+
+// De-emphasis and DC block filters, see deemphasize_filter() and
+// dc_block_filter(). The products are taken in 64 bits, the states keep
+// FIXED_STATE_BITS fractional bits so that the small de-emphasis coefficient
+// does not round the signal away. The loop stays serial: the block
+// formulation of the float path needs int32 products on int32 lanes, which
+// baseline SSE2 does not have, and measured slower than this loop.
+static void fixed_filters(int16_t *samples, int len, FixedDemodState *state) {
+    int64_t deemph = state->deemph;
+    int64_t dc_input = state->dc_input;
+    int64_t dc_output = state->dc_output;
+
+    for (int i = 0; i < len; i++) {
+        int64_t x = (int64_t)samples[i] * (1 << FIXED_STATE_BITS);
+
+        deemph += (state->alpha * (x - deemph)) >> 15;
+        dc_output = deemph - dc_input + ((state->dc_pole * dc_output) >> 15);
+        dc_input = deemph;
+
+        samples[i] = saturate16((dc_output + (1 << (FIXED_STATE_BITS - 1))) >> FIXED_STATE_BITS);
+    }
+
+    state->deemph = deemph;
+    state->dc_input = dc_input;
+    state->dc_output = dc_output;
+}
+
+// Boxcar decimation of Q15 samples, see decimate().
+static int fixed_decimate(int16_t *output, const int16_t *samples, int len) {
+    for (int i = 0; i < len / DECIMATION_FACTOR; i++) {
+        int32_t sum = 0;
+        for (int k = 0; k < DECIMATION_FACTOR; k++) {
+            sum += samples[i * DECIMATION_FACTOR + k];
+        }
+        output[i] = sum / DECIMATION_FACTOR;
+    }
+
+    return len / DECIMATION_FACTOR;
+}
+
+// Demodulate a block of len IQ bytes into WAV samples, one tile of
+// FUSED_TILE samples at a time like the fused float kernel.
+// Returns the number of samples written to output.
+int fixed_pipeline_process(FixedPipeline *pipeline, int16_t *output, const uint8_t *block, int len) {
+    int num_samples = len / 2;
+    int count = 0;
+
+    for (int start = 0; start < num_samples; start += FUSED_TILE) {
+        int n = num_samples - start < FUSED_TILE ? num_samples - start : FUSED_TILE;
+        const uint8_t *iq = block + 2 * start;
+        int16_t *freq_samples = pipeline->freq_samples;
+        if (pipeline->decimator_type == DECIMATOR_FIR) {
+            freq_samples = pipeline->fir.work + pipeline->fir.num_taps - 1;
+        }
+
+        for (int k = 0; k < n; k++) {
+            pipeline->i_samples[k] = 2 * iq[2 * k] - 255;
+            pipeline->q_samples[k] = 2 * iq[2 * k + 1] - 255;
+        }
+        fixed_freq_values(freq_samples, pipeline->i_samples, pipeline->q_samples, n, &pipeline->demod);
+        fixed_filters(freq_samples, n, &pipeline->demod);
+
+        if (pipeline->decimator_type == DECIMATOR_FIR) {
+            count += fixed_fir_decimator_filter(&pipeline->fir, pipeline->audio_samples + count, n);
+        } else {
+            count += fixed_decimate(pipeline->audio_samples + count, freq_samples, n);
+        }
+    }
+
+    // Scale the decimated frequency to the WAV samples.
+    for (int i = 0; i < count; i++) {
+        int32_t sample = pipeline->audio_samples[i] * FIXED_OUTPUT_GAIN;
+        output[i] = saturate16((sample + (1 << (FIXED_OUTPUT_SHIFT - 1))) >> FIXED_OUTPUT_SHIFT);
+    }
+
+    return count;
+}
@@ -0,0 +1,82 @@
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <stdint.h>
+
+#include "decimator.h"
+
+// Fixed-point processing chain, for hosts where float throughput is limited.
+//
+// IQ bytes become int16 values (2 * x - 255, i.e. convert_value() scaled by
+// 2), the discriminator is a CORDIC working on the int32 conjugate products
+// and the frequency samples are Q15 fractions of pi: 32768 stands for pi
+// radians. The recursive filters use Q15 coefficients and keep their state
+// with FIXED_STATE_BITS extra fractional bits, the FIR decimator multiplies
+// int16 samples by Q15 taps into int32 accumulators.
+
+// Number of CORDIC iterations. The residual angle after the last one is below
+// atan(2^-15), a third of the Q15 resolution.
+#define CORDIC_ITERATIONS 16
+// Extra fractional bits of the CORDIC angle accumulator, so that the rounding
+// of the table entries does not add up over the iterations.
+#define CORDIC_ANGLE_BITS 8
+// Left shift of the conjugate products before the CORDIC. They take at most
+// 17 bits, the shift brings small vectors to a useful precision while
+// leaving room for the CORDIC gain (1.65) in an int32.
+#define CORDIC_INPUT_SHIFT 12
+// Number of samples rotated together by the CORDIC, one iteration at a time,
+// so that the compiler can map the loops to SIMD registers.
+#define CORDIC_BLOCK 16
+
+// Extra fractional bits of the state of the recursive filters.
+#define FIXED_STATE_BITS 12
+
+// Gain from a Q15 frequency to a WAV sample, pi * 32767 / 32768 in Q13, the
+// same scale as the float path.
+#define FIXED_OUTPUT_GAIN 25735
+#define FIXED_OUTPUT_SHIFT 13
+
+// Decimating FIR filter on int16 samples, see FirDecimator.
+typedef struct {
+    int factor;
+    int num_taps;
+    int padded_taps;            // num_taps rounded up to FIR_LANES
+    int max_len;
+    int16_t *taps;              // Q15 coefficients, zero padded
+    int16_t *work;              // History followed by the new input samples
+    int phase;
+} FixedFirDecimator;
+
+// State carried from one block to the next.
+typedef struct {
+    int16_t last_i;
+    int16_t last_q;
+    int32_t alpha;              // De-emphasis coefficient, Q15
+    int32_t dc_pole;            // DC block pole, Q15
+    int32_t deemph;             // Filter states, FIXED_STATE_BITS fraction
+    int32_t dc_input;
+    int32_t dc_output;
+} FixedDemodState;
+
+typedef struct {
+    DecimatorType decimator_type; // DECIMATOR_FIR or DECIMATOR_BOXCAR
+    int block_size;
+    int16_t *i_samples;         // One tile each
+    int16_t *q_samples;
+    int16_t *freq_samples;
+    int16_t *audio_samples;     // Decimated Q15 frequency of a whole block
+    FixedDemodState demod;
+    FixedFirDecimator fir;
+} FixedPipeline;
+
+void cordic_atan2_block(int16_t *angles, const int32_t *y, const int32_t *x, int len);
+
+int fixed_fir_decimator_init(FixedFirDecimator *decimator, int factor, int num_taps, double cutoff, double sample_rate, int max_len);
+void fixed_fir_decimator_free(FixedFirDecimator *decimator);
+int fixed_fir_decimator_filter(FixedFirDecimator *decimator, int16_t *output, int len);
+
+int fixed_pipeline_init(FixedPipeline *pipeline, DecimatorType decimator_type, int fir_taps, int block_size);
+void fixed_pipeline_free(FixedPipeline *pipeline);
+int fixed_pipeline_process(FixedPipeline *pipeline, int16_t *output, const uint8_t *block, int len);
+
+#endif
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "dsp.h"
+#include "synth.h"
+
+// Command line front end of the synthetic FM generator: writes uint8 IQ
+// samples at SAMPLE_RATE (or another rate, e.g. that of a wideband capture) to
+// a file or to the standard output, so that they can be fed to fmrec -f like
+// a capture made with rtl_sdr.
+
+// Number of IQ pairs generated and written at a time.
+#define SYNTH_CHUNK 65536
+#define SYNTH_MAX_STATIONS 16
+
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] output_file\n", program);
+    fprintf(stderr, "  output_file \"-\" writes to standard output\n");
+    fprintf(stderr, "  -a NAME  audio: tone (default), multitone or sweep\n");
+    fprintf(stderr, "  -t F1,F2,...\n");
+    fprintf(stderr, "           tone frequencies in Hz (default 1000), up to %d\n", SYNTH_MAX_TONES);
+    fprintf(stderr, "  -w START,END,SECONDS\n");
+    fprintf(stderr, "           logarithmic sweep (default 20,20000,1)\n");
+    fprintf(stderr, "  -d HZ    deviation of a full scale audio sample (default 75000)\n");
+    fprintf(stderr, "  -p US    pre-emphasis time constant in microseconds (default none)\n");
+    fprintf(stderr, "  -n DB    carrier to noise ratio (default no noise)\n");
+    fprintf(stderr, "  -o HZ    carrier offset from the center frequency (default 0)\n");
+    fprintf(stderr, "  -c HZ,HZ,...\n");
+    fprintf(stderr, "           several stations at these carrier offsets instead of -o, up to %d;\n", SYNTH_MAX_STATIONS);
+    fprintf(stderr, "           station n (from 0) has its tones multiplied by n + 1 and the\n");
+    fprintf(stderr, "           amplitude is split among the stations\n");
+    fprintf(stderr, "  -A AMP   carrier amplitude, 1 is full scale (default 1)\n");
+    fprintf(stderr, "  -r RATE  sample rate in S/s (default %d)\n", SAMPLE_RATE);
+    fprintf(stderr, "  -s SECS  duration (default 10)\n");
+    fprintf(stderr, "  -S SEED  seed of the noise generator (default 1)\n");
+}
+
+// Parse a comma separated list of at most max_count frequencies, positive
+// unless allow_negative is set. Returns their number, or -1 if the list is
+// invalid.
+int parse_frequencies(const char *arg, double *frequencies, int max_count, int allow_negative) {
+    int count = 0;
+    const char *p = arg;
+
+    while (count < max_count) {
+        char *end;
+        frequencies[count] = strtod(p, &end);
+        if (end == p || (!allow_negative && frequencies[count] <= 0.0)) return -1;
+        count++;
+        if (*end == '\0') return count;
+        if (*end != ',') return -1;
+        p = end + 1;
+    }
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    SynthConfig config = synth_default_config(SAMPLE_RATE);
+    double seconds = 10.0;
+    double offsets[SYNTH_MAX_STATIONS];
+    int num_stations = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "A:a:c:d:n:o:p:r:S:s:t:w:")) != -1) {
+        switch (opt) {
+            case 'a':
+                if (synth_parse_audio(optarg, &config.audio) < 0) {
+                    fprintf(stderr, "Unknown audio %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 't':
+                config.num_tones = parse_frequencies(optarg, config.tones, SYNTH_MAX_TONES, 0);
+                if (config.num_tones < 0) {
+                    fprintf(stderr, "Invalid tone frequencies %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'w':
+                if (sscanf(optarg, "%lf,%lf,%lf", &config.sweep_start, &config.sweep_end,
+                            &config.sweep_seconds) != 3 || config.sweep_start <= 0.0 ||
+                        config.sweep_end <= 0.0 || config.sweep_seconds <= 0.0) {
+                    fprintf(stderr, "Invalid sweep %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'd':
+                config.deviation = atof(optarg);
+                break;
+            case 'p':
+                config.preemphasis_tau = atof(optarg) * 1e-6;
+                break;
+            case 'n':
+                config.cnr_db = atof(optarg);
+                break;
+            case 'o':
+                config.carrier_offset = atof(optarg);
+                break;
+            case 'c':
+                num_stations = parse_frequencies(optarg, offsets, SYNTH_MAX_STATIONS, 1);
+                if (num_stations < 0) {
+                    fprintf(stderr, "Invalid carrier offsets %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'r':
+                config.sample_rate = atoi(optarg);
+                break;
+            case 'A':
+                config.amplitude = atof(optarg);
+                break;
+            case 's':
+                seconds = atof(optarg);
+                break;
+            case 'S':
+                config.seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    if (optind + 1 != argc || seconds <= 0.0 || config.sample_rate <= 0) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    const char *path = argv[optind];
+    FILE *file = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    uint8_t *iq = malloc(2 * SYNTH_CHUNK);
+    if (file == NULL || iq == NULL) {
+        fprintf(stderr, "Failed to open %s.\n", path);
+        exit(1);
+    }
+
+    // A single station is the one of the configuration.
+    SynthState states[SYNTH_MAX_STATIONS];
+    if (num_stations == 0) {
+        synth_init(&states[0], &config);
+        num_stations = 1;
+    } else {
+        for (int s = 0; s < num_stations; s++) {
+            SynthConfig station = config;
+            station.carrier_offset = offsets[s];
+            station.amplitude = config.amplitude / num_stations;
+            for (int t = 0; t < config.num_tones; t++) station.tones[t] = config.tones[t] * (s + 1);
+            synth_init(&states[s], &station);
+        }
+    }
+
+    long remaining = lrint(seconds * config.sample_rate);
+    while (remaining > 0) {
+        int n = remaining < SYNTH_CHUNK ? remaining : SYNTH_CHUNK;
+        synth_generate_stations(states, num_stations, iq, n);
+        if (fwrite(iq, 2, n, file) != (size_t)n) {
+            fprintf(stderr, "Failed to write %s.\n", path);
+            exit(1);
+        }
+        remaining -= n;
+    }
+
+    free(iq);
+    if (file != stdout && fclose(file) != 0) {
+        fprintf(stderr, "Failed to write %s.\n", path);
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+
+#include "cpu.h"
+#include "dsp.h"
+#include "decimator.h"
+#include "kernels.h"
+#include "nco.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS
+#endif
+
+// Reference copy, with the vectorizer disabled.
+#pragma GCC push_options
+#pragma GCC optimize("no-tree-vectorize", "no-tree-slp-vectorize")
+#define KERNEL(name) name##_scalar
+#define KERNEL_LEVEL_NAME "scalar"
+#include "kernels_template.h"
+#undef KERNEL
+#undef KERNEL_LEVEL_NAME
+#pragma GCC pop_options
+
+// Baseline SIMD of the architecture: SSE2 on x86, NEON on 64-bit ARM.
+#pragma GCC push_options
+#ifdef HAVE_X86_KERNELS
+#pragma GCC target("sse2")
+#endif
+#define KERNEL(name) name##_vector
+#define KERNEL_LEVEL_NAME "vector"
+#include "kernels_template.h"
+#undef KERNEL
+#undef KERNEL_LEVEL_NAME
+#pragma GCC pop_options
+
+#ifdef HAVE_X86_KERNELS
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define KERNEL(name) name##_avx2
+#define KERNEL_LEVEL_NAME "avx2"
+#include "kernels_template.h"
+#undef KERNEL
+#undef KERNEL_LEVEL_NAME
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vl,avx2,fma")
+#define KERNEL(name) name##_avx512
+#define KERNEL_LEVEL_NAME "avx512"
+#include "kernels_template.h"
+#undef KERNEL
+#undef KERNEL_LEVEL_NAME
+#pragma GCC pop_options
+#endif
+
+const DspKernels *dsp_kernels = &kernels_vector;
+
+// Return the kernels compiled for the given level, or NULL if the level is
+// not supported by this CPU.
+const DspKernels *kernels_for_level(CpuLevel level) {
+    if (!cpu_level_supported(level)) return NULL;
+
+    switch (level) {
+        case CPU_LEVEL_SCALAR: return &kernels_scalar;
+#ifdef HAVE_X86_KERNELS
+        case CPU_LEVEL_AVX2: return &kernels_avx2;
+        case CPU_LEVEL_AVX512: return &kernels_avx512;
+#endif
+        default: return &kernels_vector;
+    }
+}
+
+// Select the kernels used from now on. Returns 0 on success and -1 if the
+// level is not supported by this CPU.
+int kernels_init(CpuLevel level) {
+    const DspKernels *kernels = kernels_for_level(level);
+    if (kernels == NULL) return -1;
+
+    dsp_kernels = kernels;
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+#include "dsp.h"
+
+// Hot loops of the float processing chain, compiled once per instruction set
+// level from kernels_template.h. The plain C loops are written so that the
+// compiler vectorizes them, and each copy is vectorized for the registers of
+// its level (and fused multiply-adds where available), while the program
+// itself is still built for the baseline of the architecture.
+typedef struct {
+    const char *name;
+    void (*fast_atan2_block)(float *angles, const float *y, const float *x, int len, const AtanApprox *approx);
+    void (*freq_values_fast)(float *freq_samples, const float *i_samples, const float *q_samples,
+            float last_i, float last_q, int len, const AtanApprox *approx);
+    float (*first_order_block)(const FirstOrderFilter *filter, float *samples, int len, float last_output);
+    // Outputs of a decimating FIR for the windows starting at work[first],
+    // work[first + factor], ... below work[len]. Returns their number.
+    int (*fir_filter)(float *output, const float *taps, int padded_taps, const float *work,
+            int first, int factor, int len);
+    // Outputs of a half-band stage from its polyphase branches.
+    void (*halfband_filter)(float *output, const float *center_branch, const float *odd_branch,
+            const float *pair_taps, int pairs, int count);
+    // Sums of the branches of the channelizer filter bank for one output.
+    void (*polyphase_branches)(float *branch_i, float *branch_q, const float *taps,
+            const float *window_i, const float *window_q, int branches, int taps_per_branch);
+    // Rotation of a group of NCO_LANES samples by the oscillator.
+    void (*nco_rotate)(float *i_samples, float *q_samples, const float *lane_re, const float *lane_im,
+            double base_re, double base_im);
+    void (*convert_samples)(int16_t *buffer, const float *samples, int len);
+} DspKernels;
+
+// Kernels of the selected level, the baseline ones until kernels_init() is
+// called.
+extern const DspKernels *dsp_kernels;
+
+int kernels_init(CpuLevel level);
+const DspKernels *kernels_for_level(CpuLevel level);
+
+#endif
@@ -0,0 +1,260 @@
+// Template of the DSP kernels, included by kernels.c once per instruction set
+// level with KERNEL(name) defined to add the suffix of the level and the
+// matching target options in effect. It has no include guard on purpose.
+// Helpers are static inline, so each copy gets its own, compiled for the same
+// target as the kernels calling it.
+
+// Compute the fast arctan of up to ATAN_BLOCK samples.
+// The angle is reduced to the first octant by dividing the smaller component
+// by the larger one, so that the ratio is in [0, 1] where the polynomial is
+// accurate, and the result is then moved back to the original octant.
+// Every operation is branch free, so each loop runs on SIMD registers.
+static inline void KERNEL(fast_atan2_tile)(float *restrict angles, const float *restrict y,
+        const float *restrict x, int len, const AtanApprox *approx) {
+    float ratio[ATAN_BLOCK];
+    float ratio2[ATAN_BLOCK];
+    float poly[ATAN_BLOCK];
+    const int last = approx->num_coeffs - 1;
+
+    for (int k = 0; k < len; k++) {
+        float ax = fabsf(x[k]);
+        float ay = fabsf(y[k]);
+        float num = ax < ay ? ax : ay;
+        float den = ax < ay ? ay : ax;
+
+        // FLT_MIN avoids the 0/0 division when both components are zero.
+        ratio[k] = num / (den + FLT_MIN);
+        ratio2[k] = ratio[k] * ratio[k];
+        poly[k] = approx->coeffs[last];
+    }
+
+    // Horner's scheme, one coefficient at a time over the whole block.
+    for (int c = last - 1; c >= 0; c--) {
+        const float coeff = approx->coeffs[c];
+        for (int k = 0; k < len; k++) {
+            poly[k] = poly[k] * ratio2[k] + coeff;
+        }
+    }
+
+    // The octant corrections are written as arithmetic on 0/1 masks rather
+    // than as conditionals, so that the loop has no control flow.
+    for (int k = 0; k < len; k++) {
+        float angle = ratio[k] * poly[k];
+        float swapped = (float)(fabsf(y[k]) > fabsf(x[k]));
+        float negative = (float)(x[k] < 0.0f);
+
+        angle += swapped * ((float)M_PI_2 - 2.0f * angle);
+        angle += negative * ((float)M_PI - 2.0f * angle);
+        angles[k] = copysignf(angle, y[k]);
+    }
+}
+
+// Approximate atan2(y, x) over len samples, with the accuracy of approx.
+static void KERNEL(fast_atan2_block)(float *angles, const float *y, const float *x, int len, const AtanApprox *approx) {
+    int i = 0;
+    for (; i + ATAN_BLOCK <= len; i += ATAN_BLOCK) {
+        KERNEL(fast_atan2_tile)(angles + i, y + i, x + i, ATAN_BLOCK, approx);
+    }
+    if (i < len) KERNEL(fast_atan2_tile)(angles + i, y + i, x + i, len - i, approx);
+}
+
+// Conjugate products of up to ATAN_BLOCK consecutive samples, i1 and q1
+// starting one sample before the products.
+static inline void KERNEL(conjugate_products)(float *restrict re, float *restrict im,
+        const float *restrict i1, const float *restrict q1, int len) {
+    for (int k = 0; k < len; k++) {
+        re[k] = i1[k] * i1[k + 1] + q1[k] * q1[k + 1];
+        im[k] = i1[k] * q1[k + 1] - q1[k] * i1[k + 1];
+    }
+}
+
+// Polar discriminator using the fast arctan approximation.
+// The conjugate products are computed one block at a time into small arrays
+// that stay in L1 cache, and the arctan is then evaluated on the whole block.
+// Whole blocks are kept apart from the last one, like in fast_atan2_block(),
+// since GCC only vectorizes these loops at -O2 when their trip count is known.
+static void KERNEL(freq_values_fast)(float *freq_samples, const float *i_samples, const float *q_samples,
+        float last_i, float last_q, int len, const AtanApprox *approx) {
+    float re[ATAN_BLOCK];
+    float im[ATAN_BLOCK];
+    int start = 1;
+
+    re[0] = last_i * i_samples[0] + last_q * q_samples[0];
+    im[0] = last_i * q_samples[0] - last_q * i_samples[0];
+    KERNEL(fast_atan2_tile)(freq_samples, im, re, 1, approx);
+
+    for (; start + ATAN_BLOCK <= len; start += ATAN_BLOCK) {
+        KERNEL(conjugate_products)(re, im, i_samples + start - 1, q_samples + start - 1, ATAN_BLOCK);
+        KERNEL(fast_atan2_tile)(freq_samples + start, im, re, ATAN_BLOCK, approx);
+    }
+    if (start < len) {
+        KERNEL(conjugate_products)(re, im, i_samples + start - 1, q_samples + start - 1, len - start);
+        KERNEL(fast_atan2_tile)(freq_samples + start, im, re, len - start, approx);
+    }
+}
+
+// Block formulation of a first order filter, see first_order_block().
+static float KERNEL(first_order_block)(const FirstOrderFilter *restrict filter, float *restrict samples, int len, float last_output) {
+    int i = 0;
+
+    for (; i + IIR_BLOCK <= len; i += IIR_BLOCK) {
+        float *restrict x = samples + i;
+        float acc[IIR_BLOCK];
+
+        // The contribution of the previous block is added last, so that the
+        // loop carried dependency through last_output is a single multiply-add
+        // per block, and the products of the samples overlap with it. The j
+        // loop is unrolled so that acc stays in registers: with 8 lanes it
+        // otherwise goes through the stack on every j.
+        for (int k = 0; k < IIR_BLOCK; k++) {
+            acc[k] = filter->response[0][k] * x[0];
+        }
+#pragma GCC unroll 8
+        for (int j = 1; j < IIR_BLOCK; j++) {
+            for (int k = 0; k < IIR_BLOCK; k++) {
+                acc[k] += filter->response[j][k] * x[j];
+            }
+        }
+        for (int k = 0; k < IIR_BLOCK; k++) {
+            x[k] = acc[k] + filter->decay[k] * last_output;
+        }
+        last_output = x[IIR_BLOCK - 1];
+    }
+
+    // The last samples one at a time.
+    for (; i < len; i++) {
+        last_output = filter->gain * samples[i] + filter->pole * last_output;
+        samples[i] = last_output;
+    }
+
+    return last_output;
+}
+
+// Dot product of two arrays whose length is a multiple of FIR_LANES.
+// FIR_LANES independent partial sums are kept, which maps the inner loop on
+// a SIMD register without requiring the compiler to reorder float additions.
+static inline float KERNEL(dot_product)(const float *restrict a, const float *restrict b, int len) {
+    float acc[FIR_LANES] = { 0.0f };
+
+    for (int k = 0; k < len; k += FIR_LANES) {
+        for (int j = 0; j < FIR_LANES; j++) {
+            acc[j] += a[k + j] * b[k + j];
+        }
+    }
+
+    float sum = 0.0f;
+    for (int j = 0; j < FIR_LANES; j++) {
+        sum += acc[j];
+    }
+    return sum;
+}
+
+static int KERNEL(fir_filter)(float *output, const float *taps, int padded_taps, const float *work,
+        int first, int factor, int len) {
+    int count = 0;
+
+    for (int p = first; p < len; p += factor) {
+        output[count++] = KERNEL(dot_product)(taps, work + p, padded_taps);
+    }
+    return count;
+}
+
+// Compute len outputs of a half-band stage from its two polyphase branches.
+// It is always called with HALFBAND_TILE outputs except for the last tile,
+// so the loops have a constant trip count that the compiler vectorizes.
+static inline void KERNEL(halfband_tile)(float *restrict out, const float *restrict center_branch,
+        const float *restrict odd_branch, const float *restrict pair_taps, int pairs, int len) {
+    for (int m = 0; m < len; m++) {
+        out[m] = 0.5f * center_branch[m];
+    }
+    for (int k = 0; k < pairs; k++) {
+        const float tap = pair_taps[k];
+        const float *restrict before = odd_branch + pairs - 1 - k;
+        const float *restrict after = odd_branch + pairs + k;
+
+        for (int m = 0; m < len; m++) {
+            out[m] += tap * (before[m] + after[m]);
+        }
+    }
+}
+
+static void KERNEL(halfband_filter)(float *output, const float *center_branch, const float *odd_branch,
+        const float *pair_taps, int pairs, int count) {
+    int start = 0;
+
+    for (; start + HALFBAND_TILE <= count; start += HALFBAND_TILE) {
+        KERNEL(halfband_tile)(output + start, center_branch + start, odd_branch + start, pair_taps, pairs, HALFBAND_TILE);
+    }
+    if (start < count) {
+        KERNEL(halfband_tile)(output + start, center_branch + start, odd_branch + start, pair_taps, pairs, count - start);
+    }
+}
+
+// Sums of the branches of a polyphase filter bank for one output: branch c
+// gets taps[p * branches + c] * window[p * branches + c] over p. Each row of
+// the window is contiguous, and branches is a multiple of FIR_LANES, so the
+// inner loops have a constant trip count that maps on SIMD registers.
+static void KERNEL(polyphase_branches)(float *restrict branch_i, float *restrict branch_q,
+        const float *restrict taps, const float *restrict window_i, const float *restrict window_q,
+        int branches, int taps_per_branch) {
+    for (int c = 0; c < branches; c += FIR_LANES) {
+        float acc_i[FIR_LANES] = { 0.0f };
+        float acc_q[FIR_LANES] = { 0.0f };
+
+        for (int p = 0; p < taps_per_branch; p++) {
+            const int k = p * branches + c;
+            for (int j = 0; j < FIR_LANES; j++) {
+                acc_i[j] += taps[k + j] * window_i[k + j];
+                acc_q[j] += taps[k + j] * window_q[k + j];
+            }
+        }
+        for (int j = 0; j < FIR_LANES; j++) {
+            branch_i[c + j] = acc_i[j];
+            branch_q[c + j] = acc_q[j];
+        }
+    }
+}
+
+// Rotate a group of NCO_LANES samples, see nco_mix(): lane k is multiplied
+// by the base rotation of the group times the rotation of the lane.
+static void KERNEL(nco_rotate)(float *restrict i_samples, float *restrict q_samples,
+        const float *restrict lane_re, const float *restrict lane_im, double base_re, double base_im) {
+    const float re = base_re;
+    const float im = base_im;
+
+    for (int k = 0; k < NCO_LANES; k++) {
+        float rot_re = re * lane_re[k] - im * lane_im[k];
+        float rot_im = re * lane_im[k] + im * lane_re[k];
+        float i = i_samples[k];
+        float q = q_samples[k];
+
+        i_samples[k] = i * rot_re - q * rot_im;
+        q_samples[k] = i * rot_im + q * rot_re;
+    }
+}
+
+// Scale and clip the samples to int16, see convert_samples().
+static void KERNEL(convert_samples)(int16_t *buffer, const float *samples, int len) {
+    const float GAIN = 32767.0f;
+
+    for (int i = 0; i < len; i++) {
+        float res = samples[i] * GAIN;
+
+        if (res > 32767.0f) res = 32767.0f;
+        else if (res < -32768.0f) res = -32768.0f;
+
+        buffer[i] = (int16_t)res;
+    }
+}
+
+static const DspKernels KERNEL(kernels) = {
+    KERNEL_LEVEL_NAME,
+    KERNEL(fast_atan2_block),
+    KERNEL(freq_values_fast),
+    KERNEL(first_order_block),
+    KERNEL(fir_filter),
+    KERNEL(halfband_filter),
+    KERNEL(polyphase_branches),
+    KERNEL(nco_rotate),
+    KERNEL(convert_samples),
+};
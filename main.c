@@ -3,293 +3,690 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "channelizer.h"
+#include "cpu.h"
+#include "dsp.h"
+#include "convert.h"
+#include "kernels.h"
+#include "decimator.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "receiver.h"
+#include "metrics.h"
+#include "writer.h"
+#include "source.h"
 
-#include "rtl-sdr.h"
-
-// Sample rate is set to 960 kHz as it is a multiple of the WAV file sample rate
-// and it is sufficiently high to work well with the SDR dongle and to correctly
-// sample the radio signal (it is almost five time the FM signal bandwidth).
-#define SAMPLE_RATE 960000
-#define AUDIO_RATE 48000
-#define DECIMATION_FACTOR (SAMPLE_RATE / AUDIO_RATE)
-
-// Size of the buffer used to store samples. 16384 represents the number of
-// bytes contained in a USB packet the one used to send data from the dongle to
-// the CPU
-#define BUFFER_SIZE (16 * 16384)
 #define AUDIO_DURATION 5
 #define SDR_INDEX 0
-
-// Time coefficient used in the de-emphasis filter. It represents the speed to
-// which the physical circuit reacts and it is used to convert the de-emphasis
-// filter in software.
-// The value of the constant depend on the continent in which the FM signals are
-// being transmitted: 50 microseconds for Europe/Asia/Africa and 75 microseconds
-// for Americas/Korea.
-#define TAU 0.000050
-
-// Standard WAV file header structure (44 bytes).
-// This struct represents the standard RIFF/WAVE header for PCM audio.
-typedef struct {
-    // RIFF Chunk Descriptor 
-    char     chunkId[4];        // "RIFF" (Big Endian)
-    uint32_t chunkSize;         // File size - 8 bytes
-    char     format[4];         // "WAVE" (Big Endian)
-    // Format Sub-chunk
-    char     fmtChunkId[4];     // "fmt " (includes trailing space)
-    uint32_t fmtChunkSize;      // Size of the fmt chunk (usually 16 for PCM)
-    uint16_t audioFormat;       // Audio format (1 = PCM, 3 = IEEE Float)
-    uint16_t numChannels;       // Number of channels (1 = Mono, 2 = Stereo)
-    uint32_t sampleRate;        // Sampling frequency in Hz (e.g., 44100)
-    uint32_t byteRate;          // Bytes per second (SampleRate * BlockAlign)
-    uint16_t blockAlign;        // Bytes per sample frame (NumChannels * BitsPerSample / 8)
-    uint16_t bitsPerSample;     // Bits per sample (e.g., 16, 24, 32)
-    // Data  Sub-chunk
-    char     dataChunkId[4];    // "data" (Big Endian)
-    uint32_t dataSize;          // Size of the raw audio data in bytes
-} WavHeader;
-
-// Convert value from unsigned int to float.
-// This function is used for converting IQ samples to float values.
-float convert_value(uint8_t value) {
-    return (float)value - 127.5f;
-}
-
-// Compute the istantaneous frequency from a pair of IQ samples.
-// This is the core of FM demodulation, as it converts the raw IQ samples into
-// a frequency value that contains the actual audio data.
-//
-// The math behind is simple: we need to compute the derivative of the phase,
-// which is the angle of the signal in the complex plane. To compute the phase
-// we need to compute the arctan of Q/I, following simple trigonometry formalas.
-// Then we compute the derivative by subtracting the two consecutive phases.
-// It is important to handle the case where the shift in phase is small but
-// the computed arctan value is the clipped to the opposite value (e.g. +pi and
-// -pi), as it will cause a sudden jump in the final audio. 
-// To solve this issue we can subtract or add 2pi depending on
-// the frequency value.
-float get_instant_freq(float i1, float q1, float i2, float q2) {
-    float phase1 = atan2(q1, i1);
-    float phase2 = atan2(q2, i2);
-
-    float instant_freq = phase2 - phase1;
-    
-    if (instant_freq > M_PI) instant_freq -= 2 * M_PI;
-    else if (instant_freq < -M_PI) instant_freq += 2 * M_PI;
-
-    return instant_freq;
+// Largest offset of the station from the frequency of the dongle with -o, so
+// that its whole channel stays within the capture.
+#define MAX_STATION_OFFSET ((int)(SAMPLE_RATE / 2 - FM_CHANNEL_BANDWIDTH / 2))
+
+// Return the current time of a monotonic clock in seconds.
+double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-// Compute istantaneous frequency over all the IQ samples.
-void get_freq_values(float *freq_samples, float *i_samples, float *q_samples, float last_i, float last_q, int len) {
-    freq_samples[0] = get_instant_freq(
-        last_i, last_q, i_samples[0], q_samples[0] 
-    );
-    for (int i = 1; i < len - 1; i++) {
-        freq_samples[i] = get_instant_freq(
-                i_samples[i], q_samples[i], i_samples[i+1], q_samples[i+1]
-        );
+// Parse a comma separated list of frequencies in MHz. Returns their number,
+// or -1 if the list is invalid or longer than max_count.
+int parse_frequencies(const char *arg, double *frequencies, int max_count) {
+    int count = 0;
+    const char *p = arg;
+
+    while (count < max_count) {
+        char *end;
+        frequencies[count] = strtod(p, &end);
+        if (end == p || frequencies[count] <= 0.0) return -1;
+        count++;
+        if (*end == '\0') return count;
+        if (*end != ',') return -1;
+        p = end + 1;
     }
+    return -1;
 }
 
-// De-emphasize filter is a low-pass filter that is used to reduce high
-// frequency components in the signal.
-// This is crucial because in FM transmissions, transmitters apply a boost
-// to the high frequencies to make them less susceptible to noise,
-// however at the receiver this will result in distorted audio.
-// So it is crucial to apply such filter.
-// To reproduce this filter in the digital domain an exponential moving average
-// is used to replicate the same decay effect that is part of the analog circuit.
-//
-// The coefficient used in the average is computed using the sample rate and
-// the time constant tau that depends on the continent where we are trying
-// to demodulate the signal.
-void deemphasize_filter(float *freq_samples, float last_sample, int len) {
-    float alpha = 1.0 - exp(-(1.0/(TAU * SAMPLE_RATE)));
-
-    freq_samples[0] = alpha * freq_samples[0] + (1.0f - alpha) * last_sample;
-    for (int i = 1; i < len; i++) {
-        freq_samples[i] = alpha * freq_samples[i] + (1.0f - alpha) * freq_samples[i - 1];
-    }
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options] center_frequency audio_duration\n", program);
+    fprintf(stderr, "       %s [options] -f iq_file [center_frequency audio_duration]\n", program);
+    fprintf(stderr, "       %s [options] -R device@MHZ -R device@MHZ ... audio_duration\n", program);
+    fprintf(stderr, "       %s [options] -B THREADS iq_file iq_file ...\n", program);
+    fprintf(stderr, "  -a       capture asynchronously, processing samples on a separate thread\n");
+    fprintf(stderr, "  -b BYTES size of the blocks of IQ samples, a multiple of %d (default %d)\n", BLOCK_SIZE_MULTIPLE, BUFFER_SIZE);
+    fprintf(stderr, "  -H       back the working buffers with huge pages\n");
+    fprintf(stderr, "  -f FILE[@MHZ]\n");
+    fprintf(stderr, "           read uint8 IQ samples recorded at %d S/s (e.g. by rtl_sdr) from FILE\n", SAMPLE_RATE);
+    fprintf(stderr, "           instead of the dongle (%d S/s with -s), \"-\" reads from standard\n", CHANNELIZER_SAMPLE_RATE);
+    fprintf(stderr, "           input; repeated, each file stands in for a dongle tuned on MHZ\n");
+    fprintf(stderr, "  -R DEVICE[@MHZ]\n");
+    fprintf(stderr, "           capture from the dongle with this index or serial number, tuned on MHZ\n");
+    fprintf(stderr, "           (default center_frequency); repeated, up to %d dongles are captured\n", MAX_RECEIVERS);
+    fprintf(stderr, "           together, each on its own thread, writing audio_<MHZ>.wav, and the\n");
+    fprintf(stderr, "           stations of -s are taken from the closest dongle\n");
+    fprintf(stderr, "  -B THREADS\n");
+    fprintf(stderr, "           batch mode: demodulate whole IQ files, each to a WAV file with the same\n");
+    fprintf(stderr, "           name next to it, on THREADS pinned worker threads (0: one per core);\n");
+    fprintf(stderr, "           long files are split between the threads, the audio is the same\n");
+    fprintf(stderr, "  -L LEVEL force the instruction set of the DSP kernels: scalar, sse2, avx2,\n");
+    fprintf(stderr, "           avx512 or neon (default: the best one supported by the CPU)\n");
+    fprintf(stderr, "  -m       memory map the IQ file instead of reading it\n");
+    fprintf(stderr, "  -O NAME  output: thread (default, writer thread with large batched writes)\n");
+    fprintf(stderr, "           stdio (fwrite on the processing thread) or uring (writer thread\n");
+    fprintf(stderr, "           submitting through io_uring, Linux only)\n");
+    fprintf(stderr, "  -o HZ    tune the dongle HZ below center_frequency, away from its DC spike,\n");
+    fprintf(stderr, "           and bring the station back to baseband with an NCO (at most %d)\n", MAX_STATION_OFFSET);
+    fprintf(stderr, "  -s MHZ,MHZ,...\n");
+    fprintf(stderr, "           record several stations from a single %d S/s capture, split into\n", CHANNELIZER_SAMPLE_RATE);
+    fprintf(stderr, "           channels by a polyphase filter bank, each to station_<MHZ>.wav; they\n");
+    fprintf(stderr, "           must be on the %d kHz raster of center_frequency, at most %d kHz away\n",
+            CHANNEL_SPACING / 1000, CHANNELIZER_MAX_OFFSET / 1000);
+    fprintf(stderr, "  -j THREADS\n");
+    fprintf(stderr, "           with -s, split the filter banks and the stations of all the captures\n");
+    fprintf(stderr, "           between THREADS worker threads, each pinned to its own core (default:\n");
+    fprintf(stderr, "           all on the main thread)\n");
+    fprintf(stderr, "  -M SECS  measure the latency of each stage and print it every SECS seconds\n");
+    fprintf(stderr, "           (0: only at the end of the recording)\n");
+    fprintf(stderr, "  -d NAME  FM discriminator: polar (default), fast (approximated arctan)\n");
+    fprintf(stderr, "           or atan2 (reference)\n");
+    fprintf(stderr, "  -e ERR   maximum arctan error in radians of the fast discriminator (default %g)\n", ATAN_DEFAULT_MAX_ERROR);
+    fprintf(stderr, "  -c NAME  IQ conversion: arith (default), lut256 or lut65536 (lookup tables)\n");
+    fprintf(stderr, "  -D NAME  decimator: fir (default), multistage (half-band IQ stages before\n");
+    fprintf(stderr, "           the discriminator and audio FIR) or boxcar (reference)\n");
+    fprintf(stderr, "  -E NAME  arithmetic: float (default) or fixed (int16 samples, CORDIC\n");
+    fprintf(stderr, "           discriminator and Q15 filters, with -D fir or -D boxcar)\n");
+    fprintf(stderr, "  -k NAME  processing kernel: staged (default, one pass over the block per\n");
+    fprintf(stderr, "           stage) or fused (one pass over small tiles)\n");
+    fprintf(stderr, "  -i NAME  recursive filters: block (default, SIMD friendly) or serial (reference)\n");
+    fprintf(stderr, "  -t TAPS  number of taps of the FIR decimator (default %d)\n", FIR_DEFAULT_TAPS);
+    fprintf(stderr, "  -C DC_I,DC_Q,GAIN,PHASE\n");
+    fprintf(stderr, "           correct DC offsets, Q/I gain and Q phase error (degrees, less than %.0f\n",
+            MAX_IQ_PHASE_ERROR);
+    fprintf(stderr, "           in magnitude), requires a lookup table conversion\n");
 }
 
-// DC block filter is an high-pass filter used to reduce the impact of the DC
-// frequencies. In the digital domain it works by centering the frequency around
-// 0 using the two operations: first we compute the difference between the last
-// two samples and then we add a fraction of the previous output. This formula
-// translates the high-pass CR circuit.
-void dc_block_filter(float *samples_buffer, int len) {
-    const float R = 0.99;
-
-    float last = samples_buffer[0];
-    float tmp_res = 0.0f;
-    for (int i = 1; i < len; i++) {
-        tmp_res = samples_buffer[i] - last + R * samples_buffer[i-1];
-        last = samples_buffer[i];
-        samples_buffer[i] = tmp_res;
+// Parse a dongle or an IQ file given as NAME or NAME@MHZ into the receiver,
+// cutting arg at the @. Returns 0 on success and -1 if the frequency is
+// invalid.
+int parse_receiver(char *arg, Receiver *receiver, int is_file) {
+    char *at = strrchr(arg, '@');
+
+    memset(receiver, 0, sizeof(Receiver));
+    if (at != NULL) {
+        char *end;
+        receiver->center_freq = strtod(at + 1, &end);
+        if (end == at + 1 || *end != '\0' || receiver->center_freq <= 0.0) return -1;
+        *at = '\0';
     }
+    if (is_file) receiver->iq_path = arg;
+    else receiver->device = arg;
+    return 0;
 }
 
-// Perform FM signal demodulation. Specifically it performs the following
-// operations:
-// - Separate I and Q samples into two different arrays
-// - Compute the frequency samples
-// - Apply De-emphasize filter on frequency samples
-// - Apply DC block filter on frequency samples
-float demodulate(float *freq_samples, float last_sample, uint8_t *buffer, uint8_t last_i, uint8_t last_q, int len) {
-    float *i_samples = malloc(sizeof(float) * (len / 2));
-    float *q_samples = malloc(sizeof(float) * (len / 2));
-
-    for (int i = 0, j = 0; j < len; i++, j += 2) {
-        i_samples[i] = convert_value(buffer[j]);
-        q_samples[i] = convert_value(buffer[j+1]);
+// Demodulate the IQ files of batch mode on num_threads workers and report the
+// throughput. Returns the exit status.
+int run_batch(const char **iq_paths, int num_files, const PipelineConfig *config, int block_size,
+        int num_threads, WriterBackend writer_backend) {
+    Batch batch;
+    Writer writer;
+
+    // batch_free() also releases a batch prepared only in part.
+    if (batch_init(&batch, config, block_size, iq_paths, num_files, num_threads) < 0) {
+        fprintf(stderr, "Failed to prepare the batch.\n");
+        batch_free(&batch);
+        return 1;
+    }
+    if (writer_init(&writer, writer_backend, 1, NULL) < 0) {
+        fprintf(stderr, "Failed to start the writer%s.\n",
+                writer_backend == WRITER_URING ? " (io_uring may be unavailable)" : "");
+        batch_free(&batch);
+        return 1;
     }
 
-    get_freq_values(freq_samples, i_samples, q_samples, convert_value(last_i), convert_value(last_q), len/2);
-    deemphasize_filter(freq_samples, last_sample, len/2);
-    dc_block_filter(freq_samples, len/2);
-
-    free(i_samples);
-    free(q_samples);
-    return freq_samples[len/2 - 1];
-} 
-
-// Decimate frequency samples to match the sample rate of the WAV audio file.
-// This is a fundamental operation for converting the FM audio into the WAV
-// file.
-// Decimation is implemented using a Boxcar low pass filter. In practice, each
-// decimated sample is obtained by averaging out a number of samples equal to
-// the DECIMATED_FACTOR. This works better than taking one sample every
-// DECIMATION_FACTOR samples and improves audio quality in the end.
-int decimate(float *decimated_samples, float *freq_samples, int len) {
-    for (int i = 0, j = DECIMATION_FACTOR; i < (len / DECIMATION_FACTOR); i++, j+=DECIMATION_FACTOR) {
-        for (int k = j - DECIMATION_FACTOR; k < j; k++) {
-            decimated_samples[i] += freq_samples[k];
-        }
-        decimated_samples[i] /= DECIMATION_FACTOR;
+    double start_time = monotonic_seconds();
+    int result = batch_run(&batch, &writer);
+    writer_free(&writer);
+    double elapsed = monotonic_seconds() - start_time;
+    if (result < 0) {
+        batch_free(&batch);
+        return 1;
     }
 
-    return len / DECIMATION_FACTOR;
+    // Aggregate throughput over all the files, writing the audio included.
+    double megabytes = batch.total_bytes / 1e6;
+    double signal_seconds = batch.total_bytes / (2.0 * SAMPLE_RATE);
+    fprintf(stderr, "Demodulated %d files, %.1f MB of IQ samples in %.3f s: %.1f MB/s (%.1fx real time).\n",
+            num_files, megabytes, elapsed, elapsed > 0.0 ? megabytes / elapsed : 0.0,
+            elapsed > 0.0 ? signal_seconds / elapsed : 0.0);
+    fprintf(stderr, "%d segments on %d threads, %d resynchronized on the carried state (%.1f MB demodulated again).\n",
+            batch.num_segments, num_threads, batch.resyncs, batch.resync_bytes / 1e6);
+    batch_free(&batch);
+    return 0;
 }
 
-// Converts samples from float to int16_t for the WAV audio file.
-// Since the WAV file will contain 16bit integers, it is important to convert
-// them.
-// This is done by clipping the sample value and converting it into an int16_t
-// data type. The gain is used to take into account the value difference between
-// the frequency sample and the audio file.
-// Frequency samples go from -1 to 1, while WAV samples go from -32768 to 32767.
-// It is fundamental to clip values to make them fit the 16 bit integer.
-void convert_samples(int16_t *buffer, float *samples, int len) {
-    const float GAIN = 32767.0f;
-
-    for (int i = 0; i < len; i++) {
-        float res = samples[i] * GAIN;
-
-        if (res > 32767.0f) res = 32767.0f; 
-        else if (res < -32768.0f) res = -32768.0f; 
-
-        buffer[i] = (int16_t)res;
-    }
+// Blocks dropped by the sources of all the receivers.
+uint64_t dropped_blocks(Receiver *receivers, int num_receivers) {
+    uint64_t dropped = 0;
+    for (int r = 0; r < num_receivers; r++) dropped += source_dropped_blocks(&receivers[r].source);
+    return dropped;
 }
 
 int main(int argc, char **argv) {
-    // Configuration of the SDR device.
-    rtlsdr_dev_t *sdr = NULL;
-    float center_freq = 0.0;
+    // Configuration of the sample sources: dongles given with -R or IQ files
+    // given with -f, each one tuned on its own frequency or on center_freq.
+    static Receiver receivers[MAX_RECEIVERS];
+    int num_devices = 0;
+    int num_files = 0;
+    double center_freq = 0.0;
     int audio_duration = 0;
+    int async_mode = 0;
+    int use_mmap = 0;
+    WriterBackend writer_backend = WRITER_THREAD;
+    int block_size = BUFFER_SIZE;
+    PipelineConfig pipeline_config = pipeline_default_config();
+    float atan_max_error = ATAN_DEFAULT_MAX_ERROR;
+    ConvertStrategy convert_strategy = CONVERT_ARITHMETIC;
+    IqCorrection correction = IQ_CORRECTION_NONE;
+    int use_correction = 0;
+    CpuLevel cpu_level = cpu_detect_level();
+    // Interval between latency reports, negative to disable the measurements.
+    double metrics_interval = -1.0;
+    // Stations recorded through the channelizer, none to record center_freq.
+    double stations[CHANNELIZER_NUM_CHANNELS];
+    int num_stations = 0;
+    // Worker threads demodulating the stations, 0 to do it on the main thread.
+    int num_threads = 0;
+    // Worker threads of batch mode, negative outside of it.
+    int batch_threads = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "aB:b:C:c:D:d:E:e:f:Hi:j:k:L:M:mO:o:R:s:t:")) != -1) {
+        switch (opt) {
+            case 'a':
+                async_mode = 1;
+                break;
+            case 'B':
+                batch_threads = atoi(optarg);
+                if (batch_threads == 0) batch_threads = sysconf(_SC_NPROCESSORS_ONLN);
+                if (batch_threads > POOL_MAX_THREADS) batch_threads = POOL_MAX_THREADS;
+                if (batch_threads < 1) {
+                    fprintf(stderr, "Invalid number of threads %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'b':
+                block_size = atoi(optarg);
+                if (block_size < BLOCK_SIZE_MULTIPLE || block_size > MAX_BLOCK_SIZE ||
+                        block_size % BLOCK_SIZE_MULTIPLE != 0) {
+                    fprintf(stderr, "Invalid block size %s, it must be a multiple of %d up to %d bytes.\n",
+                            optarg, BLOCK_SIZE_MULTIPLE, MAX_BLOCK_SIZE);
+                    exit(1);
+                }
+                break;
+            case 'H':
+                dsp_set_hugepages(1);
+                break;
+            case 'c':
+                if (strcmp(optarg, "arith") == 0) {
+                    convert_strategy = CONVERT_ARITHMETIC;
+                } else if (strcmp(optarg, "lut256") == 0) {
+                    convert_strategy = CONVERT_LUT256;
+                } else if (strcmp(optarg, "lut65536") == 0) {
+                    convert_strategy = CONVERT_LUT65536;
+                } else {
+                    fprintf(stderr, "Unknown IQ conversion %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'C':
+                if (sscanf(optarg, "%f,%f,%f,%f", &correction.dc_i, &correction.dc_q,
+                            &correction.gain_q, &correction.phase) != 4 || !(correction.gain_q > 0.0f)) {
+                    fprintf(stderr, "Invalid IQ correction %s.\n", optarg);
+                    exit(1);
+                }
+                if (!(fabsf(correction.phase) < MAX_IQ_PHASE_ERROR)) {
+                    fprintf(stderr, "Invalid IQ phase error %g, it must be between -%.0f and %.0f degrees.\n",
+                            correction.phase, MAX_IQ_PHASE_ERROR, MAX_IQ_PHASE_ERROR);
+                    exit(1);
+                }
+                correction.phase *= M_PI / 180.0;
+                use_correction = 1;
+                break;
+            case 'D':
+                if (strcmp(optarg, "fir") == 0) {
+                    pipeline_config.decimator_type = DECIMATOR_FIR;
+                } else if (strcmp(optarg, "multistage") == 0) {
+                    pipeline_config.decimator_type = DECIMATOR_MULTISTAGE;
+                } else if (strcmp(optarg, "boxcar") == 0) {
+                    pipeline_config.decimator_type = DECIMATOR_BOXCAR;
+                } else {
+                    fprintf(stderr, "Unknown decimator %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'i':
+                if (strcmp(optarg, "block") == 0) {
+                    pipeline_config.block_iir = 1;
+                } else if (strcmp(optarg, "serial") == 0) {
+                    pipeline_config.block_iir = 0;
+                } else {
+                    fprintf(stderr, "Unknown recursive filter formulation %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'k':
+                if (strcmp(optarg, "fused") == 0) {
+                    pipeline_config.fused = 1;
+                } else if (strcmp(optarg, "staged") == 0) {
+                    pipeline_config.fused = 0;
+                } else {
+                    fprintf(stderr, "Unknown processing kernel %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 't':
+                pipeline_config.fir_taps = atoi(optarg);
+                if (pipeline_config.fir_taps < 1) {
+                    fprintf(stderr, "Invalid number of taps %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'd':
+                if (strcmp(optarg, "polar") == 0) {
+                    pipeline_config.discriminator = DISCRIMINATOR_POLAR;
+                } else if (strcmp(optarg, "fast") == 0) {
+                    pipeline_config.discriminator = DISCRIMINATOR_FAST;
+                } else if (strcmp(optarg, "atan2") == 0) {
+                    pipeline_config.discriminator = DISCRIMINATOR_ATAN2;
+                } else {
+                    fprintf(stderr, "Unknown discriminator %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'E':
+                if (strcmp(optarg, "float") == 0) {
+                    pipeline_config.engine = ENGINE_FLOAT;
+                } else if (strcmp(optarg, "fixed") == 0) {
+                    pipeline_config.engine = ENGINE_FIXED;
+                } else {
+                    fprintf(stderr, "Unknown arithmetic %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'e': {
+                char *end;
+                atan_max_error = strtod(optarg, &end);
+                if (end == optarg || *end != '\0' || !(atan_max_error > 0.0f)) {
+                    fprintf(stderr, "Invalid arctan error %s.\n", optarg);
+                    exit(1);
+                }
+                const AtanApprox *approx = atan_approx_for_error(atan_max_error);
+                if (approx->max_error > atan_max_error) {
+                    fprintf(stderr, "Invalid arctan error %s, the most accurate approximation reaches %.1e rad.\n",
+                            optarg, approx->max_error);
+                    exit(1);
+                }
+                break;
+            }
+            case 'f':
+            case 'R':
+                if (num_devices + num_files == MAX_RECEIVERS) {
+                    fprintf(stderr, "At most %d dongles or IQ files can be given.\n", MAX_RECEIVERS);
+                    exit(1);
+                }
+                if (parse_receiver(optarg, &receivers[num_devices + num_files], opt == 'f') < 0) {
+                    fprintf(stderr, "Invalid frequency in %s.\n", optarg);
+                    exit(1);
+                }
+                if (opt == 'f') num_files++;
+                else num_devices++;
+                break;
+            case 'L':
+                if (cpu_level_from_name(optarg, &cpu_level) < 0) {
+                    fprintf(stderr, "Unknown instruction set %s.\n", optarg);
+                    exit(1);
+                }
+                if (!cpu_level_supported(cpu_level)) {
+                    fprintf(stderr, "The CPU does not support %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'm':
+                use_mmap = 1;
+                break;
+            case 'O':
+                if (writer_backend_from_name(optarg, &writer_backend) < 0) {
+                    fprintf(stderr, "Unknown output backend %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'o':
+                pipeline_config.offset = atof(optarg);
+                if (fabs(pipeline_config.offset) > MAX_STATION_OFFSET) {
+                    fprintf(stderr, "Invalid station offset %s, it must be at most %d Hz.\n",
+                            optarg, MAX_STATION_OFFSET);
+                    exit(1);
+                }
+                break;
+            case 's':
+                num_stations = parse_frequencies(optarg, stations, CHANNELIZER_NUM_CHANNELS);
+                if (num_stations < 0) {
+                    fprintf(stderr, "Invalid station frequencies %s, at most %d are allowed.\n",
+                            optarg, CHANNELIZER_NUM_CHANNELS);
+                    exit(1);
+                }
+                break;
+            case 'j':
+                num_threads = atoi(optarg);
+                if (num_threads < 1 || num_threads > POOL_MAX_THREADS) {
+                    fprintf(stderr, "Invalid number of threads %s, it must be between 1 and %d.\n",
+                            optarg, POOL_MAX_THREADS);
+                    exit(1);
+                }
+                break;
+            case 'M':
+                metrics_interval = atof(optarg);
+                if (metrics_interval < 0.0) {
+                    fprintf(stderr, "Invalid report interval %s.\n", optarg);
+                    exit(1);
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
 
-    if (argc > 2) {
-        center_freq = atof(argv[1]);
-        audio_duration = atoi(argv[2]);
-    } else {
+    // With dongles the center frequency and the duration are required, unless
+    // every dongle has its own frequency. When reading from files the center
+    // frequency is only needed to find the stations, and the whole files are
+    // processed unless a duration is given.
+    int num_receivers = num_devices + num_files;
+    int all_tuned = 1;
+    for (int r = 0; r < num_receivers; r++) {
+        if (receivers[r].center_freq == 0.0) all_tuned = 0;
+    }
+    if (batch_threads > 0) {
+        if (argc == optind || num_receivers > 0 || num_stations > 0 || num_threads > 0 || metrics_interval >= 0.0) {
+            fprintf(stderr, "Batch mode takes IQ files as arguments and cannot be combined with -f, -R, -s, -j or -M.\n");
+            print_usage(argv[0]);
+            exit(1);
+        }
+    } else if (argc - optind > 1) {
+        center_freq = atof(argv[optind]);
+        audio_duration = atoi(argv[optind + 1]);
+    } else if (argc - optind == 1 && all_tuned) {
+        audio_duration = atoi(argv[optind]);
+    } else if (num_files == 0 || argc - optind == 1) {
         fprintf(
                 stderr, 
                 "At least an argument is missing.\nMake sure to have inserted both center frequency and audio duration.\n"
         );
+        print_usage(argv[0]);
         exit(1);
     }
-
-    if (rtlsdr_open(&sdr, SDR_INDEX) < 0) {
-        fprintf(stderr, "Failed to open SDR sdrice.\n");
+    if (num_devices > 0 && num_files > 0) {
+        fprintf(stderr, "Dongles and IQ files cannot be mixed.\n");
+        exit(1);
     }
+    // Without -R or -f the first dongle is tuned on the center frequency.
+    if (num_receivers == 0) {
+        receivers[0].device = NULL;
+        num_receivers = 1;
+    }
+    for (int r = 0; r < num_receivers; r++) {
+        if (receivers[r].center_freq == 0.0) receivers[r].center_freq = center_freq;
+    }
+    // Every dongle needs its own capture thread when there are several.
+    if (num_devices > 1) async_mode = 1;
 
-    rtlsdr_set_center_freq(sdr, center_freq * 1000000.0);
-    rtlsdr_set_sample_rate(sdr, SAMPLE_RATE);
-    rtlsdr_set_tuner_gain_mode(sdr, 0);
-    rtlsdr_reset_buffer(sdr);
-
-    // Main FM demodulation and audio recording logic.
-    FILE *audio_file = fopen("audio.wav", "wb");
-
-    // Fill WAV header with known values.
-    WavHeader header;
-    memcpy(header.chunkId, "RIFF", 4);
-    header.chunkSize = 0; // Placeholder, will fix later
-    memcpy(header.format, "WAVE", 4);
-    memcpy(header.fmtChunkId, "fmt ", 4);
-    header.fmtChunkSize = 16;
-    header.audioFormat = 1; // PCM
-    header.numChannels = 1; // Mono
-    header.sampleRate = AUDIO_RATE; // 48000
-    header.bitsPerSample = 16;
-    header.byteRate = AUDIO_RATE * 1 * 16 / 8;
-    header.blockAlign = 1 * 16 / 8;
-    memcpy(header.dataChunkId, "data", 4);
-    header.dataSize = 0; // Placeholder
-
-    // Write the header to the start of the file.
-    fwrite(&header, sizeof(WavHeader), 1, audio_file);
-
-    // Main buffers for data handling.
-    uint8_t buffer[BUFFER_SIZE];
-    memset(buffer, 0, sizeof(uint8_t) * BUFFER_SIZE);
-    float freq_samples[BUFFER_SIZE / 2];
-    float freq_samples_decimated[BUFFER_SIZE / (2 * DECIMATION_FACTOR)];
-    uint8_t last_i = 0;
-    uint8_t last_q = 0;
+    pipeline_config.atan_approx = atan_approx_for_error(atan_max_error);
+    if (use_correction && convert_strategy == CONVERT_ARITHMETIC) {
+        fprintf(stderr, "IQ correction requires a lookup table conversion (-c lut256 or -c lut65536).\n");
+        exit(1);
+    }
+    if (pipeline_config.engine == ENGINE_FIXED &&
+            (use_correction || pipeline_config.decimator_type == DECIMATOR_MULTISTAGE)) {
+        fprintf(stderr, "The fixed-point arithmetic supports neither IQ correction nor multistage decimation.\n");
+        exit(1);
+    }
+    if (pipeline_config.offset != 0.0 && (pipeline_config.engine == ENGINE_FIXED || num_stations > 0)) {
+        fprintf(stderr, "A station offset requires the float arithmetic and cannot be combined with -s.\n");
+        exit(1);
+    }
 
-    int read_bytes = 0;
-    float last_sample = 0.0f;
-    int bytes_count = 0;
-    int total_bytes = SAMPLE_RATE * audio_duration * 2;
-    long total_audio_bytes = 0;
-    while (bytes_count < total_bytes) {
-        // Read BUFFER_SIZE IQ samples from SDR into buffer.
-        last_i = buffer[BUFFER_SIZE - 2];
-        last_q = buffer[BUFFER_SIZE - 1];
-        int result = rtlsdr_read_sync(sdr, buffer, BUFFER_SIZE, &read_bytes); 
-        if (result < 0) {
-            fprintf(stderr, "An error occurred while reading IQ samples.\n");
+    // Channels of the stations, each one taken from the closest capture
+    // that has it, and the rate of the captures.
+    int sample_rate = SAMPLE_RATE;
+    if (num_stations > 0) {
+        for (int r = 0; r < num_receivers; r++) {
+            if (receivers[r].center_freq == 0.0) {
+                fprintf(stderr, "Recording several stations requires the center frequency of the capture.\n");
+                exit(1);
+            }
+        }
+        if (pipeline_config.engine != ENGINE_FLOAT || pipeline_config.decimator_type == DECIMATOR_BOXCAR) {
+            fprintf(stderr, "Recording several stations requires the float arithmetic and the fir or multistage decimator.\n");
             exit(1);
         }
+        for (int k = 0; k < num_stations; k++) {
+            for (int j = 0; j < k; j++) {
+                if (stations[j] == stations[k]) {
+                    fprintf(stderr, "Station %g MHz is given twice.\n", stations[k]);
+                    exit(1);
+                }
+            }
+            Receiver *closest = NULL;
+            int bin = -1;
+            for (int r = 0; r < num_receivers; r++) {
+                int b = channelizer_bin_for_offset((stations[k] - receivers[r].center_freq) * 1000000.0);
+                if (b >= 0 && (closest == NULL || fabs(stations[k] - receivers[r].center_freq) <
+                            fabs(stations[k] - closest->center_freq))) {
+                    closest = &receivers[r];
+                    bin = b;
+                }
+            }
+            if (closest == NULL) {
+                fprintf(stderr, "Station %g MHz is not on the %d kHz raster of a center frequency or farther than %d kHz from it.\n",
+                        stations[k], CHANNEL_SPACING / 1000, CHANNELIZER_MAX_OFFSET / 1000);
+                exit(1);
+            }
+            closest->stations[closest->num_stations] = stations[k];
+            closest->bins[closest->num_stations++] = bin;
+        }
+        for (int r = 0; r < num_receivers; r++) {
+            if (receivers[r].num_stations == 0) {
+                fprintf(stderr, "No station is recorded from the capture at %g MHz.\n", receivers[r].center_freq);
+                exit(1);
+            }
+        }
+        sample_rate = CHANNELIZER_SAMPLE_RATE;
+    } else if (num_threads > 0) {
+        fprintf(stderr, "Worker threads are only used to record several stations (-s).\n");
+        exit(1);
+    } else if (num_receivers > 1) {
+        for (int r = 0; r < num_receivers; r++) {
+            for (int j = 0; j < r; j++) {
+                if (receivers[j].center_freq == receivers[r].center_freq) {
+                    fprintf(stderr, "Two captures are tuned on %g MHz.\n", receivers[r].center_freq);
+                    exit(1);
+                }
+            }
+        }
+    }
 
-        // FM signal handling.
-        last_sample = demodulate(freq_samples, last_sample, buffer, last_i, last_q, BUFFER_SIZE);    
-        int samples_to_write = decimate(freq_samples_decimated, freq_samples, BUFFER_SIZE / 2);
-        
-        // Frequency conversion into WAV data and actual write.
-        int16_t *int_samples = malloc(sizeof(int16_t) * samples_to_write);        
-        convert_samples(int_samples, freq_samples_decimated, samples_to_write);
-        fwrite(int_samples, sizeof(int16_t), samples_to_write, audio_file);
+    if (convert_init(cpu_level, convert_strategy, &correction) < 0 || kernels_init(cpu_level) < 0) {
+        fprintf(stderr, "Failed to initialize the DSP kernels.\n");
+        exit(1);
+    }
+    if (batch_threads > 0) {
+        return run_batch((const char **)&argv[optind], argc - optind, &pipeline_config, block_size, batch_threads,
+                writer_backend);
+    }
 
-        total_audio_bytes += samples_to_write * sizeof(int16_t);
-        bytes_count += read_bytes;
+    Metrics metrics;
+    metrics_init(&metrics, metrics_interval >= 0.0);
+    int num_outputs = 0;
+    for (int r = 0; r < num_receivers; r++) {
+        Receiver *receiver = &receivers[r];
+        int result;
+        if (receiver->iq_path != NULL) {
+            result = source_open_iq_file(&receiver->source, receiver->iq_path, block_size, use_mmap);
+        } else {
+            int index = receiver->device != NULL ? source_find_rtlsdr(receiver->device) : SDR_INDEX;
+            if (index < 0) {
+                fprintf(stderr, "No SDR device has index or serial number %s.\n", receiver->device);
+                exit(1);
+            }
+            result = source_open_rtlsdr(
+                    &receiver->source, index, receiver->center_freq * 1000000.0 - pipeline_config.offset,
+                    sample_rate, block_size, async_mode
+            );
+        }
+        if (result < 0) exit(1);
+
+        // The pipelines own every working buffer, allocated once here: one for
+        // the center frequency, or one per station behind the channelizer.
+        char path[RECEIVER_PATH_SIZE];
+        if (num_receivers > 1) snprintf(path, sizeof(path), "audio_%g.wav", receiver->center_freq);
+        else snprintf(path, sizeof(path), "audio.wav");
+        if (receiver_init(receiver, &pipeline_config, block_size, num_threads, &metrics, path) < 0) {
+            fprintf(stderr, "Failed to allocate the processing pipeline.\n");
+            exit(1);
+        }
+        num_outputs += receiver->num_outputs;
+    }
+    // A single pool of workers, each pinned to its own core, serves the
+    // stations of every receiver.
+    static ChannelPool channel_pool;
+    if (num_threads > 0 && receivers_start_workers(receivers, num_receivers, &channel_pool, &pipeline_config,
+                num_threads, &metrics) < 0) {
+        fprintf(stderr, "Failed to start the worker threads.\n");
+        exit(1);
+    }
+    if (pipeline_config.decimator_type == DECIMATOR_MULTISTAGE) {
+        fprintf(stderr, "Multistage decimation plan:\n");
+        multistage_print_plan(&receivers[0].active[0]->multistage, receivers[0].active[0]->sample_rate,
+                AUDIO_RATE, stderr);
+    }
 
-        // Free the integer samples buffer at the end.
-        free(int_samples);
+    // Main FM demodulation and audio recording logic. A single writer takes
+    // the audio of every receiver.
+    Writer writer;
+    if (writer_init(&writer, writer_backend, num_outputs, &metrics) < 0) {
+        fprintf(stderr, "Failed to start the writer%s.\n",
+                writer_backend == WRITER_URING ? " (io_uring may be unavailable)" : "");
+        exit(1);
+    }
+    for (int r = 0; r < num_receivers; r++) {
+        if (receiver_open_outputs(&receivers[r], &writer) < 0) exit(1);
     }
-    
-    // Move the pointer at the start of the audio file, as we have to update
-    // the header to match the size of the audio file.
-    fseek(audio_file, 0, SEEK_SET);
+    // The processing thread has to keep up with all the captures together.
+    int stream_rate = sample_rate * num_receivers;
+    RealtimeMonitor monitor;
+    realtime_init(&monitor, stream_rate, block_size, receivers[0].source.realtime);
+
+    long long bytes_count = 0;
+    long long total_bytes = (long long)sample_rate * audio_duration * 2;
+    if (num_files > 0 && audio_duration == 0) total_bytes = LLONG_MAX;
+    int num_running = num_receivers;
+    double start_time = monotonic_seconds();
+    double last_report = start_time;
+    while (num_running > 0) {
+        // Read the next block of IQ samples of every receiver, then process
+        // them together.
+        uint8_t *blocks[MAX_RECEIVERS];
+        int lens[MAX_RECEIVERS];
+        int round_bytes = 0;
+        for (int r = 0; r < num_receivers; r++) {
+            Receiver *receiver = &receivers[r];
+            lens[r] = 0;
+            if (receiver->done) continue;
+
+            uint64_t stage_start = metrics_start(&metrics);
+            int read_bytes = source_read(&receiver->source, &blocks[r]);
+            metrics_stop(&metrics, METRIC_READ, stage_start);
+            if (read_bytes < 0) {
+                fprintf(stderr, "An error occurred while reading IQ samples.\n");
+                exit(1);
+            }
+            if (read_bytes < 4) {
+                receiver->done = 1;
+                num_running--;
+                continue;
+            }
+            lens[r] = read_bytes;
+            round_bytes += read_bytes;
+        }
+        double read_end = monotonic_seconds();
+        if (round_bytes == 0) continue;
 
-    header.chunkSize = 36 + total_audio_bytes; // Total file size - 8
-    header.dataSize = total_audio_bytes;  // Just the audio data size
+        if (receivers_process(receivers, num_receivers, blocks, lens, &metrics) < 0) {
+            // Complete the headers of the WAV files before giving up.
+            for (int k = 0; k < num_receivers; k++) receiver_close(&receivers[k]);
+            writer_free(&writer);
+            exit(1);
+        }
+        for (int r = 0; r < num_receivers; r++) {
+            if (lens[r] > 0 && receivers[r].bytes_count >= total_bytes) {
+                receivers[r].done = 1;
+                num_running--;
+            }
+        }
 
-    fwrite(&header, sizeof(WavHeader), 1, audio_file);
+        // Every block is accounted for, the time spent processing the round
+        // only once.
+        double round_end = monotonic_seconds();
+        for (int r = 0; r < num_receivers; r++) {
+            if (lens[r] == 0) continue;
+            realtime_block(&monitor, lens[r], read_end, round_end);
+            read_end = round_end;
+        }
+        bytes_count += round_bytes;
+
+        if (metrics_interval > 0.0 && monotonic_seconds() - last_report >= metrics_interval) {
+            last_report = monotonic_seconds();
+            fprintf(stderr, "Latency after %.1f s of IQ samples:\n", bytes_count / (2.0 * stream_rate));
+            writer_collect_metrics(&writer, &metrics);
+            receivers_collect_metrics(receivers, num_receivers, &metrics);
+            metrics_print(&metrics, bytes_count / (2.0 * stream_rate), stderr);
+            realtime_print(&monitor, dropped_blocks(receivers, num_receivers), stderr);
+        }
+    }
+    double elapsed = monotonic_seconds() - start_time;
 
-    fclose(audio_file);
-    rtlsdr_close(sdr);
-    return 0; 
+    // For offline sources report how much faster than real time the samples
+    // went through the processing chain.
+    if (!receivers[0].source.realtime && elapsed > 0.0) {
+        double signal_seconds = bytes_count / (2.0 * stream_rate);
+        fprintf(
+                stderr,
+                "Processed %.2f s of IQ samples in %.3f s (%.1fx real time).\n",
+                signal_seconds, elapsed, signal_seconds / elapsed
+        );
+    }
+    realtime_print(&monitor, dropped_blocks(receivers, num_receivers), stderr);
+    uint64_t steady_allocations = 0;
+    for (int r = 0; r < num_receivers; r++) steady_allocations += receiver_steady_allocations(&receivers[r]);
+    if (steady_allocations > 0) {
+        fprintf(stderr, "Warning: %llu heap allocations were made while processing.\n",
+                (unsigned long long)steady_allocations);
+    }
+    if (metrics.enabled) receivers_collect_metrics(receivers, num_receivers, &metrics);
+    for (int r = 0; r < num_receivers; r++) {
+        if (receiver_close(&receivers[r]) < 0) exit(1);
+    }
+    if (num_threads > 0) channel_pool_free(&channel_pool);
+    if (metrics.enabled) {
+        writer_collect_metrics(&writer, &metrics);
+        fprintf(stderr, "Latency of the stages per block of %d bytes:\n", block_size);
+        metrics_print(&metrics, bytes_count / (2.0 * stream_rate), stderr);
+    }
+    writer_free(&writer);
+    return 0;
 }
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "metrics.h"
+
+static const char *STAGE_NAMES[METRIC_NUM_STAGES] = {
+    "read", "channelize", "demodulate", "decimate", "demod+decimate", "convert", "write", "disk write"
+};
+
+void metrics_init(Metrics *metrics, int enabled) {
+    memset(metrics, 0, sizeof(Metrics));
+    metrics->enabled = enabled;
+}
+
+// Index of the bucket holding ns. Values below METRICS_SUB_BUCKETS have a
+// bucket each, above that the top bits select the power of two and the next
+// log2(METRICS_SUB_BUCKETS) bits the sub-bucket.
+static int bucket_index(uint64_t ns) {
+    if (ns < METRICS_SUB_BUCKETS) return (int)ns;
+
+    int exponent = 63 - __builtin_clzll(ns);
+    int shift = exponent - __builtin_ctz(METRICS_SUB_BUCKETS);
+    int sub = (int)(ns >> shift) - METRICS_SUB_BUCKETS;
+    return (shift + 1) * METRICS_SUB_BUCKETS + sub;
+}
+
+// Largest value that falls in the bucket.
+static uint64_t bucket_upper_bound(int index) {
+    if (index < METRICS_SUB_BUCKETS) return index;
+
+    int shift = index / METRICS_SUB_BUCKETS - 1;
+    uint64_t sub = index % METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+void latency_record(LatencyHistogram *histogram, uint64_t ns) {
+    histogram->count++;
+    histogram->total_ns += ns;
+    if (ns > histogram->max_ns) histogram->max_ns = ns;
+    histogram->buckets[bucket_index(ns)]++;
+}
+
+// Add the times recorded in from to histogram.
+void latency_merge(LatencyHistogram *histogram, const LatencyHistogram *from) {
+    histogram->count += from->count;
+    histogram->total_ns += from->total_ns;
+    if (from->max_ns > histogram->max_ns) histogram->max_ns = from->max_ns;
+    for (int k = 0; k < METRICS_NUM_BUCKETS; k++) histogram->buckets[k] += from->buckets[k];
+}
+
+void metrics_record(Metrics *metrics, MetricStage stage, uint64_t ns) {
+    latency_record(&metrics->stages[stage], ns);
+}
+
+// Value below which the given fraction of the recorded times fall, rounded up
+// to the end of its bucket and never above the maximum.
+uint64_t metrics_percentile(const LatencyHistogram *histogram, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * histogram->count + 0.5);
+    uint64_t seen = 0;
+
+    if (rank == 0) rank = 1;
+    for (int k = 0; k < METRICS_NUM_BUCKETS; k++) {
+        seen += histogram->buckets[k];
+        if (seen >= rank) {
+            uint64_t bound = bucket_upper_bound(k);
+            return bound < histogram->max_ns ? bound : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+// Print a table with the latency percentiles of every stage that recorded
+// something, and how many times faster than real time each stage alone would
+// process the signal_seconds of samples it went through.
+void metrics_print(const Metrics *metrics, double signal_seconds, FILE *file) {
+    fprintf(file, "%-15s %8s %10s %10s %10s %10s %12s\n",
+            "stage", "blocks", "p50 us", "p99 us", "max us", "total s", "x real time");
+
+    for (int s = 0; s < METRIC_NUM_STAGES; s++) {
+        const LatencyHistogram *histogram = &metrics->stages[s];
+        if (histogram->count == 0) continue;
+
+        double total = histogram->total_ns / 1e9;
+        fprintf(file, "%-15s %8llu %10.1f %10.1f %10.1f %10.3f %12.1f\n",
+                STAGE_NAMES[s], (unsigned long long)histogram->count,
+                metrics_percentile(histogram, 0.50) / 1e3, metrics_percentile(histogram, 0.99) / 1e3,
+                histogram->max_ns / 1e3, total, total > 0.0 ? signal_seconds / total : 0.0);
+    }
+
+    const QueueMetrics *queue = &metrics->queue;
+    if (queue->submitted > 0) {
+        fprintf(file, "Writer queue: %llu buffers, depth %.1f on average and %llu at most of %d, "
+                "%llu stalls (%.1f ms)\n",
+                (unsigned long long)queue->submitted, (double)queue->depth_total / queue->submitted,
+                (unsigned long long)queue->max_depth, queue->capacity,
+                (unsigned long long)queue->stalls, queue->stall_ns / 1e6);
+    }
+}
+
+void realtime_init(RealtimeMonitor *monitor, int sample_rate, int block_size, int live) {
+    memset(monitor, 0, sizeof(RealtimeMonitor));
+    monitor->sample_rate = sample_rate;
+    monitor->block_size = block_size;
+    monitor->live = live;
+    monitor->first_block = -1.0;
+    monitor->min_headroom = 100.0;
+}
+
+// Headroom in percent left by busy seconds of work over the given samples.
+static double headroom_percent(double busy, uint64_t samples, int sample_rate) {
+    double signal = (double)samples / sample_rate;
+    return signal > 0.0 ? 100.0 * (1.0 - busy / signal) : 100.0;
+}
+
+// Account for a block of read_bytes returned by source_read() at read_end and
+// processed by block_end (monotonic clock, seconds).
+void realtime_block(RealtimeMonitor *monitor, int read_bytes, double read_end, double block_end) {
+    uint64_t samples = read_bytes / 2;
+    double busy = block_end - read_end;
+
+    if (monitor->pending_short) monitor->short_reads++;
+    monitor->pending_short = read_bytes < monitor->block_size;
+
+    monitor->samples += samples;
+    monitor->busy_seconds += busy;
+
+    // The wall clock starts when the first block arrives, its samples were
+    // captured before.
+    if (monitor->first_block < 0.0) {
+        monitor->first_block = read_end;
+        monitor->first_samples = samples;
+    }
+    double consumed = (double)(monitor->samples - monitor->first_samples) / monitor->sample_rate;
+    monitor->lag_seconds = (read_end - monitor->first_block) - consumed;
+    if (monitor->lag_seconds > monitor->max_lag_seconds) monitor->max_lag_seconds = monitor->lag_seconds;
+
+    monitor->window_busy += busy;
+    monitor->window_samples += samples;
+    if (monitor->window_samples >= REALTIME_WINDOW_SECONDS * monitor->sample_rate) {
+        double headroom = headroom_percent(monitor->window_busy, monitor->window_samples, monitor->sample_rate);
+        if (headroom < monitor->min_headroom) monitor->min_headroom = headroom;
+
+        if (monitor->live && headroom < REALTIME_WARN_HEADROOM && !monitor->warned) {
+            fprintf(stderr, "Warning: real-time headroom down to %.1f%%, processing is close to saturation.\n", headroom);
+            monitor->warned = 1;
+        }
+        monitor->window_busy = 0.0;
+        monitor->window_samples = 0;
+    }
+}
+
+// Headroom over the whole run, in percent.
+double realtime_headroom(const RealtimeMonitor *monitor) {
+    return headroom_percent(monitor->busy_seconds, monitor->samples, monitor->sample_rate);
+}
+
+// Print the headroom, and for live sources whether samples were lost:
+// dropped_blocks is the number of blocks the source itself dropped.
+void realtime_print(const RealtimeMonitor *monitor, uint64_t dropped_blocks, FILE *file) {
+    fprintf(file, "Real-time headroom: %.1f%% overall", realtime_headroom(monitor));
+    if (monitor->samples >= REALTIME_WINDOW_SECONDS * monitor->sample_rate) {
+        fprintf(file, ", %.1f%% over the worst %.0f s", monitor->min_headroom, REALTIME_WINDOW_SECONDS);
+    }
+    fprintf(file, ".\n");
+
+    if (!monitor->live) return;
+
+    fprintf(file, "Lag behind the wall clock: %.3f s at the end, %.3f s at most.\n",
+            monitor->lag_seconds, monitor->max_lag_seconds);
+    if (monitor->short_reads > 0) {
+        fprintf(file, "Warning: %llu short reads.\n", (unsigned long long)monitor->short_reads);
+    }
+    if (dropped_blocks > 0) {
+        fprintf(file, "Warning: %llu blocks of IQ samples (%.2f s) were dropped because processing did not keep up.\n",
+                (unsigned long long)dropped_blocks,
+                (double)dropped_blocks * monitor->block_size / (2.0 * monitor->sample_rate));
+    }
+}
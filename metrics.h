@@ -0,0 +1,129 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Latency instrumentation of the main loop.
+//
+// Each stage records how long it took for every block in a histogram with
+// logarithmic buckets: METRICS_SUB_BUCKETS buckets per power of two of
+// nanoseconds, so that percentiles are known within 1/METRICS_SUB_BUCKETS of
+// their value whatever the block size. Recording is a couple of integer
+// operations, and the stages only read the clock when instrumentation is
+// enabled, so a disabled Metrics costs one branch per stage and block.
+
+#define METRICS_SUB_BUCKETS 8
+#define METRICS_NUM_BUCKETS (64 * METRICS_SUB_BUCKETS)
+
+typedef enum {
+    METRIC_READ,                // source_read()
+    METRIC_CHANNELIZE,          // Split of a wideband capture into channels
+    METRIC_DEMODULATE,          // IQ conversion, discriminator and filters
+    METRIC_DECIMATE,
+    METRIC_FUSED,               // Demodulation and decimation, one tile at a time
+    METRIC_CONVERT,             // Float to int16 conversion
+    METRIC_WRITE,               // Hand the WAV samples to the output stage
+    METRIC_DISK,                // Writes issued by the writer thread
+    METRIC_NUM_STAGES
+} MetricStage;
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint32_t buckets[METRICS_NUM_BUCKETS];
+} LatencyHistogram;
+
+// Queue between the DSP thread and the writer thread, as seen by the DSP
+// thread each time it hands over a buffer.
+typedef struct {
+    uint64_t submitted;         // Buffers handed to the writer thread
+    uint64_t depth_total;       // Sum of the queue depths after each submission
+    uint64_t max_depth;
+    int capacity;
+    uint64_t stalls;            // Times the DSP thread waited for a free buffer
+    uint64_t stall_ns;
+} QueueMetrics;
+
+typedef struct {
+    int enabled;
+    LatencyHistogram stages[METRIC_NUM_STAGES];
+    QueueMetrics queue;
+} Metrics;
+
+// Current time of a monotonic clock in nanoseconds.
+static inline uint64_t metrics_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Start timing a stage: the current time, or 0 if metrics is disabled.
+// metrics may be NULL.
+static inline uint64_t metrics_start(const Metrics *metrics) {
+    return metrics != NULL && metrics->enabled ? metrics_clock_ns() : 0;
+}
+
+void latency_record(LatencyHistogram *histogram, uint64_t ns);
+void latency_merge(LatencyHistogram *histogram, const LatencyHistogram *from);
+void metrics_record(Metrics *metrics, MetricStage stage, uint64_t ns);
+
+// Record the time elapsed since metrics_start() returned start, and return
+// the current time so that consecutive stages can be chained.
+static inline uint64_t metrics_stop(Metrics *metrics, MetricStage stage, uint64_t start) {
+    if (metrics == NULL || !metrics->enabled) return 0;
+    uint64_t now = metrics_clock_ns();
+    metrics_record(metrics, stage, now - start);
+    return now;
+}
+
+// Real-time monitoring, always enabled as it reads the clock twice per block.
+//
+// The time spent outside source_read() (processing and writing) is compared
+// with the duration of the samples it handled, which gives the real-time
+// headroom: 100% when processing is free, 0% when it takes as long as the
+// signal, at which point a live source starts losing samples. It is tracked
+// over the whole run and over windows of REALTIME_WINDOW_SECONDS of signal,
+// to catch short saturations.
+//
+// For live sources the samples consumed are also compared with the wall
+// clock: when processing falls behind, the dongle keeps streaming and the
+// samples it delivers late, or never, show up as a lag. Short reads (blocks
+// smaller than requested before the end of the stream) are counted too.
+#define REALTIME_WINDOW_SECONDS 5.0
+// Headroom below which a warning is printed while recording, in percent.
+#define REALTIME_WARN_HEADROOM 10.0
+
+typedef struct {
+    int sample_rate;
+    int block_size;
+    int live;                   // The source produces samples in real time
+    uint64_t samples;           // IQ samples consumed
+    uint64_t short_reads;
+    int pending_short;          // The last block was short, count it if more follow
+    double busy_seconds;        // Time spent outside source_read()
+
+    // Wall clock against samples consumed.
+    double first_block;         // Time the first block was returned, or -1
+    uint64_t first_samples;     // Samples in the first block
+    double lag_seconds;         // Current lag of the samples behind the wall clock
+    double max_lag_seconds;
+
+    // Headroom over the current window.
+    double window_busy;
+    uint64_t window_samples;
+    double min_headroom;        // Lowest headroom of a complete window, in percent
+    int warned;
+} RealtimeMonitor;
+
+void metrics_init(Metrics *metrics, int enabled);
+void realtime_init(RealtimeMonitor *monitor, int sample_rate, int block_size, int live);
+void realtime_block(RealtimeMonitor *monitor, int read_bytes, double read_end, double block_end);
+double realtime_headroom(const RealtimeMonitor *monitor);
+void realtime_print(const RealtimeMonitor *monitor, uint64_t dropped_blocks, FILE *file);
+uint64_t metrics_percentile(const LatencyHistogram *histogram, double fraction);
+void metrics_print(const Metrics *metrics, double signal_seconds, FILE *file);
+
+#endif
@@ -0,0 +1,70 @@
+#include <math.h>
+#include <string.h>
+
+#include "kernels.h"
+#include "nco.h"
+
+// Prepare an oscillator moving the signal at offset Hz to baseband, for
+// samples at sample_rate.
+void nco_init(Nco *nco, double offset, double sample_rate) {
+    double step = -2.0 * M_PI * offset / sample_rate;
+
+    nco->offset = offset;
+    for (int k = 0; k < NCO_LANES; k++) {
+        nco->lane_re[k] = cos(step * k);
+        nco->lane_im[k] = sin(step * k);
+    }
+    nco->step_re = cos(step * NCO_LANES);
+    nco->step_im = sin(step * NCO_LANES);
+    nco->base_re = 1.0;
+    nco->base_im = 0.0;
+    nco->lane = 0;
+}
+
+// Move the base rotation to the next group, bringing its magnitude back to 1.
+static void nco_next_group(Nco *nco) {
+    double re = nco->base_re * nco->step_re - nco->base_im * nco->step_im;
+    double im = nco->base_re * nco->step_im + nco->base_im * nco->step_re;
+    double gain = 1.5 - 0.5 * (re * re + im * im);
+
+    nco->base_re = re * gain;
+    nco->base_im = im * gain;
+}
+
+// Rotate count samples of the current group, from its next lane on. They go
+// through the kernel like whole groups, so that every sample is rotated by the
+// same operations wherever the calls split the stream.
+static void nco_mix_partial(Nco *nco, float *i_samples, float *q_samples, int count) {
+    float group_i[NCO_LANES] = { 0.0f };
+    float group_q[NCO_LANES] = { 0.0f };
+
+    memcpy(group_i + nco->lane, i_samples, sizeof(float) * count);
+    memcpy(group_q + nco->lane, q_samples, sizeof(float) * count);
+    dsp_kernels->nco_rotate(group_i, group_q, nco->lane_re, nco->lane_im, nco->base_re, nco->base_im);
+    memcpy(i_samples, group_i + nco->lane, sizeof(float) * count);
+    memcpy(q_samples, group_q + nco->lane, sizeof(float) * count);
+
+    nco->lane += count;
+    if (nco->lane == NCO_LANES) {
+        nco->lane = 0;
+        nco_next_group(nco);
+    }
+}
+
+// Shift len samples in place. The samples continue the ones of the previous
+// call, whatever their number.
+void nco_mix(Nco *nco, float *i_samples, float *q_samples, int len) {
+    int n = 0;
+
+    // Finish the group started by the previous call, then whole groups, then
+    // start a new group with the last samples.
+    if (nco->lane != 0) {
+        n = NCO_LANES - nco->lane < len ? NCO_LANES - nco->lane : len;
+        nco_mix_partial(nco, i_samples, q_samples, n);
+    }
+    for (; n + NCO_LANES <= len; n += NCO_LANES) {
+        dsp_kernels->nco_rotate(i_samples + n, q_samples + n, nco->lane_re, nco->lane_im, nco->base_re, nco->base_im);
+        nco_next_group(nco);
+    }
+    if (n < len) nco_mix_partial(nco, i_samples + n, q_samples + n, len - n);
+}
@@ -0,0 +1,33 @@
+#ifndef NCO_H
+#define NCO_H
+
+// Numerically controlled oscillator moving a station at an offset from the
+// center of the capture to baseband, before the discriminator. This way the
+// dongle can be tuned away from the station, whose carrier then no longer
+// sits on the DC spike and the LO leakage of the dongle.
+//
+// Sample n is multiplied by exp(-2 pi i offset n / rate). The rotation of
+// NCO_LANES consecutive samples is the rotation of the first one, kept in
+// double precision and advanced once per group, times a constant table of
+// lane rotations, so the inner loop is a complex multiply over NCO_LANES
+// samples that maps on SIMD registers. The base rotation is renormalized at
+// every group, so neither the amplitude nor the frequency drifts over long
+// recordings, and as every sample uses the same product whatever the calls
+// the samples are split in, the output does not depend on the block size.
+#define NCO_LANES 16
+
+typedef struct {
+    double offset;              // Hz, 0 if the NCO is disabled
+    float lane_re[NCO_LANES];   // exp(-2 pi i offset k / rate)
+    float lane_im[NCO_LANES];
+    double step_re;             // Rotation of a whole group
+    double step_im;
+    double base_re;             // Rotation of the first sample of the group
+    double base_im;
+    int lane;                   // Index of the next sample in its group
+} Nco;
+
+void nco_init(Nco *nco, double offset, double sample_rate);
+void nco_mix(Nco *nco, float *i_samples, float *q_samples, int len);
+
+#endif
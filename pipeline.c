@@ -0,0 +1,335 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsp.h"
+#include "convert.h"
+#include "decimator.h"
+#include "pipeline.h"
+
+PipelineConfig pipeline_default_config(void) {
+    PipelineConfig config;
+
+    config.engine = ENGINE_FLOAT;
+    config.discriminator = DISCRIMINATOR_POLAR;
+    config.atan_approx = atan_approx_for_error(ATAN_DEFAULT_MAX_ERROR);
+    config.decimator_type = DECIMATOR_FIR;
+    config.fir_taps = FIR_DEFAULT_TAPS;
+    config.fused = 0;
+    config.block_iir = 1;
+    config.offset = 0.0;
+
+    return config;
+}
+
+// Largest number of audio samples produced from a single block. The FIR
+// decimators carry their phase across blocks, so they can produce one sample
+// more than the boxcar one.
+int pipeline_max_output(const Pipeline *pipeline) {
+    return pipeline->block_size / 2 / (pipeline->sample_rate / AUDIO_RATE) + 1;
+}
+
+// Allocate the buffers and the decimators of the float engine, for blocks of
+// at most block_size / 2 IQ samples at sample_rate.
+static int pipeline_alloc(Pipeline *pipeline, const PipelineConfig *config, int sample_rate, int block_size) {
+    memset(pipeline, 0, sizeof(Pipeline));
+    pipeline->config = *config;
+    pipeline->sample_rate = sample_rate;
+    pipeline->block_size = block_size;
+
+    int num_samples = block_size / 2;
+    int max_output = pipeline_max_output(pipeline);
+
+    pipeline->i_samples = alloc_aligned(sizeof(float) * num_samples);
+    pipeline->q_samples = alloc_aligned(sizeof(float) * num_samples);
+    pipeline->freq_samples = alloc_aligned(sizeof(float) * num_samples);
+    pipeline->audio_samples = alloc_aligned(sizeof(float) * max_output);
+    pipeline->int_samples = alloc_aligned(sizeof(int16_t) * max_output);
+    if (pipeline->i_samples == NULL || pipeline->q_samples == NULL || pipeline->freq_samples == NULL ||
+            pipeline->audio_samples == NULL || pipeline->int_samples == NULL) {
+        pipeline_free(pipeline);
+        return -1;
+    }
+
+    int result = 0;
+    if (config->decimator_type == DECIMATOR_FIR) {
+        result = fir_decimator_init(&pipeline->fir, sample_rate / AUDIO_RATE, config->fir_taps, FIR_CUTOFF,
+                sample_rate, num_samples);
+    } else if (config->decimator_type == DECIMATOR_MULTISTAGE) {
+        result = multistage_init(&pipeline->multistage, sample_rate, AUDIO_RATE, num_samples);
+    }
+    if (result < 0) {
+        pipeline_free(pipeline);
+        return -1;
+    }
+
+    nco_init(&pipeline->nco, config->offset, sample_rate);
+
+    // The discriminator starts from the IQ sample (0, 0), or from 0.0 after
+    // the half-band stages.
+    demod_state_init(&pipeline->demod, config->decimator_type == DECIMATOR_MULTISTAGE ?
+            pipeline->multistage.iq_rate : sample_rate, config->block_iir);
+
+    return 0;
+}
+
+// Allocate the buffers and the filters for blocks of at most block_size bytes.
+// Returns 0 on success and -1 on failure.
+int pipeline_init(Pipeline *pipeline, const PipelineConfig *config, int block_size) {
+    // The fixed-point chain has buffers of its own and writes the WAV
+    // samples directly. It has no NCO.
+    if (config->engine == ENGINE_FIXED) {
+        if (config->offset != 0.0) return -1;
+        memset(pipeline, 0, sizeof(Pipeline));
+        pipeline->config = *config;
+        pipeline->sample_rate = SAMPLE_RATE;
+        pipeline->block_size = block_size;
+        pipeline->int_samples = alloc_aligned(sizeof(int16_t) * pipeline_max_output(pipeline));
+        if (pipeline->int_samples == NULL ||
+                fixed_pipeline_init(&pipeline->fixed, config->decimator_type, config->fir_taps, block_size) < 0) {
+            pipeline_free(pipeline);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (pipeline_alloc(pipeline, config, SAMPLE_RATE, block_size) < 0) return -1;
+
+    // The uint8 IQ sample (0, 0) is not at the origin once converted.
+    if (config->decimator_type != DECIMATOR_MULTISTAGE) {
+        uint8_t first_pair[2] = { 0, 0 };
+        deinterleave_iq(&pipeline->demod.last_i, &pipeline->demod.last_q, first_pair, 1);
+    }
+
+    return 0;
+}
+
+// Allocate a pipeline demodulating float IQ samples at sample_rate, e.g. a
+// channel of the channelizer, at most max_samples at a time. Only the float
+// engine with the FIR or multistage decimators runs at other rates than
+// SAMPLE_RATE. Returns 0 on success and -1 on failure.
+int pipeline_init_channel(Pipeline *pipeline, const PipelineConfig *config, int sample_rate, int max_samples) {
+    if (config->engine != ENGINE_FLOAT || config->decimator_type == DECIMATOR_BOXCAR ||
+            sample_rate % AUDIO_RATE != 0) {
+        return -1;
+    }
+    return pipeline_alloc(pipeline, config, sample_rate, 2 * max_samples);
+}
+
+void pipeline_free(Pipeline *pipeline) {
+    free(pipeline->i_samples);
+    free(pipeline->q_samples);
+    free(pipeline->freq_samples);
+    free(pipeline->audio_samples);
+    free(pipeline->int_samples);
+
+    if (pipeline->config.engine == ENGINE_FIXED) {
+        fixed_pipeline_free(&pipeline->fixed);
+        memset(pipeline, 0, sizeof(Pipeline));
+        return;
+    }
+    if (pipeline->config.decimator_type == DECIMATOR_FIR) fir_decimator_free(&pipeline->fir);
+    if (pipeline->config.decimator_type == DECIMATOR_MULTISTAGE) multistage_free(&pipeline->multistage);
+
+    memset(pipeline, 0, sizeof(Pipeline));
+}
+
+// The state carried from one block to the next: the samples and outputs the
+// demodulator and the filters remember, the phases of the decimators and of
+// the NCO. Loaded in another pipeline with the same configuration, it
+// continues the stream of the first one, e.g. to split a long capture
+// between threads, and two pipelines with the same state produce the same
+// audio from then on. Only the float engine saves its state. Size in bytes
+// of the state.
+size_t pipeline_state_size(const Pipeline *pipeline) {
+    const PipelineConfig *config = &pipeline->config;
+    size_t size = 5 * sizeof(float) + 2 * sizeof(double) + sizeof(int);
+
+    if (config->engine == ENGINE_FIXED) return 0;
+    if (config->decimator_type == DECIMATOR_FIR) size += fir_decimator_state_size(&pipeline->fir);
+    if (config->decimator_type == DECIMATOR_MULTISTAGE) size += multistage_state_size(&pipeline->multistage);
+    return size;
+}
+
+void pipeline_save_state(const Pipeline *pipeline, uint8_t *state) {
+    const DemodState *demod = &pipeline->demod;
+    const float carried[5] = { demod->last_i, demod->last_q, demod->deemph, demod->dc_input, demod->dc_output };
+    const double nco[2] = { pipeline->nco.base_re, pipeline->nco.base_im };
+
+    memcpy(state, carried, sizeof(carried));
+    memcpy(state + sizeof(carried), nco, sizeof(nco));
+    memcpy(state + sizeof(carried) + sizeof(nco), &pipeline->nco.lane, sizeof(int));
+    state += sizeof(carried) + sizeof(nco) + sizeof(int);
+
+    if (pipeline->config.decimator_type == DECIMATOR_FIR) fir_decimator_save_state(&pipeline->fir, state);
+    if (pipeline->config.decimator_type == DECIMATOR_MULTISTAGE) multistage_save_state(&pipeline->multistage, state);
+}
+
+void pipeline_load_state(Pipeline *pipeline, const uint8_t *state) {
+    DemodState *demod = &pipeline->demod;
+    float carried[5];
+    double nco[2];
+
+    memcpy(carried, state, sizeof(carried));
+    memcpy(nco, state + sizeof(carried), sizeof(nco));
+    memcpy(&pipeline->nco.lane, state + sizeof(carried) + sizeof(nco), sizeof(int));
+    state += sizeof(carried) + sizeof(nco) + sizeof(int);
+    demod->last_i = carried[0];
+    demod->last_q = carried[1];
+    demod->deemph = carried[2];
+    demod->dc_input = carried[3];
+    demod->dc_output = carried[4];
+    pipeline->nco.base_re = nco[0];
+    pipeline->nco.base_im = nco[1];
+
+    if (pipeline->config.decimator_type == DECIMATOR_FIR) fir_decimator_load_state(&pipeline->fir, state);
+    if (pipeline->config.decimator_type == DECIMATOR_MULTISTAGE) multistage_load_state(&pipeline->multistage, state);
+}
+
+// Demodulate a block of len IQ bytes (at most block_size) and convert it into
+// audio samples, stored in pipeline->int_samples.
+// Returns the number of audio samples.
+int pipeline_process(Pipeline *pipeline, uint8_t *block, int len) {
+    uint64_t allocations = dsp_allocation_count();
+    int count;
+
+    if (pipeline->config.engine == ENGINE_FIXED) {
+        uint64_t start = metrics_start(pipeline->metrics);
+        count = fixed_pipeline_process(&pipeline->fixed, pipeline->int_samples, block, len);
+        metrics_stop(pipeline->metrics, METRIC_FUSED, start);
+    } else {
+        count = pipeline->config.fused ?
+            pipeline_process_fused(pipeline, block, len) : pipeline_process_staged(pipeline, block, len);
+
+        uint64_t start = metrics_start(pipeline->metrics);
+        convert_samples(pipeline->int_samples, pipeline->audio_samples, count);
+        metrics_stop(pipeline->metrics, METRIC_CONVERT, start);
+    }
+
+    pipeline->steady_allocations += dsp_allocation_count() - allocations;
+    return count;
+}
+
+// Demodulate num_samples float IQ samples of a pipeline made by
+// pipeline_init_channel(), overwriting them, and convert them into audio
+// samples stored in pipeline->int_samples. Returns the number of audio samples.
+int pipeline_process_iq(Pipeline *pipeline, float *i_samples, float *q_samples, int num_samples) {
+    const PipelineConfig *config = &pipeline->config;
+    Metrics *metrics = pipeline->metrics;
+    uint64_t allocations = dsp_allocation_count();
+    int count;
+
+    uint64_t start = metrics_start(metrics);
+    if (config->offset != 0.0) nco_mix(&pipeline->nco, i_samples, q_samples, num_samples);
+    if (config->decimator_type == DECIMATOR_MULTISTAGE) {
+        int iq_len = multistage_process_iq(&pipeline->multistage, i_samples, q_samples, num_samples);
+        demodulate_samples(pipeline->freq_samples, i_samples, q_samples, iq_len,
+                &pipeline->demod, config->discriminator, config->atan_approx);
+        count = fir_decimator_process(&pipeline->multistage.audio, pipeline->audio_samples, pipeline->freq_samples, iq_len);
+    } else {
+        demodulate_samples(fir_decimator_input(&pipeline->fir), i_samples, q_samples, num_samples,
+                &pipeline->demod, config->discriminator, config->atan_approx);
+        count = fir_decimator_filter(&pipeline->fir, pipeline->audio_samples, num_samples);
+    }
+    start = metrics_stop(metrics, METRIC_FUSED, start);
+
+    convert_samples(pipeline->int_samples, pipeline->audio_samples, count);
+    metrics_stop(metrics, METRIC_CONVERT, start);
+
+    pipeline->steady_allocations += dsp_allocation_count() - allocations;
+    return count;
+}
+
+// Reference kernel: each stage sweeps the whole block before the next one
+// starts. Stores the decimated samples in pipeline->audio_samples and returns
+// their number.
+int pipeline_process_staged(Pipeline *pipeline, uint8_t *block, int len) {
+    const PipelineConfig *config = &pipeline->config;
+    Metrics *metrics = pipeline->metrics;
+    int num_samples = len / 2;
+    int count = 0;
+    uint64_t start = metrics_start(metrics);
+
+    if (config->decimator_type == DECIMATOR_MULTISTAGE) {
+        // Reduce the IQ rate before demodulating, then filter the audio. The
+        // half-band stages are accounted to the decimation.
+        deinterleave_iq(pipeline->i_samples, pipeline->q_samples, block, num_samples);
+        if (config->offset != 0.0) nco_mix(&pipeline->nco, pipeline->i_samples, pipeline->q_samples, num_samples);
+        uint64_t converted = metrics_start(metrics);
+        int iq_len = multistage_process_iq(&pipeline->multistage, pipeline->i_samples, pipeline->q_samples, num_samples);
+        uint64_t halfband = metrics_start(metrics);
+        demodulate_samples(pipeline->freq_samples, pipeline->i_samples, pipeline->q_samples, iq_len,
+                &pipeline->demod, config->discriminator, config->atan_approx);
+        uint64_t demodulated = metrics_start(metrics);
+        count = fir_decimator_process(&pipeline->multistage.audio, pipeline->audio_samples, pipeline->freq_samples, iq_len);
+
+        if (metrics != NULL && metrics->enabled) {
+            uint64_t end = metrics_clock_ns();
+            metrics_record(metrics, METRIC_DEMODULATE, (converted - start) + (demodulated - halfband));
+            metrics_record(metrics, METRIC_DECIMATE, (halfband - converted) + (end - demodulated));
+        }
+    } else {
+        deinterleave_iq(pipeline->i_samples, pipeline->q_samples, block, num_samples);
+        if (config->offset != 0.0) nco_mix(&pipeline->nco, pipeline->i_samples, pipeline->q_samples, num_samples);
+        demodulate_samples(pipeline->freq_samples, pipeline->i_samples, pipeline->q_samples, num_samples,
+                &pipeline->demod, config->discriminator, config->atan_approx);
+        start = metrics_stop(metrics, METRIC_DEMODULATE, start);
+
+        if (config->decimator_type == DECIMATOR_FIR) {
+            count = fir_decimator_process(&pipeline->fir, pipeline->audio_samples, pipeline->freq_samples, num_samples);
+        } else {
+            count = decimate(pipeline->audio_samples, pipeline->freq_samples, num_samples);
+        }
+        metrics_stop(metrics, METRIC_DECIMATE, start);
+    }
+
+    return count;
+}
+
+// Fused kernel: the block is split in tiles of FUSED_TILE IQ samples, and
+// each tile goes through the conversion, the NCO, the half-band stages, the
+// discriminator, the filters and the decimator while it is still in L1 cache.
+// The frequency samples are written straight into the input of the FIR
+// decimators. The result is identical to pipeline_process_staged().
+int pipeline_process_fused(Pipeline *pipeline, uint8_t *block, int len) {
+    const PipelineConfig *config = &pipeline->config;
+    int num_samples = len / 2;
+    int count = 0;
+
+    // The half-band stages shrink the tiles, start from larger ones so that
+    // the discriminator still sees FUSED_TILE samples at a time.
+    int tile = FUSED_TILE;
+    if (config->decimator_type == DECIMATOR_MULTISTAGE) tile <<= pipeline->multistage.num_iq_stages;
+
+    // The stages run a tile at a time, they are timed together.
+    uint64_t start = metrics_start(pipeline->metrics);
+
+    for (int offset = 0; offset < num_samples; offset += tile) {
+        int n = num_samples - offset < tile ? num_samples - offset : tile;
+        float *freq_samples = pipeline->freq_samples;
+
+        deinterleave_iq(pipeline->i_samples, pipeline->q_samples, block + 2 * offset, n);
+        if (config->offset != 0.0) nco_mix(&pipeline->nco, pipeline->i_samples, pipeline->q_samples, n);
+
+        if (config->decimator_type == DECIMATOR_MULTISTAGE) {
+            n = multistage_process_iq(&pipeline->multistage, pipeline->i_samples, pipeline->q_samples, n);
+            freq_samples = fir_decimator_input(&pipeline->multistage.audio);
+        } else if (config->decimator_type == DECIMATOR_FIR) {
+            freq_samples = fir_decimator_input(&pipeline->fir);
+        }
+        if (n == 0) continue;
+
+        demodulate_samples(freq_samples, pipeline->i_samples, pipeline->q_samples, n, &pipeline->demod,
+                config->discriminator, config->atan_approx);
+
+        if (config->decimator_type == DECIMATOR_MULTISTAGE) {
+            count += fir_decimator_filter(&pipeline->multistage.audio, pipeline->audio_samples + count, n);
+        } else if (config->decimator_type == DECIMATOR_FIR) {
+            count += fir_decimator_filter(&pipeline->fir, pipeline->audio_samples + count, n);
+        } else {
+            count += decimate(pipeline->audio_samples + count, freq_samples, n);
+        }
+    }
+    metrics_stop(pipeline->metrics, METRIC_FUSED, start);
+
+    return count;
+}
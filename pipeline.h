@@ -0,0 +1,83 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+
+#include "dsp.h"
+#include "decimator.h"
+#include "fixed.h"
+#include "metrics.h"
+#include "nco.h"
+
+// Number of IQ samples that go through all the stages of the fused kernel
+// together. A tile of I, Q and frequency samples takes 15 KB, so it stays in
+// L1 cache from the conversion to the decimation. It is a multiple of
+// DECIMATION_FACTOR, as the boxcar decimator does not keep partial sums.
+#define FUSED_TILE 1280
+
+// Arithmetic used by the processing chain.
+typedef enum {
+    ENGINE_FLOAT,
+    ENGINE_FIXED,               // int16 samples and Q15 filters, see fixed.h
+} Engine;
+
+// Options of the processing chain, chosen on the command line.
+typedef struct {
+    Engine engine;
+    Discriminator discriminator;
+    const AtanApprox *atan_approx;
+    DecimatorType decimator_type;
+    int fir_taps;
+    int fused;                  // Process blocks one tile at a time
+    int block_iir;              // Block formulation of the recursive filters
+    double offset;              // Hz from the center of the capture to the
+                                // station, shifted to baseband by an NCO
+} PipelineConfig;
+
+// Everything needed to turn blocks of IQ samples into audio samples: the
+// working buffers, allocated once and aligned to DSP_ALIGNMENT, and the state
+// carried from one block to the next. Once initialized, processing a block
+// never touches the heap.
+typedef struct {
+    PipelineConfig config;
+    int sample_rate;            // Rate of the IQ samples
+    int block_size;             // Maximum number of IQ bytes per block
+
+    // Working buffers.
+    float *i_samples;
+    float *q_samples;
+    float *freq_samples;
+    float *audio_samples;
+    int16_t *int_samples;       // Output of the last processed block
+
+    // Decimators, only the one selected by the configuration is used.
+    FirDecimator fir;
+    MultistageDecimator multistage;
+    FixedPipeline fixed;        // Used instead of all the above by ENGINE_FIXED
+
+    // State carried across blocks.
+    Nco nco;                    // Only used with a non-zero offset
+    DemodState demod;
+
+    // Heap allocations made by the thread processing the blocks while it
+    // does so, always 0 unless a kernel allocates memory on the hot path.
+    uint64_t steady_allocations;
+
+    // Latency of the stages, NULL (the default) to skip the measurements.
+    Metrics *metrics;
+} Pipeline;
+
+PipelineConfig pipeline_default_config(void);
+int pipeline_init(Pipeline *pipeline, const PipelineConfig *config, int block_size);
+int pipeline_init_channel(Pipeline *pipeline, const PipelineConfig *config, int sample_rate, int max_samples);
+void pipeline_free(Pipeline *pipeline);
+int pipeline_max_output(const Pipeline *pipeline);
+size_t pipeline_state_size(const Pipeline *pipeline);
+void pipeline_save_state(const Pipeline *pipeline, uint8_t *state);
+void pipeline_load_state(Pipeline *pipeline, const uint8_t *state);
+int pipeline_process(Pipeline *pipeline, uint8_t *block, int len);
+int pipeline_process_iq(Pipeline *pipeline, float *i_samples, float *q_samples, int num_samples);
+int pipeline_process_staged(Pipeline *pipeline, uint8_t *block, int len);
+int pipeline_process_fused(Pipeline *pipeline, uint8_t *block, int len);
+
+#endif
@@ -0,0 +1,243 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "dsp.h"
+#include "pool.h"
+
+// Pin the calling thread to the index-th core it may run on, wrapping around
+// when there are more workers than cores. Elsewhere than on Linux the
+// scheduler places the workers.
+static void pin_worker(int index) {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) return;
+
+    int target = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed) || target-- > 0) continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        return;
+    }
+#endif
+}
+
+// Run the tasks of this worker for each job, until the pool is stopped.
+static void *pool_worker(void *arg) {
+    PoolWorker *worker = arg;
+    WorkerPool *pool = worker->pool;
+    uint64_t seen = 0;
+
+    pin_worker(worker->index);
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->stop) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop) break;
+        seen = pool->generation;
+        PoolTask task = pool->task;
+        void *context = pool->context;
+        int num_tasks = pool->num_tasks;
+        pthread_mutex_unlock(&pool->lock);
+
+        int k = worker->index;
+        while (k < num_tasks) {
+            task(context, k, worker->index);
+            k = atomic_fetch_add_explicit(&pool->next_task, 1, memory_order_relaxed);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Start num_threads pinned workers. Returns 0 on success and -1 on failure.
+int pool_init(WorkerPool *pool, int num_threads, int metrics_enabled) {
+    memset(pool, 0, sizeof(WorkerPool));
+    if (num_threads < 1 || num_threads > POOL_MAX_THREADS) return -1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int t = 0; t < num_threads; t++) {
+        // Aligned so that the metrics of two workers never share a cache line.
+        PoolWorker *worker = alloc_aligned(sizeof(PoolWorker));
+        if (worker == NULL) {
+            pool_free(pool);
+            return -1;
+        }
+        worker->pool = pool;
+        worker->index = t;
+        metrics_init(&worker->metrics, metrics_enabled);
+        if (pthread_create(&worker->thread, NULL, pool_worker, worker) != 0) {
+            free(worker);
+            pool_free(pool);
+            return -1;
+        }
+        pool->workers[pool->num_threads++] = worker;
+    }
+    return 0;
+}
+
+// Stop the workers and wait for them to exit.
+void pool_free(WorkerPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int t = 0; t < pool->num_threads; t++) {
+        pthread_join(pool->workers[t]->thread, NULL);
+        free(pool->workers[t]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    memset(pool, 0, sizeof(WorkerPool));
+}
+
+// Run task for tasks 0 to num_tasks - 1, task t on worker t and the others
+// on whichever worker is free first, and wait until all of them are done.
+void pool_run(WorkerPool *pool, PoolTask task, void *context, int num_tasks) {
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->num_tasks = num_tasks;
+    atomic_store_explicit(&pool->next_task, pool->num_threads, memory_order_relaxed);
+    pool->pending = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Allocate the pipeline of channel k on the worker that will run it.
+static void channel_init_task(void *context, int k, int worker) {
+    ChannelPool *channels = context;
+    Pipeline *pipeline = alloc_aligned(sizeof(Pipeline));
+
+    if (pipeline != NULL && pipeline_init_channel(pipeline, &channels->config, channels->sample_rate,
+                channels->max_samples) < 0) {
+        free(pipeline);
+        pipeline = NULL;
+    }
+    if (pipeline != NULL) pipeline->metrics = &channels->pool.workers[worker]->metrics;
+    channels->pipelines[k] = pipeline;
+}
+
+// Task part counts the parts of all the channelizers, one after the other.
+static void channelize_task(void *context, int part, int worker) {
+    ChannelPool *channels = context;
+
+    for (int c = 0; c < channels->num_channelizers; c++) {
+        Channelizer *channelizer = channels->channelizers[c];
+        if (part < channelizer->num_parts) {
+            channelizer_process_part(channelizer, part);
+            return;
+        }
+        part -= channelizer->num_parts;
+    }
+}
+
+static void channel_process_task(void *context, int k, int worker) {
+    ChannelPool *channels = context;
+
+    channels->counts[k] = 0;
+    if (channels->lens[k] == 0) return;
+    channels->counts[k] = pipeline_process_iq(channels->pipelines[k], channels->in_i[k], channels->in_q[k],
+            channels->lens[k]);
+}
+
+// Start num_threads workers and allocate a pipeline for each of num_channels
+// channels at sample_rate, receiving at most max_samples IQ samples per block.
+// Returns 0 on success and -1 on failure.
+int channel_pool_init(ChannelPool *channels, const PipelineConfig *config, int num_channels,
+        int sample_rate, int max_samples, int num_threads, int metrics_enabled) {
+    memset(channels, 0, sizeof(ChannelPool));
+    channels->num_channels = num_channels;
+    channels->config = *config;
+    channels->sample_rate = sample_rate;
+    channels->max_samples = max_samples;
+    channels->pipelines = calloc(num_channels, sizeof(Pipeline *));
+    channels->counts = calloc(num_channels, sizeof(int));
+    if (channels->pipelines == NULL || channels->counts == NULL) {
+        free(channels->pipelines);
+        free(channels->counts);
+        return -1;
+    }
+    if (pool_init(&channels->pool, num_threads, metrics_enabled) < 0) {
+        free(channels->pipelines);
+        free(channels->counts);
+        return -1;
+    }
+
+    pool_run(&channels->pool, channel_init_task, channels, num_channels);
+    for (int k = 0; k < num_channels; k++) {
+        if (channels->pipelines[k] == NULL) {
+            channel_pool_free(channels);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void channel_pool_free(ChannelPool *channels) {
+    pool_free(&channels->pool);
+    for (int k = 0; k < channels->num_channels; k++) {
+        if (channels->pipelines[k] == NULL) continue;
+        pipeline_free(channels->pipelines[k]);
+        free(channels->pipelines[k]);
+    }
+    free(channels->pipelines);
+    free(channels->counts);
+    memset(channels, 0, sizeof(ChannelPool));
+}
+
+// Compute the parts of the current block of num_channelizers channelizers,
+// all of them in parallel. channelizer_begin() must have been called on each
+// one, and channelizer_end() must be called afterwards.
+void channel_pool_channelize(ChannelPool *channels, Channelizer **channelizers, int num_channelizers) {
+    int num_parts = 0;
+
+    for (int c = 0; c < num_channelizers; c++) num_parts += channelizers[c]->num_parts;
+    channels->channelizers = channelizers;
+    channels->num_channelizers = num_channelizers;
+    pool_run(&channels->pool, channelize_task, channels, num_parts);
+}
+
+// Demodulate the next lens[k] IQ samples of every channel, in_i[k] and
+// in_q[k] for channel k, in parallel. The WAV samples of channel k are then in
+// the int_samples of pipelines[k], counts[k] of them.
+void channel_pool_process(ChannelPool *channels, float **in_i, float **in_q, const int *lens) {
+    channels->in_i = in_i;
+    channels->in_q = in_q;
+    channels->lens = lens;
+    pool_run(&channels->pool, channel_process_task, channels, channels->num_channels);
+}
+
+// Add the stages recorded by the workers to metrics. The workers are idle
+// between two blocks, their metrics can be read without locking.
+void channel_pool_merge_metrics(ChannelPool *channels, Metrics *metrics) {
+    WorkerPool *pool = &channels->pool;
+
+    for (int t = 0; t < pool->num_threads; t++) {
+        for (int s = 0; s < METRIC_NUM_STAGES; s++) {
+            latency_merge(&metrics->stages[s], &pool->workers[t]->metrics.stages[s]);
+        }
+    }
+}
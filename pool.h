@@ -0,0 +1,92 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "channelizer.h"
+#include "metrics.h"
+#include "pipeline.h"
+
+// Worker threads demodulating the channels of the channelizer in parallel.
+//
+// Every block is split by channel. Worker t first runs task t, then claims
+// the next task nobody took yet, so that a worker done early takes over the
+// remaining tasks instead of waiting for the slowest one. Each worker is
+// pinned to its own core. The pipeline of channel k is allocated by worker k
+// when there are enough workers, so that with as many workers as channels its
+// filters and working buffers are first touched, and stay, in the caches (and
+// on the memory node) of the core running it. The outputs of the channelizer
+// are split the same way, one part per worker, before the channels are
+// demodulated. The thread reading the samples hands the block to the workers
+// and waits for all of them, then writes the audio; as the channels and the
+// outputs of the channelizer are independent the audio is the same as with a
+// single thread.
+//
+// Each worker records the latency of its stages in a Metrics of its own,
+// merged into the metrics of the main loop when they are reported.
+
+// Largest number of worker threads.
+#define POOL_MAX_THREADS 64
+
+typedef void (*PoolTask)(void *context, int task, int worker);
+
+struct WorkerPool;
+
+typedef struct {
+    struct WorkerPool *pool;
+    int index;
+    pthread_t thread;
+    Metrics metrics;            // Stages run by this worker
+} PoolWorker;
+
+typedef struct WorkerPool {
+    int num_threads;
+    PoolWorker *workers[POOL_MAX_THREADS];
+
+    // Current job, protected by lock. Workers wait for generation to change,
+    // and the last one to finish signals done.
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    int pending;
+    int stop;
+    PoolTask task;
+    void *context;
+    int num_tasks;
+    _Atomic int next_task;      // Next task after the first one of each worker
+} WorkerPool;
+
+// Pipelines of the selected channels, each one owned by a worker. A single
+// pool serves the channels of every receiver, so that no two workers share a
+// core and the captures are processed concurrently.
+typedef struct {
+    WorkerPool pool;
+    int num_channels;
+    Pipeline **pipelines;       // Allocated by their workers, NULL on failure
+    PipelineConfig config;
+    int sample_rate;
+    int max_samples;
+
+    // Input of the current block.
+    Channelizer **channelizers;
+    int num_channelizers;
+    float **in_i;
+    float **in_q;
+    const int *lens;            // IQ samples of each channel, 0 to skip it
+    int *counts;                // WAV samples of each channel, in pipelines[k]->int_samples
+} ChannelPool;
+
+int pool_init(WorkerPool *pool, int num_threads, int metrics_enabled);
+void pool_free(WorkerPool *pool);
+void pool_run(WorkerPool *pool, PoolTask task, void *context, int num_tasks);
+
+int channel_pool_init(ChannelPool *channels, const PipelineConfig *config, int num_channels,
+        int sample_rate, int max_samples, int num_threads, int metrics_enabled);
+void channel_pool_free(ChannelPool *channels);
+void channel_pool_channelize(ChannelPool *channels, Channelizer **channelizers, int num_channelizers);
+void channel_pool_process(ChannelPool *channels, float **in_i, float **in_q, const int *lens);
+void channel_pool_merge_metrics(ChannelPool *channels, Metrics *metrics);
+
+#endif
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "receiver.h"
+
+// Allocate the pipelines of the receiver for blocks of at most block_size
+// bytes: one per station, or a single one writing to path. With num_threads
+// workers the pipelines of the stations are allocated by
+// receivers_start_workers() instead. The source, the center frequency and the
+// stations must already be set. Returns 0 on success and -1 on failure.
+int receiver_init(Receiver *receiver, const PipelineConfig *config, int block_size, int num_threads,
+        Metrics *metrics, const char *path) {
+    int result = 0;
+
+    receiver->num_threads = receiver->num_stations > 0 ? num_threads : 0;
+    receiver->channel_pool = NULL;
+    receiver->first_channel = 0;
+    receiver->num_outputs = receiver->num_stations > 0 ? receiver->num_stations : 1;
+    receiver->pipelines = calloc(receiver->num_outputs, sizeof(Pipeline));
+    receiver->active = calloc(receiver->num_outputs, sizeof(Pipeline *));
+    receiver->outputs = calloc(receiver->num_outputs, sizeof(WavOutput));
+    receiver->paths = calloc(receiver->num_outputs, sizeof(*receiver->paths));
+    receiver->bytes_count = 0;
+    receiver->steady_allocations = 0;
+    receiver->done = 0;
+    if (receiver->pipelines == NULL || receiver->active == NULL || receiver->outputs == NULL ||
+            receiver->paths == NULL) {
+        return -1;
+    }
+
+    // With worker threads the filter bank is split in a part per worker.
+    if (receiver->num_stations > 0) {
+        result = channelizer_init(&receiver->channelizer, receiver->bins, receiver->num_stations, block_size / 2,
+                receiver->num_threads > 0 ? receiver->num_threads : 1);
+        for (int k = 0; k < receiver->num_stations && result == 0; k++) {
+            if (receiver->num_threads == 0) {
+                receiver->active[k] = &receiver->pipelines[k];
+                result = pipeline_init_channel(receiver->active[k], config, CHANNEL_RATE,
+                        channelizer_max_output(&receiver->channelizer));
+            }
+            snprintf(receiver->paths[k], RECEIVER_PATH_SIZE, "station_%g.wav", receiver->stations[k]);
+        }
+    } else {
+        receiver->active[0] = &receiver->pipelines[0];
+        result = pipeline_init(receiver->active[0], config, block_size);
+        snprintf(receiver->paths[0], RECEIVER_PATH_SIZE, "%s", path);
+    }
+    if (result < 0) return -1;
+
+    // The workers record the stages of their pipelines on their own, they are
+    // merged before printing.
+    if (receiver->num_threads == 0) {
+        for (int k = 0; k < receiver->num_outputs; k++) receiver->active[k]->metrics = metrics;
+    }
+    return 0;
+}
+
+// Start num_threads workers shared by the receivers, which all record
+// stations, each worker allocating the pipelines of the stations it starts
+// with: the stations of all the receivers are numbered one after the other.
+// Returns 0 on success and -1 on failure.
+int receivers_start_workers(Receiver *receivers, int num_receivers, ChannelPool *channel_pool,
+        const PipelineConfig *config, int num_threads, Metrics *metrics) {
+    int num_channels = 0;
+
+    for (int r = 0; r < num_receivers; r++) {
+        receivers[r].first_channel = num_channels;
+        num_channels += receivers[r].num_stations;
+    }
+    if (channel_pool_init(channel_pool, config, num_channels, CHANNEL_RATE,
+                channelizer_max_output(&receivers[0].channelizer), num_threads, metrics->enabled) < 0) {
+        return -1;
+    }
+    for (int r = 0; r < num_receivers; r++) {
+        Receiver *receiver = &receivers[r];
+        receiver->channel_pool = channel_pool;
+        for (int k = 0; k < receiver->num_stations; k++) {
+            receiver->active[k] = channel_pool->pipelines[receiver->first_channel + k];
+        }
+    }
+    return 0;
+}
+
+// Create the WAV files of the receiver. Returns 0 on success and -1 on failure.
+int receiver_open_outputs(Receiver *receiver, Writer *writer) {
+    for (int k = 0; k < receiver->num_outputs; k++) {
+        if (wav_output_open(&receiver->outputs[k], writer, receiver->paths[k]) < 0) {
+            fprintf(stderr, "Failed to create %s.\n", receiver->paths[k]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Hand the audio of the current block of the receiver to the writer, counts[k]
+// samples for output k. Returns 0 on success and -1 if a write failed.
+static int receiver_write(Receiver *receiver, const int *counts, Metrics *metrics) {
+    uint64_t allocations = dsp_allocation_count();
+
+    for (int k = 0; k < receiver->num_outputs; k++) {
+        uint64_t start = metrics_start(metrics);
+        if (wav_output_write(&receiver->outputs[k], receiver->active[k]->int_samples, counts[k]) < 0) {
+            fprintf(stderr, "An error occurred while writing %s.\n", receiver->paths[k]);
+            return -1;
+        }
+        metrics_stop(metrics, METRIC_WRITE, start);
+    }
+    receiver->steady_allocations += dsp_allocation_count() - allocations;
+    return 0;
+}
+
+// Demodulate a block of len bytes of IQ samples of a receiver without worker
+// threads and hand the audio to the writer. Returns 0 on success and -1 if a
+// write failed.
+int receiver_process(Receiver *receiver, uint8_t *block, int len, Metrics *metrics) {
+    int counts[CHANNELIZER_NUM_CHANNELS];
+
+    // Split the stations into their channels.
+    int channel_len = 0;
+    if (receiver->num_stations > 0) {
+        uint64_t allocations = dsp_allocation_count();
+        uint64_t start = metrics_start(metrics);
+        channel_len = channelizer_process(&receiver->channelizer, block, len);
+        metrics_stop(metrics, METRIC_CHANNELIZE, start);
+        receiver->steady_allocations += dsp_allocation_count() - allocations;
+    }
+
+    // FM signal handling and frequency conversion into WAV data.
+    for (int k = 0; k < receiver->num_outputs; k++) {
+        if (receiver->num_stations > 0) {
+            counts[k] = pipeline_process_iq(receiver->active[k], receiver->channelizer.out_i[k],
+                    receiver->channelizer.out_q[k], channel_len);
+        } else {
+            counts[k] = pipeline_process(receiver->active[k], block, len);
+        }
+    }
+    if (receiver_write(receiver, counts, metrics) < 0) return -1;
+
+    receiver->bytes_count += len;
+    return 0;
+}
+
+// Demodulate the next block of every receiver, blocks[r] of lens[r] bytes or
+// none if lens[r] is 0, and hand the audio to the writer. With worker threads
+// the filter banks of all the receivers are split between the workers in a
+// single round, then all their stations in another one, and the audio is
+// written once all of them are done. Returns 0 on success and -1 if a write
+// failed.
+int receivers_process(Receiver *receivers, int num_receivers, uint8_t **blocks, const int *lens, Metrics *metrics) {
+    ChannelPool *channel_pool = receivers[0].channel_pool;
+    Channelizer *channelizers[MAX_RECEIVERS];
+    int channel_lens[MAX_RECEIVERS];
+    int num_channelizers = 0;
+
+    if (channel_pool == NULL) {
+        for (int r = 0; r < num_receivers; r++) {
+            if (lens[r] > 0 && receiver_process(&receivers[r], blocks[r], lens[r], metrics) < 0) return -1;
+        }
+        return 0;
+    }
+
+    uint64_t start = metrics_start(metrics);
+    for (int r = 0; r < num_receivers; r++) {
+        channel_lens[r] = 0;
+        if (lens[r] == 0) continue;
+        channel_lens[r] = channelizer_begin(&receivers[r].channelizer, blocks[r], lens[r]);
+        channelizers[num_channelizers++] = &receivers[r].channelizer;
+    }
+    channel_pool_channelize(channel_pool, channelizers, num_channelizers);
+    for (int c = 0; c < num_channelizers; c++) channelizer_end(channelizers[c]);
+    metrics_stop(metrics, METRIC_CHANNELIZE, start);
+
+    // The workers demodulate the stations of every receiver at once.
+    float *in_i[MAX_RECEIVERS * CHANNELIZER_NUM_CHANNELS];
+    float *in_q[MAX_RECEIVERS * CHANNELIZER_NUM_CHANNELS];
+    int in_lens[MAX_RECEIVERS * CHANNELIZER_NUM_CHANNELS];
+    for (int r = 0; r < num_receivers; r++) {
+        Receiver *receiver = &receivers[r];
+        for (int k = 0; k < receiver->num_stations; k++) {
+            in_i[receiver->first_channel + k] = receiver->channelizer.out_i[k];
+            in_q[receiver->first_channel + k] = receiver->channelizer.out_q[k];
+            in_lens[receiver->first_channel + k] = channel_lens[r];
+        }
+    }
+    channel_pool_process(channel_pool, in_i, in_q, in_lens);
+
+    for (int r = 0; r < num_receivers; r++) {
+        if (lens[r] == 0) continue;
+        if (receiver_write(&receivers[r], channel_pool->counts + receivers[r].first_channel, metrics) < 0) return -1;
+        receivers[r].bytes_count += lens[r];
+    }
+    return 0;
+}
+
+// Heap allocations made while processing, by the pipelines of the receiver on
+// whichever thread runs them, by its channelizer and by its writes.
+uint64_t receiver_steady_allocations(const Receiver *receiver) {
+    uint64_t allocations = receiver->steady_allocations;
+    for (int k = 0; k < receiver->num_outputs; k++) allocations += receiver->active[k]->steady_allocations;
+    return allocations;
+}
+
+// Replace the stages recorded by the workers of the receivers in metrics with
+// their sum over all the workers.
+void receivers_collect_metrics(Receiver *receivers, int num_receivers, Metrics *metrics) {
+    Metrics pooled;
+
+    // The workers are shared by all the receivers.
+    if (num_receivers == 0 || receivers[0].channel_pool == NULL) return;
+    metrics_init(&pooled, 1);
+    channel_pool_merge_metrics(receivers[0].channel_pool, &pooled);
+    for (int s = 0; s < METRIC_NUM_STAGES; s++) {
+        if (pooled.stages[s].count > 0) metrics->stages[s] = pooled.stages[s];
+    }
+}
+
+// Close the source, free the pipelines and complete the WAV files.
+// Returns 0 on success and -1 if a write failed.
+int receiver_close(Receiver *receiver) {
+    int result = 0;
+
+    source_close(&receiver->source);
+    if (receiver->num_stations > 0) channelizer_free(&receiver->channelizer);
+    // The pipelines of the workers are freed with their pool.
+    if (receiver->num_threads == 0) {
+        for (int k = 0; k < receiver->num_outputs; k++) pipeline_free(receiver->active[k]);
+    }
+
+    for (int k = 0; k < receiver->num_outputs; k++) {
+        if (wav_output_close(&receiver->outputs[k]) < 0) {
+            fprintf(stderr, "An error occurred while writing %s.\n", receiver->paths[k]);
+            result = -1;
+        }
+    }
+    free(receiver->pipelines);
+    free(receiver->active);
+    free(receiver->outputs);
+    free(receiver->paths);
+    return result;
+}
@@ -0,0 +1,67 @@
+#ifndef RECEIVER_H
+#define RECEIVER_H
+
+#include <stdint.h>
+
+#include "channelizer.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "source.h"
+#include "writer.h"
+
+// A capture, from a dongle or from an IQ file standing in for one, together
+// with the demodulation chains of what is recorded from it: the station at
+// its center frequency, or several stations through the channelizer.
+//
+// Several receivers run in one process to cover more spectrum than a single
+// dongle. Each one has its own source, with its own capture thread for the
+// dongles, and its own pipelines, while the writer, the metrics and the
+// worker threads are shared by all of them. The main loop reads a block from
+// every receiver in turn, then processes them together: the dongles stream
+// at the same rate, and the asynchronous ring of each one absorbs the time
+// spent on the others. With worker threads the filter banks of all the
+// receivers are computed in one round, then all their stations in another,
+// so the captures are processed concurrently on all the cores.
+#define MAX_RECEIVERS 8
+#define RECEIVER_PATH_SIZE 64
+
+typedef struct {
+    const char *device;         // Index or serial number of the dongle, or NULL
+    const char *iq_path;        // IQ file standing in for the dongle, or NULL
+    double center_freq;         // MHz
+    SampleSource source;
+
+    // Stations recorded through the channelizer, none to record center_freq.
+    int num_stations;
+    double stations[CHANNELIZER_NUM_CHANNELS];
+    int bins[CHANNELIZER_NUM_CHANNELS];
+    Channelizer channelizer;
+    int num_threads;            // Workers demodulating the stations, 0 for none
+    ChannelPool *channel_pool;  // Shared by the receivers, NULL without workers
+    int first_channel;          // Channel of the first station in channel_pool
+
+    // One output per station, or a single one for center_freq.
+    int num_outputs;
+    Pipeline *pipelines;
+    Pipeline **active;          // Pipeline of each output
+    WavOutput *outputs;
+    char (*paths)[RECEIVER_PATH_SIZE];
+
+    long long bytes_count;      // IQ bytes processed so far
+    uint64_t steady_allocations; // Made by the channelizer and the writes
+    int done;                   // End of the stream or of the recording
+} Receiver;
+
+int receiver_init(Receiver *receiver, const PipelineConfig *config, int block_size, int num_threads,
+        Metrics *metrics, const char *path);
+int receiver_open_outputs(Receiver *receiver, Writer *writer);
+int receivers_start_workers(Receiver *receivers, int num_receivers, ChannelPool *channel_pool,
+        const PipelineConfig *config, int num_threads, Metrics *metrics);
+int receiver_process(Receiver *receiver, uint8_t *block, int len, Metrics *metrics);
+int receivers_process(Receiver *receivers, int num_receivers, uint8_t **blocks, const int *lens, Metrics *metrics);
+uint64_t receiver_steady_allocations(const Receiver *receiver);
+void receivers_collect_metrics(Receiver *receivers, int num_receivers, Metrics *metrics);
+int receiver_close(Receiver *receiver);
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+// Allocate the ring storage up front, so that the producer never has to
+// allocate memory while samples are streaming.
+// num_blocks must be a power of two. Returns 0 on success and -1 on failure.
+int ring_init(RingBuffer *ring, size_t num_blocks, size_t block_size) {
+    if (num_blocks == 0 || (num_blocks & (num_blocks - 1)) != 0) return -1;
+
+    void *blocks = NULL;
+    if (posix_memalign(&blocks, CACHE_LINE_SIZE, num_blocks * block_size) != 0) {
+        return -1;
+    }
+
+    ring->lengths = calloc(num_blocks, sizeof(uint32_t));
+    if (ring->lengths == NULL) {
+        free(blocks);
+        return -1;
+    }
+
+    ring->blocks = blocks;
+    ring->block_size = block_size;
+    ring->num_blocks = num_blocks;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->overruns, 0);
+
+    return 0;
+}
+
+void ring_free(RingBuffer *ring) {
+    free(ring->blocks);
+    free(ring->lengths);
+    ring->blocks = NULL;
+    ring->lengths = NULL;
+}
+
+// Copy a block of data into the ring. Must only be called by the producer.
+// If the consumer has not released enough blocks the data is dropped and the
+// overrun counter is incremented. Returns 1 if the block was stored, 0 if it
+// was dropped.
+int ring_push(RingBuffer *ring, const uint8_t *data, uint32_t len) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail == ring->num_blocks) {
+        atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    if (len > ring->block_size) len = ring->block_size;
+
+    size_t slot = head & (ring->num_blocks - 1);
+    memcpy(ring->blocks + slot * ring->block_size, data, len);
+    ring->lengths[slot] = len;
+
+    // Publish the block only after its content has been written.
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+// Return the oldest block that has not been released yet, or NULL if the ring
+// is empty. Must only be called by the consumer. The block stays valid until
+// ring_release() is called.
+uint8_t *ring_peek(RingBuffer *ring, uint32_t *len) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail) return NULL;
+
+    size_t slot = tail & (ring->num_blocks - 1);
+    *len = ring->lengths[slot];
+    return ring->blocks + slot * ring->block_size;
+}
+
+// Hand the block returned by ring_peek() back to the producer.
+void ring_release(RingBuffer *ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+uint64_t ring_overruns(RingBuffer *ring) {
+    return atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+}
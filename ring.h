@@ -0,0 +1,40 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of a cache line. Producer and consumer indexes are kept on different
+// lines so that the two threads never write to the same line.
+#define CACHE_LINE_SIZE 64
+
+// Lock-free single-producer/single-consumer ring of fixed-size blocks.
+//
+// The producer (the librtlsdr async callback) copies each USB transfer into
+// the next free block, while the consumer (the DSP thread) processes blocks in
+// order and hands them back. Neither side ever takes a lock or waits for the
+// other: when the ring is full the producer drops the incoming block and
+// counts an overrun instead of stalling the USB transfers.
+//
+// The indexes grow monotonically and are reduced modulo num_blocks (a power of
+// two) when accessing the slots, so head == tail means empty and
+// head - tail == num_blocks means full.
+typedef struct {
+    uint8_t *blocks;            // num_blocks * block_size bytes
+    uint32_t *lengths;          // Number of valid bytes in each block
+    size_t block_size;
+    size_t num_blocks;
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t head;     // Written by producer
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t tail;     // Written by consumer
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t overruns;
+} RingBuffer;
+
+int ring_init(RingBuffer *ring, size_t num_blocks, size_t block_size);
+void ring_free(RingBuffer *ring);
+int ring_push(RingBuffer *ring, const uint8_t *data, uint32_t len);
+uint8_t *ring_peek(RingBuffer *ring, uint32_t *len);
+void ring_release(RingBuffer *ring);
+uint64_t ring_overruns(RingBuffer *ring);
+
+#endif
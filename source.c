@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rtl-sdr.h"
+#include "ring.h"
+#include "source.h"
+
+// Asynchronous capture configuration.
+// The USB transfers used by librtlsdr have the same size as a block, so that
+// each callback fills exactly one block of the ring. The ring holds about
+// ASYNC_RING_SECONDS of IQ samples, whatever the block size, which is enough
+// to absorb long stalls in the DSP or in the disk writes.
+#define ASYNC_USB_BUFFERS 15
+#define ASYNC_RING_SECONDS 4
+#define ASYNC_RING_MIN_BLOCKS 4
+// Time the DSP thread sleeps when the ring is empty. With the default block
+// size a new block arrives every ~136 ms, so polling every millisecond adds no
+// noticeable latency.
+#define ASYNC_POLL_NS 1000000
+
+// State of a source reading from an RTL-SDR dongle.
+typedef struct {
+    rtlsdr_dev_t *sdr;
+    size_t block_size;
+    uint32_t sample_rate;
+    uint8_t *buffer;            // Destination of rtlsdr_read_sync
+
+    // Asynchronous capture, shared with the capture thread.
+    int async;
+    RingBuffer ring;
+    pthread_t thread;
+    atomic_int done;            // Set when rtlsdr_read_async has returned
+    int result;                 // Return value of rtlsdr_read_async
+    int holding;                // The consumer holds the oldest ring block
+} RtlSdrSource;
+
+// State of a source reading from a file of raw IQ samples.
+typedef struct {
+    size_t block_size;
+    // Buffered reads.
+    FILE *file;
+    uint8_t *buffer;
+    // Memory mapped reads.
+    uint8_t *map;
+    size_t map_size;
+    size_t offset;
+} IqFileSource;
+
+// Callback invoked by librtlsdr for every completed USB transfer.
+// It runs on the capture thread, so it must never block: it only copies the
+// samples into the ring, dropping them if the DSP thread fell too far behind.
+void async_capture_callback(unsigned char *buf, uint32_t len, void *ctx) {
+    RtlSdrSource *state = ctx;
+    ring_push(&state->ring, buf, len);
+}
+
+// Body of the capture thread. rtlsdr_read_async blocks until
+// rtlsdr_cancel_async is called or an error occurs.
+void *async_capture_thread(void *arg) {
+    RtlSdrSource *state = arg;
+
+    state->result = rtlsdr_read_async(
+            state->sdr, async_capture_callback, state, ASYNC_USB_BUFFERS, state->block_size
+    );
+    atomic_store(&state->done, 1);
+
+    return NULL;
+}
+
+// Start the capture thread. Returns 0 on success and -1 on failure.
+int async_capture_start(RtlSdrSource *state) {
+    state->result = 0;
+    state->holding = 0;
+    atomic_init(&state->done, 0);
+
+    // The ring needs a power of two number of blocks.
+    size_t ring_bytes = (size_t)ASYNC_RING_SECONDS * state->sample_rate * 2;
+    size_t num_blocks = ASYNC_RING_MIN_BLOCKS;
+    while (num_blocks * state->block_size < ring_bytes) num_blocks *= 2;
+
+    if (ring_init(&state->ring, num_blocks, state->block_size) < 0) {
+        return -1;
+    }
+
+    if (pthread_create(&state->thread, NULL, async_capture_thread, state) != 0) {
+        ring_free(&state->ring);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Stop the capture thread and release the ring.
+void async_capture_stop(RtlSdrSource *state) {
+    rtlsdr_cancel_async(state->sdr);
+    pthread_join(state->thread, NULL);
+    ring_free(&state->ring);
+}
+
+// Return the next captured block, waiting for it if the ring is empty.
+// The block handed out by the previous call goes back to the capture thread.
+int rtlsdr_source_read_async(RtlSdrSource *state, uint8_t **block) {
+    const struct timespec poll_interval = { 0, ASYNC_POLL_NS };
+    uint32_t len = 0;
+
+    if (state->holding) {
+        ring_release(&state->ring);
+        state->holding = 0;
+    }
+
+    for (;;) {
+        *block = ring_peek(&state->ring, &len);
+        if (*block != NULL) {
+            state->holding = 1;
+            return len & ~1u;
+        }
+        if (atomic_load(&state->done)) return state->result < 0 ? -1 : 0;
+        nanosleep(&poll_interval, NULL);
+    }
+}
+
+int rtlsdr_source_read(SampleSource *source, uint8_t **block) {
+    RtlSdrSource *state = source->state;
+
+    if (state->async) return rtlsdr_source_read_async(state, block);
+
+    int read_bytes = 0;
+    if (rtlsdr_read_sync(state->sdr, state->buffer, state->block_size, &read_bytes) < 0) {
+        return -1;
+    }
+
+    *block = state->buffer;
+    return read_bytes & ~1;
+}
+
+// Blocks the capture thread dropped because the ring was full. Synchronous
+// reads cannot tell, their losses show up as a lag behind the wall clock.
+uint64_t rtlsdr_source_dropped(SampleSource *source) {
+    RtlSdrSource *state = source->state;
+    return state->async ? ring_overruns(&state->ring) : 0;
+}
+
+void rtlsdr_source_close(SampleSource *source) {
+    RtlSdrSource *state = source->state;
+
+    if (state->async) async_capture_stop(state);
+
+    rtlsdr_close(state->sdr);
+    free(state->buffer);
+    free(state);
+}
+
+// Index of the dongle with the given serial number or, failing that, with the
+// given index. Returns -1 if there is no such dongle.
+int source_find_rtlsdr(const char *device) {
+    int index = rtlsdr_get_index_by_serial(device);
+    if (index >= 0) return index;
+
+    char *end;
+    long value = strtol(device, &end, 10);
+    if (end == device || *end != '\0' || value < 0 || value >= (long)rtlsdr_get_device_count()) return -1;
+    return (int)value;
+}
+
+// Open and configure the dongle with the given index. If async is non-zero
+// samples are captured by a dedicated thread through rtlsdr_read_async, so
+// that USB transfers never wait for the processing.
+// Returns 0 on success and -1 on failure.
+int source_open_rtlsdr(SampleSource *source, uint32_t index, uint32_t center_freq,
+        uint32_t sample_rate, size_t block_size, int async) {
+    RtlSdrSource *state = calloc(1, sizeof(RtlSdrSource));
+    if (state == NULL) return -1;
+
+    state->block_size = block_size;
+    state->sample_rate = sample_rate;
+    state->async = async;
+
+    if (rtlsdr_open(&state->sdr, index) < 0) {
+        fprintf(stderr, "Failed to open SDR device %u.\n", index);
+        free(state);
+        return -1;
+    }
+
+    rtlsdr_set_center_freq(state->sdr, center_freq);
+    rtlsdr_set_sample_rate(state->sdr, sample_rate);
+    rtlsdr_set_tuner_gain_mode(state->sdr, 0);
+    rtlsdr_reset_buffer(state->sdr);
+
+    if (async) {
+        if (async_capture_start(state) < 0) {
+            fprintf(stderr, "Failed to start asynchronous capture.\n");
+            rtlsdr_close(state->sdr);
+            free(state);
+            return -1;
+        }
+    } else {
+        state->buffer = malloc(block_size);
+        if (state->buffer == NULL) {
+            rtlsdr_close(state->sdr);
+            free(state);
+            return -1;
+        }
+    }
+
+    source->read = rtlsdr_source_read;
+    source->close = rtlsdr_source_close;
+    source->dropped = rtlsdr_source_dropped;
+    source->realtime = 1;
+    source->state = state;
+    return 0;
+}
+
+int iq_file_source_read(SampleSource *source, uint8_t **block) {
+    IqFileSource *state = source->state;
+
+    if (state->map != NULL) {
+        // Hand out blocks directly from the mapping, without any copy.
+        size_t len = state->map_size - state->offset;
+        if (len > state->block_size) len = state->block_size;
+
+        *block = state->map + state->offset;
+        state->offset += len;
+        return len & ~1u;
+    }
+
+    size_t len = fread(state->buffer, 1, state->block_size, state->file);
+    if (len < state->block_size && ferror(state->file)) return -1;
+
+    *block = state->buffer;
+    return len & ~1u;
+}
+
+void iq_file_source_close(SampleSource *source) {
+    IqFileSource *state = source->state;
+
+    if (state->map != NULL) munmap(state->map, state->map_size);
+    if (state->file != NULL && state->file != stdin) fclose(state->file);
+    free(state->buffer);
+    free(state);
+}
+
+// Map the whole file in memory. Returns 0 on success and -1 on failure.
+int iq_file_map(IqFileSource *state, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    // The file is read front to back exactly once, so ask the kernel for an
+    // aggressive read-ahead.
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    state->map = map;
+    state->map_size = st.st_size;
+    state->offset = 0;
+    return 0;
+}
+
+// Open a file of raw IQ samples, such as the ones recorded with rtl_sdr.
+// The path "-" reads from the standard input. If use_mmap is non-zero the
+// file is memory mapped and blocks are handed out without copying them, which
+// lets large captures stream through the DSP at memory speed.
+// Returns 0 on success and -1 on failure.
+int source_open_iq_file(SampleSource *source, const char *path, size_t block_size, int use_mmap) {
+    IqFileSource *state = calloc(1, sizeof(IqFileSource));
+    if (state == NULL) return -1;
+
+    state->block_size = block_size;
+
+    if (use_mmap && strcmp(path, "-") != 0) {
+        if (iq_file_map(state, path) < 0) {
+            fprintf(stderr, "Failed to map IQ file %s.\n", path);
+            free(state);
+            return -1;
+        }
+    } else {
+        state->file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+        state->buffer = malloc(block_size);
+        if (state->file == NULL || state->buffer == NULL) {
+            fprintf(stderr, "Failed to open IQ file %s.\n", path);
+            if (state->file != NULL && state->file != stdin) fclose(state->file);
+            free(state->buffer);
+            free(state);
+            return -1;
+        }
+    }
+
+    source->read = iq_file_source_read;
+    source->close = iq_file_source_close;
+    source->dropped = NULL;
+    source->realtime = 0;
+    source->state = state;
+    return 0;
+}
+
+int source_read(SampleSource *source, uint8_t **block) {
+    return source->read(source, block);
+}
+
+uint64_t source_dropped_blocks(SampleSource *source) {
+    return source->dropped != NULL ? source->dropped(source) : 0;
+}
+
+void source_close(SampleSource *source) {
+    source->close(source);
+}
@@ -0,0 +1,37 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Generic source of interleaved uint8 IQ samples (I0, Q0, I1, Q1, ...), the
+// same format produced by the dongle and written to disk by rtl_sdr.
+//
+// Samples are delivered one block at a time: source_read() stores a pointer
+// to the next block in *block and returns its size in bytes. The block is
+// owned by the source and stays valid until the next call to source_read() or
+// source_close(). Blocks are never larger than the block size given when the
+// source was opened, and always contain an even number of bytes.
+typedef struct SampleSource {
+    // Returns the number of bytes in the block, 0 at the end of the stream
+    // and -1 on error.
+    int (*read)(struct SampleSource *source, uint8_t **block);
+    void (*close)(struct SampleSource *source);
+    // Number of blocks dropped because the consumer did not keep up, NULL if
+    // the source never drops samples.
+    uint64_t (*dropped)(struct SampleSource *source);
+    // Non-zero if the source produces samples in real time (i.e. a dongle).
+    int realtime;
+    void *state;
+} SampleSource;
+
+int source_find_rtlsdr(const char *device);
+int source_open_rtlsdr(SampleSource *source, uint32_t index, uint32_t center_freq,
+        uint32_t sample_rate, size_t block_size, int async);
+int source_open_iq_file(SampleSource *source, const char *path, size_t block_size, int use_mmap);
+
+int source_read(SampleSource *source, uint8_t **block);
+uint64_t source_dropped_blocks(SampleSource *source);
+void source_close(SampleSource *source);
+
+#endif
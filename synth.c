@@ -0,0 +1,146 @@
+#include <math.h>
+#include <string.h>
+
+#include "synth.h"
+
+// Default test signal: a 1 kHz tone with the 75 kHz deviation of broadcast
+// FM, on the center frequency, without noise nor pre-emphasis.
+SynthConfig synth_default_config(int sample_rate) {
+    SynthConfig config;
+
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = sample_rate;
+    config.audio = SYNTH_TONE;
+    config.tones[0] = 1000.0;
+    config.num_tones = 1;
+    config.sweep_start = 20.0;
+    config.sweep_end = 20000.0;
+    config.sweep_seconds = 1.0;
+    config.deviation = 75000.0;
+    config.preemphasis_tau = 0.0;
+    config.carrier_offset = 0.0;
+    config.cnr_db = INFINITY;
+    config.amplitude = 1.0;
+    config.seed = 1;
+    return config;
+}
+
+// Returns 0 on success and -1 if the name is unknown.
+int synth_parse_audio(const char *name, SynthAudio *audio) {
+    if (strcmp(name, "tone") == 0) *audio = SYNTH_TONE;
+    else if (strcmp(name, "multitone") == 0) *audio = SYNTH_MULTITONE;
+    else if (strcmp(name, "sweep") == 0) *audio = SYNTH_SWEEP;
+    else return -1;
+    return 0;
+}
+
+void synth_init(SynthState *state, const SynthConfig *config) {
+    state->config = *config;
+    state->index = 0;
+    state->phase = 0.0;
+    state->last_audio = 0.0;
+    state->rng = config->seed != 0 ? config->seed : 1;
+
+    // Exact inverse of the de-emphasis filter of the demodulator, so that a
+    // pre-emphasized signal comes out with a flat response.
+    if (config->preemphasis_tau > 0.0) {
+        state->preemphasis_pole = exp(-1.0 / (config->preemphasis_tau * config->sample_rate));
+        state->preemphasis_gain = 1.0 - state->preemphasis_pole;
+    } else {
+        state->preemphasis_pole = 0.0;
+        state->preemphasis_gain = 1.0;
+    }
+
+    // The carrier has a power of (127 * amplitude)^2 in uint8 steps, split
+    // the noise power evenly between I and Q.
+    if (isfinite(config->cnr_db)) {
+        state->noise_sigma = 127.0 * config->amplitude / sqrt(2.0 * pow(10.0, config->cnr_db / 10.0));
+    } else {
+        state->noise_sigma = 0.0;
+    }
+}
+
+// Value of the audio signal at the given sample, in [-1, 1].
+double synth_audio_value(const SynthConfig *config, long index) {
+    double t = (double)index / config->sample_rate;
+
+    switch (config->audio) {
+        case SYNTH_MULTITONE: {
+            double sum = 0.0;
+            for (int k = 0; k < config->num_tones; k++) {
+                sum += sin(2.0 * M_PI * config->tones[k] * t);
+            }
+            return sum / config->num_tones;
+        }
+        case SYNTH_SWEEP: {
+            // The instantaneous frequency grows exponentially from sweep_start
+            // to sweep_end, the phase is its integral.
+            double ratio = log(config->sweep_end / config->sweep_start);
+            double ts = fmod(t, config->sweep_seconds);
+            double scale = config->sweep_start * config->sweep_seconds / ratio;
+            return sin(2.0 * M_PI * scale * (exp(ratio * ts / config->sweep_seconds) - 1.0));
+        }
+        default:
+            return sin(2.0 * M_PI * config->tones[0] * t);
+    }
+}
+
+// Uniform value in (0, 1], from a xorshift64* generator.
+static double synth_uniform(SynthState *state) {
+    state->rng ^= state->rng >> 12;
+    state->rng ^= state->rng << 25;
+    state->rng ^= state->rng >> 27;
+    return ((state->rng * 0x2545F4914F6CDD1DULL >> 11) + 1.0) / 9007199254740992.0;
+}
+
+static uint8_t synth_quantize(double value) {
+    long v = lrint(value - 0.5);
+    if (v < 0) v = 0;
+    else if (v > 255) v = 255;
+    return (uint8_t)v;
+}
+
+// Move the carrier of the station to the next sample.
+static void synth_advance(SynthState *state) {
+    const SynthConfig *config = &state->config;
+    double audio = synth_audio_value(config, state->index++);
+    double emphasized = (audio - state->preemphasis_pole * state->last_audio) / state->preemphasis_gain;
+    state->last_audio = audio;
+
+    state->phase += 2.0 * M_PI / config->sample_rate * (config->carrier_offset + config->deviation * emphasized);
+    if (state->phase > M_PI) state->phase -= 2.0 * M_PI;
+    else if (state->phase < -M_PI) state->phase += 2.0 * M_PI;
+}
+
+// Generate the next num_samples IQ pairs of the signal.
+void synth_generate(SynthState *state, uint8_t *iq, int num_samples) {
+    synth_generate_stations(state, 1, iq, num_samples);
+}
+
+// Generate the next num_samples IQ pairs of the sum of several stations, e.g.
+// with different carrier offsets like a wideband capture. The noise is the
+// one of the first station.
+void synth_generate_stations(SynthState *states, int num_stations, uint8_t *iq, int num_samples) {
+    for (int i = 0; i < num_samples; i++) {
+        double value_i = 127.5, value_q = 127.5;
+
+        for (int s = 0; s < num_stations; s++) {
+            double carrier = 127.0 * states[s].config.amplitude;
+            synth_advance(&states[s]);
+            value_i += carrier * cos(states[s].phase);
+            value_q += carrier * sin(states[s].phase);
+        }
+
+        double noise_i = 0.0, noise_q = 0.0;
+        if (states[0].noise_sigma > 0.0) {
+            // Box-Muller transform, one Gaussian value for each component.
+            double radius = states[0].noise_sigma * sqrt(-2.0 * log(synth_uniform(&states[0])));
+            double angle = 2.0 * M_PI * synth_uniform(&states[0]);
+            noise_i = radius * cos(angle);
+            noise_q = radius * sin(angle);
+        }
+
+        iq[2 * i] = synth_quantize(value_i + noise_i);
+        iq[2 * i + 1] = synth_quantize(value_q + noise_q);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdint.h>
+
+// Generator of synthetic FM signals in the rtl-sdr format, used to benchmark
+// and check the whole chain without a dongle.
+//
+// A known audio signal (one tone, several tones or a sweep) is optionally
+// pre-emphasized like broadcast transmitters do, frequency modulated with the
+// given peak deviation around a carrier that may be offset from the center
+// frequency, corrupted by white Gaussian noise and quantized to interleaved
+// uint8 I/Q samples.
+
+#define SYNTH_MAX_TONES 8
+
+typedef enum {
+    SYNTH_TONE,                 // tones[0]
+    SYNTH_MULTITONE,            // tones[0 .. num_tones - 1] with equal amplitude
+    SYNTH_SWEEP,                // Logarithmic sweep, repeated every sweep_seconds
+} SynthAudio;
+
+typedef struct {
+    int sample_rate;
+    SynthAudio audio;
+    double tones[SYNTH_MAX_TONES];  // Hz
+    int num_tones;
+    double sweep_start;         // Hz
+    double sweep_end;           // Hz
+    double sweep_seconds;
+    double deviation;           // Deviation in Hz of a full scale audio sample
+    double preemphasis_tau;     // Seconds, 0 disables the pre-emphasis
+    double carrier_offset;      // Hz
+    double cnr_db;              // Carrier to noise ratio, INFINITY for no noise
+    double amplitude;           // Carrier amplitude, 1 is full scale
+    uint64_t seed;
+} SynthConfig;
+
+typedef struct {
+    SynthConfig config;
+    long index;                 // Samples generated so far
+    double phase;               // Radians
+    double preemphasis_gain;    // Inverse of the de-emphasis filter
+    double preemphasis_pole;
+    double last_audio;
+    double noise_sigma;         // In uint8 steps
+    uint64_t rng;
+} SynthState;
+
+SynthConfig synth_default_config(int sample_rate);
+int synth_parse_audio(const char *name, SynthAudio *audio);
+void synth_init(SynthState *state, const SynthConfig *config);
+double synth_audio_value(const SynthConfig *config, long index);
+void synth_generate(SynthState *state, uint8_t *iq, int num_samples);
+void synth_generate_stations(SynthState *states, int num_stations, uint8_t *iq, int num_samples);
+
+#endif
@@ -0,0 +1,167 @@
+#include <string.h>
+
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Create a ring with room for entries requests and map its queues.
+// Returns 0 on success and -1 on failure (e.g. io_uring disabled).
+int uring_init(Uring *ring, unsigned entries) {
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(Uring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = io_uring_setup(entries, &params);
+    if (ring->fd < 0) return -1;
+    ring->entries = params.sq_entries;
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sq_map != MAP_FAILED) munmap(ring->sq_map, ring->sq_map_size);
+        if (ring->cq_map != MAP_FAILED) munmap(ring->cq_map, ring->cq_map_size);
+        if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        close(ring->fd);
+        return -1;
+    }
+
+    uint8_t *sq = ring->sq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+    uint8_t *cq = ring->cq_map;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+void uring_free(Uring *ring) {
+    munmap(ring->sq_map, ring->sq_map_size);
+    munmap(ring->cq_map, ring->cq_map_size);
+    munmap(ring->sqes, ring->sqes_size);
+    close(ring->fd);
+}
+
+// Queue a write of len bytes at offset of fd, submitted by the next
+// uring_submit(). user_data comes back with its completion.
+// Returns 0 on success and -1 if the submission queue is full.
+int uring_queue_write(Uring *ring, int fd, const void *data, unsigned len, uint64_t offset, uint64_t user_data) {
+    unsigned tail = *ring->sq_tail;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head == ring->entries) return -1;
+
+    unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+
+    // Publish the entry only after it has been filled.
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+    return 0;
+}
+
+// Submit the queued writes with a single system call, and wait until at least
+// wait_for completions are available. Returns 0 on success and -1 on failure.
+int uring_submit(Uring *ring, unsigned wait_for) {
+    if (ring->pending == 0 && wait_for == 0) return 0;
+
+    for (;;) {
+        int submitted = io_uring_enter(ring->fd, ring->pending, wait_for,
+                wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (submitted >= 0) {
+            ring->pending -= submitted;
+            return 0;
+        }
+        // The kernel may be short of memory for a moment, or busy flushing
+        // completions, try again.
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return -1;
+    }
+}
+
+// Take the next completion, if any: stores the user_data of the request and
+// its result (bytes written or -errno). Returns 1 if there was one, else 0.
+int uring_completion(Uring *ring, uint64_t *user_data, int *result) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    *user_data = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// After uring_submit() failed, take back the last queued write the kernel has
+// not consumed: stores its user_data. Returns 1 if there was one, else 0.
+int uring_take_back(Uring *ring, uint64_t *user_data) {
+    unsigned tail = *ring->sq_tail;
+    if (tail == __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE)) return 0;
+
+    tail--;
+    *user_data = ring->sqes[ring->sq_array[tail & ring->sq_mask]].user_data;
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    if (ring->pending > 0) ring->pending--;
+    return 1;
+}
+
+#else
+
+int uring_init(Uring *ring, unsigned entries) {
+    memset(ring, 0, sizeof(Uring));
+    return -1;
+}
+
+void uring_free(Uring *ring) {
+}
+
+int uring_queue_write(Uring *ring, int fd, const void *data, unsigned len, uint64_t offset, uint64_t user_data) {
+    return -1;
+}
+
+int uring_submit(Uring *ring, unsigned wait_for) {
+    return -1;
+}
+
+int uring_completion(Uring *ring, uint64_t *user_data, int *result) {
+    return 0;
+}
+
+int uring_take_back(Uring *ring, uint64_t *user_data) {
+    return 0;
+}
+
+#endif
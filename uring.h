@@ -0,0 +1,49 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimal io_uring wrapper for the writer, talking to the kernel through the
+// raw system calls so that liburing is not needed. Only available on Linux
+// with the kernel headers; elsewhere uring_init() always fails.
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned pending;           // Queued entries not yet submitted
+
+    // Submission queue, shared with the kernel.
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+
+    // Completion queue, shared with the kernel.
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+} Uring;
+
+int uring_init(Uring *ring, unsigned entries);
+void uring_free(Uring *ring);
+int uring_queue_write(Uring *ring, int fd, const void *data, unsigned len, uint64_t offset, uint64_t user_data);
+int uring_submit(Uring *ring, unsigned wait_for);
+int uring_completion(Uring *ring, uint64_t *user_data, int *result);
+int uring_take_back(Uring *ring, uint64_t *user_data);
+
+#endif
@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dsp.h"
+#include "writer.h"
+
+// Standard WAV file header structure (44 bytes).
+// This struct represents the standard RIFF/WAVE header for PCM audio.
+typedef struct {
+    // RIFF Chunk Descriptor
+    char     chunkId[4];        // "RIFF" (Big Endian)
+    uint32_t chunkSize;         // File size - 8 bytes
+    char     format[4];         // "WAVE" (Big Endian)
+    // Format Sub-chunk
+    char     fmtChunkId[4];     // "fmt " (includes trailing space)
+    uint32_t fmtChunkSize;      // Size of the fmt chunk (usually 16 for PCM)
+    uint16_t audioFormat;       // Audio format (1 = PCM, 3 = IEEE Float)
+    uint16_t numChannels;       // Number of channels (1 = Mono, 2 = Stereo)
+    uint32_t sampleRate;        // Sampling frequency in Hz (e.g., 44100)
+    uint32_t byteRate;          // Bytes per second (SampleRate * BlockAlign)
+    uint16_t blockAlign;        // Bytes per sample frame (NumChannels * BitsPerSample / 8)
+    uint16_t bitsPerSample;     // Bits per sample (e.g., 16, 24, 32)
+    // Data  Sub-chunk
+    char     dataChunkId[4];    // "data" (Big Endian)
+    uint32_t dataSize;          // Size of the raw audio data in bytes
+} WavHeader;
+
+// Fill the header of a mono 16-bit file at AUDIO_RATE holding data_bytes of
+// samples.
+static void wav_header_fill(WavHeader *header, uint64_t data_bytes) {
+    memcpy(header->chunkId, "RIFF", 4);
+    header->chunkSize = 36 + data_bytes; // Total file size - 8
+    memcpy(header->format, "WAVE", 4);
+    memcpy(header->fmtChunkId, "fmt ", 4);
+    header->fmtChunkSize = 16;
+    header->audioFormat = 1; // PCM
+    header->numChannels = 1; // Mono
+    header->sampleRate = AUDIO_RATE; // 48000
+    header->bitsPerSample = 16;
+    header->byteRate = AUDIO_RATE * 1 * 16 / 8;
+    header->blockAlign = 1 * 16 / 8;
+    memcpy(header->dataChunkId, "data", 4);
+    header->dataSize = data_bytes;  // Just the audio data size
+}
+
+// Write len bytes at offset, retrying after partial writes.
+// Returns 0 on success and -1 on failure.
+static int write_fully(int fd, const uint8_t *data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t written = pwrite(fd, data, len, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        len -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+static void writer_release_buffers(Writer *writer) {
+    if (writer->buffers != NULL) {
+        for (int k = 0; k < writer->num_buffers; k++) free(writer->buffers[k].data);
+    }
+    free(writer->buffers);
+    free(writer->pool);
+    free(writer->queue);
+    writer->buffers = NULL;
+    writer->pool = NULL;
+    writer->queue = NULL;
+}
+
+// Give a written buffer back to the pool, with the writer locked.
+static void writer_release(Writer *writer, WriterBuffer *buffer, int result) {
+    latency_record(&writer->disk, metrics_clock_ns() - buffer->submitted_ns);
+    if (result < 0) buffer->output->error = 1;
+    buffer->output->in_flight--;
+    buffer->output = NULL;
+    writer->pool[writer->num_free++] = buffer;
+    pthread_cond_broadcast(&writer->released);
+}
+
+// Take the oldest queued buffer, with the writer locked.
+static WriterBuffer *writer_dequeue(Writer *writer) {
+    WriterBuffer *buffer = writer->queue[writer->queue_head];
+    writer->queue_head = (writer->queue_head + 1) % writer->num_buffers;
+    writer->queue_len--;
+    return buffer;
+}
+
+// Body of the writer thread: write the queued buffers in order and give them
+// back to the pool, until the writer is stopped and the queue is empty.
+static void *writer_thread(void *arg) {
+    Writer *writer = arg;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (writer->queue_len == 0 && !writer->stop) {
+            pthread_cond_wait(&writer->queued, &writer->lock);
+        }
+        if (writer->queue_len == 0) break;
+
+        WriterBuffer *buffer = writer_dequeue(writer);
+        pthread_mutex_unlock(&writer->lock);
+
+        buffer->submitted_ns = metrics_clock_ns();
+        int result = write_fully(buffer->output->fd, buffer->data, buffer->len, buffer->offset);
+
+        pthread_mutex_lock(&writer->lock);
+        writer_release(writer, buffer, result);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+// Give back the buffers of the writes completed by the ring, with the writer
+// locked. Returns the number of completions.
+static int writer_uring_collect(Writer *writer) {
+    uint64_t user_data;
+    int result;
+    int count = 0;
+
+    while (uring_completion(&writer->ring, &user_data, &result)) {
+        WriterBuffer *buffer = (WriterBuffer *)(uintptr_t)user_data;
+        writer->ring_in_flight--;
+        count++;
+
+        // Short writes are completed synchronously, they only happen
+        // when the disk is full.
+        if (result >= 0 && (size_t)result < buffer->len) {
+            result = write_fully(buffer->output->fd, buffer->data + result, buffer->len - result,
+                    buffer->offset + result);
+        }
+        writer_release(writer, buffer, result);
+    }
+    return count;
+}
+
+// Body of the writer thread with io_uring: every buffer queued since the last
+// round, whatever its file, is submitted with one io_uring_enter() call that
+// also waits for the first completion, then all the available completions
+// are collected at once.
+//
+// If io_uring_enter() fails the writes the kernel did not take fail, so that
+// their files report an error when they are written to or closed. The thread
+// then waits for the writes already in the kernel and carries on without the
+// ring, as the thread backend.
+static void *writer_uring_thread(void *arg) {
+    Writer *writer = arg;
+    Uring *ring = &writer->ring;
+    int failed = 0;
+
+    pthread_mutex_lock(&writer->lock);
+    while (!failed) {
+        while (writer->queue_len == 0 && writer->ring_in_flight == 0 && !writer->stop) {
+            pthread_cond_wait(&writer->queued, &writer->lock);
+        }
+        if (writer->queue_len == 0 && writer->ring_in_flight == 0) break;
+
+        // The ring has an entry for every buffer, so it never fills up.
+        uint64_t now = metrics_clock_ns();
+        while (writer->queue_len > 0) {
+            WriterBuffer *buffer = writer_dequeue(writer);
+            buffer->submitted_ns = now;
+            uring_queue_write(ring, buffer->output->fd, buffer->data, buffer->len, buffer->offset,
+                    (uint64_t)(uintptr_t)buffer);
+            writer->ring_in_flight++;
+        }
+        pthread_mutex_unlock(&writer->lock);
+
+        failed = uring_submit(ring, 1) < 0;
+
+        pthread_mutex_lock(&writer->lock);
+        uint64_t user_data;
+        while (failed && uring_take_back(ring, &user_data)) {
+            writer->ring_in_flight--;
+            writer_release(writer, (WriterBuffer *)(uintptr_t)user_data, -1);
+        }
+        writer_uring_collect(writer);
+    }
+
+    // The completions of the writes the kernel took still come through the
+    // shared queue, without a system call.
+    while (writer->ring_in_flight > 0) {
+        if (writer_uring_collect(writer) > 0) continue;
+        pthread_mutex_unlock(&writer->lock);
+        nanosleep(&(struct timespec){ .tv_sec = 0, .tv_nsec = 1000000 }, NULL);
+        pthread_mutex_lock(&writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return failed ? writer_thread(writer) : NULL;
+}
+
+// Allocate the buffers and start the writer thread if the backend needs it,
+// for at most max_outputs files open at the same time. metrics, if not NULL,
+// receives the statistics of the queue.
+// Returns 0 on success and -1 on failure.
+int writer_init(Writer *writer, WriterBackend backend, int max_outputs, Metrics *metrics) {
+    memset(writer, 0, sizeof(Writer));
+    writer->backend = backend;
+    writer->metrics = metrics;
+    writer->num_buffers = max_outputs + WRITER_NUM_BUFFERS;
+    if (metrics != NULL) metrics->queue.capacity = writer->num_buffers;
+
+    if (backend == WRITER_STDIO) return 0;
+
+    writer->buffers = calloc(writer->num_buffers, sizeof(WriterBuffer));
+    writer->pool = calloc(writer->num_buffers, sizeof(WriterBuffer *));
+    writer->queue = calloc(writer->num_buffers, sizeof(WriterBuffer *));
+    if (writer->buffers == NULL || writer->pool == NULL || writer->queue == NULL) {
+        writer_release_buffers(writer);
+        return -1;
+    }
+    for (int k = 0; k < writer->num_buffers; k++) {
+        writer->buffers[k].data = alloc_aligned(WRITER_BUFFER_SIZE);
+        if (writer->buffers[k].data == NULL) {
+            writer_release_buffers(writer);
+            return -1;
+        }
+        writer->pool[k] = &writer->buffers[k];
+    }
+    writer->num_free = writer->num_buffers;
+
+    if (backend == WRITER_URING && uring_init(&writer->ring, writer->num_buffers) < 0) {
+        writer_release_buffers(writer);
+        return -1;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->queued, NULL);
+    pthread_cond_init(&writer->released, NULL);
+    if (pthread_create(&writer->thread, NULL, backend == WRITER_URING ? writer_uring_thread : writer_thread, writer) != 0) {
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->queued);
+        pthread_cond_destroy(&writer->released);
+        if (backend == WRITER_URING) uring_free(&writer->ring);
+        writer_release_buffers(writer);
+        return -1;
+    }
+    return 0;
+}
+
+// Stop the writer thread once the queue is empty and release the buffers.
+// Every output must have been closed.
+void writer_free(Writer *writer) {
+    if (writer->backend == WRITER_STDIO) return;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_signal(&writer->queued);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->queued);
+    pthread_cond_destroy(&writer->released);
+    if (writer->backend == WRITER_URING) uring_free(&writer->ring);
+    writer_release_buffers(writer);
+}
+
+// Returns 0 on success and -1 if the name is unknown.
+int writer_backend_from_name(const char *name, WriterBackend *backend) {
+    if (strcmp(name, "stdio") == 0) *backend = WRITER_STDIO;
+    else if (strcmp(name, "thread") == 0) *backend = WRITER_THREAD;
+    else if (strcmp(name, "uring") == 0) *backend = WRITER_URING;
+    else return -1;
+    return 0;
+}
+
+// Copy the latency of the writes issued by the writer thread so far into the
+// METRIC_DISK stage of metrics.
+void writer_collect_metrics(Writer *writer, Metrics *metrics) {
+    if (writer->backend == WRITER_STDIO) return;
+
+    pthread_mutex_lock(&writer->lock);
+    metrics->stages[METRIC_DISK] = writer->disk;
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// Take a buffer from the pool, waiting for the writer thread to release one
+// if they are all in use.
+static WriterBuffer *writer_acquire(Writer *writer) {
+    Metrics *metrics = writer->metrics;
+
+    pthread_mutex_lock(&writer->lock);
+    if (writer->num_free == 0) {
+        uint64_t start = metrics_start(metrics);
+        while (writer->num_free == 0) pthread_cond_wait(&writer->released, &writer->lock);
+        if (metrics != NULL && metrics->enabled) {
+            metrics->queue.stalls++;
+            metrics->queue.stall_ns += metrics_clock_ns() - start;
+        }
+    }
+    WriterBuffer *buffer = writer->pool[--writer->num_free];
+    pthread_mutex_unlock(&writer->lock);
+
+    return buffer;
+}
+
+// Queue the current buffer of the output for writing.
+static void writer_submit(WavOutput *output) {
+    Writer *writer = output->writer;
+    Metrics *metrics = writer->metrics;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->queue[(writer->queue_head + writer->queue_len) % writer->num_buffers] = output->current;
+    writer->queue_len++;
+    output->in_flight++;
+    if (metrics != NULL && metrics->enabled) {
+        metrics->queue.submitted++;
+        metrics->queue.depth_total += writer->queue_len;
+        if ((uint64_t)writer->queue_len > metrics->queue.max_depth) metrics->queue.max_depth = writer->queue_len;
+    }
+    pthread_cond_signal(&writer->queued);
+    pthread_mutex_unlock(&writer->lock);
+
+    output->current = NULL;
+}
+
+// Create the WAV file at path, with a placeholder header completed by
+// wav_output_close(). Returns 0 on success and -1 on failure.
+int wav_output_open(WavOutput *output, Writer *writer, const char *path) {
+    WavHeader header;
+
+    memset(output, 0, sizeof(WavOutput));
+    output->writer = writer;
+    output->fd = -1;
+    wav_header_fill(&header, 0);
+
+    if (writer->backend == WRITER_STDIO) {
+        output->file = fopen(path, "wb");
+        if (output->file == NULL) return -1;
+        fwrite(&header, sizeof(WavHeader), 1, output->file);
+        return 0;
+    }
+
+    output->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output->fd < 0) return -1;
+    if (write_fully(output->fd, (const uint8_t *)&header, sizeof(WavHeader), 0) < 0) {
+        close(output->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Append count samples to the file. With the writer thread they are only
+// copied, and written once a buffer is full.
+// Returns 0 on success and -1 if a write failed.
+int wav_output_write(WavOutput *output, const int16_t *samples, int count) {
+    Writer *writer = output->writer;
+    size_t len = count * sizeof(int16_t);
+
+    if (writer->backend == WRITER_STDIO) {
+        output->data_bytes += len;
+        return fwrite(samples, sizeof(int16_t), count, output->file) == (size_t)count ? 0 : -1;
+    }
+
+    const uint8_t *data = (const uint8_t *)samples;
+    while (len > 0) {
+        if (output->current == NULL) {
+            output->current = writer_acquire(writer);
+            output->current->output = output;
+            output->current->len = 0;
+            output->current->offset = WAV_HEADER_SIZE + output->data_bytes;
+        }
+
+        WriterBuffer *buffer = output->current;
+        size_t n = WRITER_BUFFER_SIZE - buffer->len;
+        if (n > len) n = len;
+        memcpy(buffer->data + buffer->len, data, n);
+        buffer->len += n;
+        output->data_bytes += n;
+        data += n;
+        len -= n;
+
+        if (buffer->len == WRITER_BUFFER_SIZE) writer_submit(output);
+    }
+
+    // Report the failures of the previous writes.
+    pthread_mutex_lock(&writer->lock);
+    int error = output->error;
+    pthread_mutex_unlock(&writer->lock);
+    return error ? -1 : 0;
+}
+
+// Write the last samples, wait until every buffer of the file is on disk and
+// complete the header. Returns 0 on success and -1 if a write failed.
+int wav_output_close(WavOutput *output) {
+    Writer *writer = output->writer;
+    WavHeader header;
+    int result = 0;
+
+    wav_header_fill(&header, output->data_bytes);
+
+    if (writer->backend == WRITER_STDIO) {
+        // Move the pointer at the start of the audio file, as we have to
+        // update the header to match the size of the audio file.
+        fseek(output->file, 0, SEEK_SET);
+        if (fwrite(&header, sizeof(WavHeader), 1, output->file) != 1) result = -1;
+        if (fclose(output->file) != 0) result = -1;
+        return result;
+    }
+
+    if (output->current != NULL) writer_submit(output);
+
+    pthread_mutex_lock(&writer->lock);
+    while (output->in_flight > 0) pthread_cond_wait(&writer->released, &writer->lock);
+    if (output->error) result = -1;
+    pthread_mutex_unlock(&writer->lock);
+
+    if (write_fully(output->fd, (const uint8_t *)&header, sizeof(WavHeader), 0) < 0) result = -1;
+    if (close(output->fd) != 0) result = -1;
+    return result;
+}
@@ -0,0 +1,95 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "metrics.h"
+#include "uring.h"
+
+// Output stage: WAV files written either inline with stdio, like the
+// original recorder, or by a dedicated writer thread.
+//
+// With the writer thread the DSP thread only copies the int16 samples of each
+// block into the current buffer of the file. Full buffers go through a
+// bounded queue to the writer thread, which issues one large write per
+// buffer and hands it back to the pool. The io_uring backend instead submits
+// every queued buffer, of any file, with a single system call and collects
+// the completions in batches, which keeps the number of system calls low
+// when many stations are recorded at once.
+//
+// The pool is shared by all the files of the writer: each file fills one
+// buffer at a time, and WRITER_NUM_BUFFERS more can be queued. A slow disk
+// first fills the queue, about WRITER_NUM_BUFFERS * WRITER_BUFFER_SIZE bytes
+// of audio, and only then stalls the DSP thread, which waits for a buffer to
+// come back.
+
+// Size of the buffers, and of the writes issued by the writer thread.
+#define WRITER_BUFFER_SIZE (256 * 1024)
+#define WRITER_NUM_BUFFERS 16
+
+// Size of the WAV header, the audio samples follow it.
+#define WAV_HEADER_SIZE 44
+
+typedef enum {
+    WRITER_STDIO,               // fwrite() on the DSP thread (reference)
+    WRITER_THREAD,              // Writer thread with large batched writes
+    WRITER_URING,               // Writer thread submitting through io_uring
+} WriterBackend;
+
+struct WavOutput;
+
+typedef struct {
+    struct WavOutput *output;   // File the buffer belongs to, while in use
+    uint8_t *data;              // WRITER_BUFFER_SIZE bytes
+    size_t len;
+    uint64_t offset;            // Position of the data in the file
+    uint64_t submitted_ns;      // When the writer thread issued the write
+} WriterBuffer;
+
+typedef struct {
+    WriterBackend backend;
+    Metrics *metrics;           // Queue statistics, may be NULL
+
+    // Everything below is shared with the writer thread and protected by
+    // lock. Buffers are either free, queued for writing or being filled by
+    // an output.
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;      // Signaled when a buffer is queued or on stop
+    pthread_cond_t released;    // Signaled when a buffer goes back to the pool
+    int num_buffers;
+    WriterBuffer *buffers;
+    WriterBuffer **pool;
+    int num_free;
+    WriterBuffer **queue;
+    int queue_head;
+    int queue_len;
+    int stop;
+    LatencyHistogram disk;      // Time of each write issued by the thread
+
+    Uring ring;                 // WRITER_URING, only used by the writer thread
+    int ring_in_flight;
+} Writer;
+
+typedef struct WavOutput {
+    Writer *writer;
+    FILE *file;                 // WRITER_STDIO
+    int fd;                     // WRITER_THREAD and WRITER_URING
+    uint64_t data_bytes;        // Audio bytes written so far
+    WriterBuffer *current;      // Buffer being filled, or NULL
+    int in_flight;              // Buffers queued for this file, under lock
+    int error;                  // A write failed, under lock
+} WavOutput;
+
+int writer_init(Writer *writer, WriterBackend backend, int max_outputs, Metrics *metrics);
+void writer_free(Writer *writer);
+int writer_backend_from_name(const char *name, WriterBackend *backend);
+void writer_collect_metrics(Writer *writer, Metrics *metrics);
+
+int wav_output_open(WavOutput *output, Writer *writer, const char *path);
+int wav_output_write(WavOutput *output, const int16_t *samples, int count);
+int wav_output_close(WavOutput *output);
+
+#endif